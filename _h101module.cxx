@@ -6,11 +6,19 @@
 #include <map>
 #include <unordered_map>
 #include <array>
+#include <initializer_list>
 // todo: find use cases for all the other STL containers :-P
 
 #include <string>
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <assert.h>
+#include <fnmatch.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 
 #define EXT_DATA_CLIENT_INTERNALS
@@ -38,6 +46,43 @@
 
 #define noerrno errno=0 // Python keeps errno=25 around. not very polite. 
 
+// Clock for the timing statistics (H101.timing).  rdtsc is much cheaper
+// than clock_gettime, which matters for timing single items. 
+static uint64_t stat_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+   return __rdtsc();
+#else
+   timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return uint64_t(ts.tv_sec)*1000000000+ts.tv_nsec;
+#endif
+}
+
+// calibrated once, against CLOCK_MONOTONIC
+static double stat_tick_seconds()
+{
+   static double res;
+   if (!res)
+   {
+#if defined(__x86_64__) || defined(__i386__)
+      auto ns=[]()
+      {
+	 timespec ts;
+	 clock_gettime(CLOCK_MONOTONIC, &ts);
+	 return uint64_t(ts.tv_sec)*1000000000+ts.tv_nsec;
+      };
+      uint64_t n0=ns(), t0=__rdtsc(), n1;
+      while ((n1=ns())-n0<10000000) // 10 ms
+	 ;
+      res=(n1-n0)*1e-9/(__rdtsc()-t0);
+#else
+      res=1e-9;
+#endif
+   }
+   return res;
+}
+
 static PyModuleDef h101module =
 {
     .m_base = PyModuleDef_HEAD_INIT,
@@ -51,7 +96,8 @@ enum primitive
 {
    UINT32 = 0,
    INT32  = 1,
-   FLOAT32 = 2
+   FLOAT32 = 2,
+   FLOAT64 = 3
 };
 
 PyObject* make_primitive(primitive t)
@@ -64,6 +110,8 @@ PyObject* make_primitive(primitive t)
 	   return PyArrayScalar_New(Int32);
        case FLOAT32:
 	   return PyArrayScalar_New(Float32);
+       case FLOAT64:
+	   return PyArrayScalar_New(Float64);
        default:
 	   (void)0;
     }
@@ -71,19 +119,215 @@ PyObject* make_primitive(primitive t)
 }
 
 
+// A batch of events from H101.getbatch, one event per slot. 
+struct batch_t
+{
+   const char* buf;   // H101::buf, which the item pointers refer to
+   const char* slots;
+   size_t stride;
+   npy_intp n;
+
+   // the value of the item at p (in buf) for event i
+   const uint32_t* at(const uint32_t* p, npy_intp i) const
+   {
+      return reinterpret_cast<const uint32_t*>(slots + i*stride
+		      + (reinterpret_cast<const char*>(p) - buf));
+   }
+};
+
+// One value of a field in one event, for native filling (histograms).
+// index is the channel (zero suppressed) or element number (vectors). 
+struct entry_t
+{
+   uint32_t index;
+   double value;
+};
+
+static int npy_type(primitive t)
+{
+   switch(t)
+   {
+       case INT32:
+	   return NPY_INT32;
+       case FLOAT32:
+	   return NPY_FLOAT32;
+       case FLOAT64:
+	   return NPY_FLOAT64;
+       default:
+	   return NPY_UINT32;
+   }
+}
+
+// new 1D numpy array of n entries
+template<typename T>
+static PyObject* new_column(npy_intp n, int npy_t, T** data)
+{
+   PyObject* res=PyArray_SimpleNew(1, &n, npy_t);
+   if (res)
+       *data=reinterpret_cast<T*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(res)));
+   return res;
+}
+
+// The columns of getbatch are built per chunk of events, with the slots
+// of a chunk small enough to stay in the cache (see H101_getbatch). The
+// arrays of the chunks are then appended. All arrays of the batch are
+// views of one block, so the fresh memory is one allocation (which numpy
+// backs with huge pages, from 4 MiB) instead of page faults in each.
+struct column_joiner
+{
+   PyObject* block{};
+   size_t size{};
+   char* pos{};
+
+   // f(key, arrays, offsets) for the arrays of each key of a dict
+   // column, or once with key nullptr. The "offsets" arrays (n+1
+   // entries from 0) are shifted by the entries of the chunks before.
+   template<typename F>
+   static bool each_array(const std::vector<PyObject*>& parts, F f)
+   {
+      std::vector<PyObject*> arrays;
+      if (!PyDict_Check(parts[0]))
+	  return f(nullptr, parts, false);
+      PyObject *key, *val;
+      Py_ssize_t pos=0;
+      while (PyDict_Next(parts[0], &pos, &key, &val))
+      {
+	  arrays.clear();
+	  for (auto* p: parts)
+	     arrays.push_back(PyDict_GetItem(p, key)); // borrowed
+	  const char* k=PyUnicode_AsUTF8(key);
+	  if (!k)
+	     return false;
+	  size_t len=strlen(k);
+	  if (!f(key, arrays, len>=7 && !strcmp(k+len-7, "offsets")))
+	     return false;
+      }
+      return true;
+   }
+
+   static npy_intp entries(const std::vector<PyObject*>& arrays, bool offsets)
+   {
+      npy_intp n=offsets;
+      for (auto* p: arrays)
+	  n+=PyArray_SIZE(reinterpret_cast<PyArrayObject*>(p))-offsets;
+      return n;
+   }
+
+   static size_t aligned(size_t bytes)
+   {
+      return (bytes+63)&~size_t(63);
+   }
+
+   void reserve(const std::vector<PyObject*>& parts)
+   {
+      each_array(parts, [&](PyObject*, const std::vector<PyObject*>& arrays, bool offsets) {
+	  size+=aligned(entries(arrays, offsets)*PyArray_ITEMSIZE(reinterpret_cast<PyArrayObject*>(arrays[0])));
+	  return true;
+      });
+   }
+
+   bool alloc()
+   {
+      npy_intp n=size;
+      block=PyArray_SimpleNew(1, &n, NPY_UINT8);
+      if (block)
+	  pos=reinterpret_cast<char*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(block)));
+      return block;
+   }
+
+   PyObject* join_arrays(const std::vector<PyObject*>& arrays, bool offsets)
+   {
+      auto* a0=reinterpret_cast<PyArrayObject*>(arrays[0]);
+      npy_intp n=entries(arrays, offsets);
+      size_t itemsize=PyArray_ITEMSIZE(a0);
+      PyObject* res=PyArray_New(&PyArray_Type, 1, &n, PyArray_TYPE(a0), nullptr, pos, 0, NPY_ARRAY_CARRAY, nullptr);
+      if (!res)
+	  return nullptr;
+      Py_INCREF(block);
+      if (PyArray_SetBaseObject(reinterpret_cast<PyArrayObject*>(res), block))
+      {
+	  Py_DECREF(res);
+	  return nullptr;
+      }
+      char* out=pos;
+      pos+=aligned(n*itemsize);
+      int64_t base=0;
+      bool first=true;
+      for (auto* p: arrays)
+      {
+	  auto* a=reinterpret_cast<PyArrayObject*>(p);
+	  npy_intp m=PyArray_SIZE(a);
+	  if (!offsets)
+	  {
+	     memcpy(out, PyArray_DATA(a), m*itemsize);
+	     out+=m*itemsize;
+	     continue;
+	  }
+	  const int64_t* in=reinterpret_cast<const int64_t*>(PyArray_DATA(a));
+	  int64_t* o=reinterpret_cast<int64_t*>(out);
+	  for (npy_intp j=first?0:1; j<m; j++)
+	     *(o++)=base+in[j];
+	  base+=in[m-1];
+	  first=false;
+	  out=reinterpret_cast<char*>(o);
+      }
+      return res;
+   }
+
+   // the column of all chunks, after reserve() and alloc()
+   PyObject* join(const std::vector<PyObject*>& parts)
+   {
+      if (!PyDict_Check(parts[0]))
+	  return join_arrays(parts, false);
+      PyObject* res=PyDict_New();
+      if (res && !each_array(parts, [&](PyObject* key, const std::vector<PyObject*>& arrays, bool offsets) {
+	     PyObject* a=join_arrays(arrays, offsets);
+	     bool ok=a && !PyDict_SetItem(res, key, a);
+	     Py_XDECREF(a);
+	     return ok;
+	  }))
+	  Py_CLEAR(res);
+      return res;
+   }
+
+   ~column_joiner()
+   {
+      Py_XDECREF(block); // the arrays have their references
+   }
+};
+
+// dict of the arrays of a jagged field, steals the references
+static PyObject* jagged_dict(std::initializer_list<std::pair<const char*, PyObject*>> arrays)
+{
+   PyObject* res=PyDict_New();
+   for (auto& a: arrays)
+   {
+      if (res && a.second)
+	  PyDict_SetItemString(res, a.first, a.second);
+      else
+	  Py_CLEAR(res);
+      Py_XDECREF(a.second);
+   }
+   return res;
+}
+
 struct base_iteminfo
 {
    uint32_t max_values;
    std::vector<PyObject*> value_list; // contains preconstructed items, then other stuff we still have a reference to. 
    const char* name=nullptr;
+   primitive type;
+   uint64_t ticks{}, calls{}; // for H101.stats, if timing
+   uint64_t mapped{}; // H101::lazy_event when last mapped, for H101(lazy=True)
 
-   base_iteminfo(int max_values_, primitive type)
+   base_iteminfo(int max_values_, primitive type_)
     :   max_values(max_values_)
     ,   value_list(max_values_)
+    ,   type(type_)
    {
 	for (auto& v: this->value_list)
 	{
-    	   v=make_primitive(type);
+    	   v=make_primitive(type_);
 	   Py_XINCREF(v);
 	}
    }
@@ -104,10 +348,37 @@ struct base_iteminfo
    }
    virtual int map_event() = 0;
    virtual PyObject* get_obj() = 0;
+   // batch mode: a new numpy array with one entry per event,
+   // or nullptr if the item does not support it (yet). 
+   virtual PyObject* get_column(const batch_t& b)
+   {
+      return nullptr;
+   }
+   // native filling: append the values of event i of b to out. 
+   // false if the item does not support it, or the event is broken. 
+   virtual bool get_entries(const batch_t& b, npy_intp i, std::vector<entry_t>& out)
+   {
+      return false;
+   }
+   virtual bool has_entries()
+   {
+      return false;
+   }
+   // per event state (calibrations): called by H101 for each event, before
+   // map_event, get_entries and get_column, for items in H101::stateful. 
+   // i==0 starts a new batch. 
+   virtual void prepare(const batch_t& b, npy_intp i)
+   {
+   }
+
+   double as_double(uint32_t w) const
+   {
+      return type==INT32 ? double(int32_t(w)) : double(w);
+   }
 };
 
 
-struct xint32_iteminfo: public base_iteminfo
+struct xint32_iteminfo final: public base_iteminfo
 {
     uint32_t* src;
     PyUInt32ScalarObject* dest;
@@ -130,6 +401,28 @@ struct xint32_iteminfo: public base_iteminfo
          return reinterpret_cast<PyObject*>(dest);
     }
 
+    PyObject* get_column(const batch_t& b) override
+    {
+	// int32 and uint32 have the same bits, so just copy
+	npy_intp n=b.n;
+	uint32_t* out;
+	auto* res=new_column(n, npy_type(type), &out);
+	if (!res)
+	    return nullptr;
+	for (npy_intp i=0; i<n; i++)
+	    out[i]=*b.at(this->src, i);
+	return res;
+    }
+
+    bool get_entries(const batch_t& b, npy_intp i, std::vector<entry_t>& out) override
+    {
+	out.push_back({0, as_double(*b.at(this->src, i))});
+	return true;
+    }
+    bool has_entries() override
+    {
+	return true;
+    }
 };
 
 
@@ -158,7 +451,7 @@ struct pyimp_iteminfo: public base_iteminfo
 
 
 
-struct vector_iteminfo: public base_iteminfo
+struct vector_iteminfo final: public base_iteminfo
 {
    uint32_t* length;
    uint32_t* data;
@@ -200,9 +493,64 @@ struct vector_iteminfo: public base_iteminfo
    {
       return list;
    }
+
+   // {"offsets": event i has values[offsets[i]:offsets[i+1]], "values"}
+   PyObject* get_column(const batch_t& b) override
+   {
+	int64_t *offsets;
+	uint32_t *values;
+	PyObject* o=new_column(b.n+1, NPY_INT64, &offsets);
+	if (!o)
+	    return nullptr;
+	offsets[0]=0;
+	for (npy_intp i=0; i<b.n; i++)
+	{
+	    uint32_t len=*b.at(length, i);
+	    if (len>max_values)
+	    {
+		Py_DECREF(o);
+		PyErr_Format(PyExc_ValueError, "%s: illegal length %u > %u", name, len, max_values);
+		return nullptr;
+	    }
+	    offsets[i+1]=offsets[i]+len;
+	}
+	PyObject* v=new_column(offsets[b.n], npy_type(type), &values);
+	if (v)
+	    for (npy_intp i=0; i<b.n; i++)
+		memcpy(values+offsets[i], b.at(data, i), (offsets[i+1]-offsets[i])*sizeof(uint32_t));
+	return jagged_dict({{"offsets", o}, {"values", v}});
+   }
+
+   bool get_entries(const batch_t& b, npy_intp i, std::vector<entry_t>& out) override
+   {
+	uint32_t len=*b.at(length, i);
+	if (len>max_values)
+	    return false;
+	const uint32_t* d=b.at(data, i);
+	for (uint32_t k=0; k<len; k++)
+	    out.push_back({k, as_double(d[k])});
+	return true;
+   }
+   bool has_entries() override
+   {
+	return true;
+   }
 };
 
-struct dict_iteminfo: public base_iteminfo
+// h101.ZSDict: read only mapping channel -> value of a zero suppressed
+// field for the current event, see dict_iteminfo. Plain C layout.
+struct ZSDict
+{
+   PyObject ob_base;
+   struct dict_iteminfo* item; // nullptr once the H101 is gone
+};
+
+static PyTypeObject ZSDict_type
+{
+	// fields initialized in mkZSDict_type, see H101_type
+};
+
+struct dict_iteminfo final: public base_iteminfo
 {
    dict_iteminfo(int maxlen, 
 		 uint32_t* length_,
@@ -214,35 +562,114 @@ struct dict_iteminfo: public base_iteminfo
   , keys(keys_)
   , data(data_)
   , maxlen(maxlen)
-  , dict(register_obj(PyDict_New()))
+  , present((maxlen+63)/64)
+  , view(PyObject_New(ZSDict, &ZSDict_type))
   {
       //the first half of value_list are simply the keys:
       for (int i=0; i<maxlen; i++)
 	reinterpret_cast<PyUInt32ScalarObject*>(this->value_list[i])->obval=i;
+      if (view)
+	 view->item=this;
   }
+   ~dict_iteminfo()
+   {
+      if (view)
+	 view->item=nullptr;
+      Py_XDECREF(view);
+   }
+   // no python calls: mark the channels in the bitmap, and set their
+   // (preconstructed) values
    int map_event() override
    {
-	PyDict_Clear(this->dict);
+	std::fill(present.begin(), present.end(), 0);
+	count=0;
 	auto len=*this->length;
 	CHECK( len<=maxlen, RFAIL, "Illegal length: %d > %d",len, maxlen);
 	for (uint32_t i=0; i<len; i++)
 	{
 	   uint32_t key=keys[i];
-	   uint32_t d=data[i];
-	   auto pyKey=this->value_list.at(key);
-	   CHECK(PyDict_Contains(this->dict, pyKey)==0, RFAIL, "Duplicate key %d or broken dict!", key);
-	   auto pyVal=this->value_list.at(key+maxlen);
-	   reinterpret_cast<PyUInt32ScalarObject*>(pyVal)->obval=d;
-	   int res=PyDict_SetItem(this->dict, pyKey, pyVal);
-	   CHECK(res==0, RFAIL, "PyDict_SetItem returned %d", res);
-	   //printf("dict item in %s: %d!\n", name, d);
+	   CHECK(key<maxlen, RFAIL, "Illegal key %d >= %d", key, maxlen);
+	   uint64_t bit=uint64_t(1)<<(key%64);
+	   CHECK(!(present[key/64]&bit), RFAIL, "Duplicate key %d!", key);
+	   present[key/64]|=bit;
+	   reinterpret_cast<PyUInt32ScalarObject*>(this->value_list[key+maxlen])->obval=data[i];
+	   count++;
 	}
 	return 0;
    }
 
    PyObject* get_obj() override
    {
-      return dict;
+      return reinterpret_cast<PyObject*>(view);
+   }
+
+   bool has_key(Py_ssize_t key) const
+   {
+      return key>=0 && key<maxlen && (present[key/64]>>(key%64)&1);
+   }
+   // f(key) for the channels of the current event, in ascending order
+   template<typename F>
+   void for_each_key(F f) const
+   {
+      for (size_t w=0; w<present.size(); w++)
+	 for (uint64_t bits=present[w]; bits; bits&=bits-1)
+	    f(uint32_t(w*64+__builtin_ctzll(bits)));
+   }
+   PyObject* key_obj(uint32_t key) const
+   {
+      return value_list[key];
+   }
+   PyObject* value_obj(uint32_t key) const
+   {
+      return value_list[key+maxlen];
+   }
+
+   // {"offsets": per event into "index" (channels) and "values"}
+   PyObject* get_column(const batch_t& b) override
+   {
+	int64_t *offsets;
+	uint32_t *index, *values;
+	PyObject* o=new_column(b.n+1, NPY_INT64, &offsets);
+	if (!o)
+	    return nullptr;
+	offsets[0]=0;
+	for (npy_intp i=0; i<b.n; i++)
+	{
+	    uint32_t len=*b.at(length, i);
+	    if (len>maxlen)
+	    {
+		Py_DECREF(o);
+		PyErr_Format(PyExc_ValueError, "%s: illegal length %u > %u", name, len, maxlen);
+		return nullptr;
+	    }
+	    offsets[i+1]=offsets[i]+len;
+	}
+	PyObject* k=new_column(offsets[b.n], NPY_UINT32, &index);
+	PyObject* v=new_column(offsets[b.n], npy_type(type), &values);
+	if (k && v)
+	    for (npy_intp i=0; i<b.n; i++)
+	    {
+		size_t len=offsets[i+1]-offsets[i];
+		memcpy(index+offsets[i], b.at(keys, i), len*sizeof(uint32_t));
+		memcpy(values+offsets[i], b.at(data, i), len*sizeof(uint32_t));
+	    }
+	return jagged_dict({{"offsets", o}, {"index", k}, {"values", v}});
+   }
+
+   bool get_entries(const batch_t& b, npy_intp i, std::vector<entry_t>& out) override
+   {
+	uint32_t len=*b.at(length, i);
+	if (len>maxlen)
+	    return false;
+	const uint32_t* k=b.at(keys, i);
+	const uint32_t* d=b.at(data, i);
+	for (uint32_t j=0; j<len; j++)
+	    out.push_back({k[j], as_double(d[j])});
+	return true;
+   }
+   bool has_entries() override
+   {
+	return true;
    }
 
 
@@ -250,7 +677,199 @@ struct dict_iteminfo: public base_iteminfo
    uint32_t* keys;
    uint32_t* data;
    uint32_t maxlen; // 
-   PyObject* dict;
+   std::vector<uint64_t> present; // bitmap of the channels in the current event
+   uint32_t count{};
+   ZSDict* view;
+};
+
+// the channel for key (ZSDict, MultiDict), -1 if it can not be one
+static Py_ssize_t key_channel(PyObject* key)
+{
+   if (!PyIndex_Check(key))
+      return -1;
+   Py_ssize_t res=PyNumber_AsSsize_t(key, nullptr); // clamped
+   if (res==-1 && PyErr_Occurred())
+      PyErr_Clear();
+   return res;
+}
+
+static bool ZSDict_has(ZSDict* self, PyObject* key)
+{
+   return self->item && self->item->has_key(key_channel(key));
+}
+
+static Py_ssize_t
+ZSDict_length(ZSDict* self)
+{
+   return self->item ? self->item->count : 0;
+}
+
+static PyObject *
+ZSDict_subscript(ZSDict* self, PyObject* key)
+{
+   if (!ZSDict_has(self, key))
+   {
+      PyErr_SetObject(PyExc_KeyError, key);
+      return nullptr;
+   }
+   PyObject* res=self->item->value_obj(key_channel(key));
+   Py_INCREF(res);
+   return res;
+}
+
+static int
+ZSDict_contains(ZSDict* self, PyObject* key)
+{
+   return ZSDict_has(self, key);
+}
+
+// new list of f(key) for the current channels
+template<typename F>
+static PyObject* ZSDict_list(ZSDict* self, F f)
+{
+   PyObject* res=PyList_New(ZSDict_length(self));
+   if (!res || !self->item)
+      return res;
+   Py_ssize_t i=0;
+   self->item->for_each_key([&](uint32_t key)
+   {
+      PyObject* o=f(key);
+      if (o)
+	 PyList_SET_ITEM(res, i++, o);
+   });
+   if (i!=PyList_GET_SIZE(res))
+      Py_CLEAR(res);
+   return res;
+}
+
+static PyObject *
+ZSDict_keys(ZSDict* self, PyObject *Py_UNUSED(ignored))
+{
+   return ZSDict_list(self, [&](uint32_t key)
+   {
+      PyObject* k=self->item->key_obj(key);
+      Py_INCREF(k);
+      return k;
+   });
+}
+
+static PyObject *
+ZSDict_values(ZSDict* self, PyObject *Py_UNUSED(ignored))
+{
+   return ZSDict_list(self, [&](uint32_t key)
+   {
+      PyObject* v=self->item->value_obj(key);
+      Py_INCREF(v);
+      return v;
+   });
+}
+
+static PyObject *
+ZSDict_items(ZSDict* self, PyObject *Py_UNUSED(ignored))
+{
+   return ZSDict_list(self, [&](uint32_t key)
+   {
+      return PyTuple_Pack(2, self->item->key_obj(key), self->item->value_obj(key));
+   });
+}
+
+static PyObject *
+ZSDict_get(ZSDict* self, PyObject * args)
+{
+   PyObject *key{}, *def=Py_None;
+   if (!PyArg_ParseTuple(args, "O|O:ZSDict::get", &key, &def))
+      return nullptr;
+   PyObject* res=ZSDict_has(self, key) ? self->item->value_obj(key_channel(key)) : def;
+   Py_INCREF(res);
+   return res;
+}
+
+// a dict with the current content, which the user may keep over events
+static PyObject *
+ZSDict_copy(ZSDict* self, PyObject *Py_UNUSED(ignored))
+{
+   PyObject* res=PyDict_New();
+   if (!res || !self->item)
+      return res;
+   self->item->for_each_key([&](uint32_t key)
+   {
+      PyObject* v=res ? make_primitive(self->item->type) : nullptr;
+      if (v)
+	 reinterpret_cast<PyUInt32ScalarObject*>(v)->obval=
+		 reinterpret_cast<PyUInt32ScalarObject*>(self->item->value_obj(key))->obval;
+      if (!v || PyDict_SetItem(res, self->item->key_obj(key), v)<0)
+	 Py_CLEAR(res);
+      Py_XDECREF(v);
+   });
+   return res;
+}
+
+static PyObject *
+ZSDict_iter(ZSDict* self)
+{
+   PyObject* keys=ZSDict_keys(self, nullptr);
+   if (!keys)
+      return nullptr;
+   PyObject* res=PyObject_GetIter(keys);
+   Py_DECREF(keys);
+   return res;
+}
+
+static PyObject *
+ZSDict_repr(ZSDict* self)
+{
+   PyObject* d=ZSDict_copy(self, nullptr);
+   if (!d)
+      return nullptr;
+   PyObject* res=PyObject_Repr(d);
+   Py_DECREF(d);
+   return res;
+}
+
+// compares like the dict it replaces
+static PyObject *
+ZSDict_richcompare(ZSDict* self, PyObject* other, int op)
+{
+   if (op!=Py_EQ && op!=Py_NE)
+      Py_RETURN_NOTIMPLEMENTED;
+   PyObject* d=ZSDict_copy(self, nullptr);
+   if (!d)
+      return nullptr;
+   if (PyObject_TypeCheck(other, &ZSDict_type))
+      other=ZSDict_copy(reinterpret_cast<ZSDict*>(other), nullptr);
+   else
+      Py_INCREF(other);
+   PyObject* res=other ? PyObject_RichCompare(d, other, op) : nullptr;
+   Py_DECREF(d);
+   Py_XDECREF(other);
+   return res;
+}
+
+static void
+ZSDict_dealloc(ZSDict* self)
+{
+   Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMappingMethods ZSDict_mapping=
+{
+	.mp_length=(lenfunc)ZSDict_length,
+	.mp_subscript=(binaryfunc)ZSDict_subscript,
+};
+
+static PySequenceMethods ZSDict_sequence=
+{
+	.sq_contains=(objobjproc)ZSDict_contains,
+};
+
+static PyMethodDef ZSDict_methods[] =
+{
+	{"keys", (PyCFunction)ZSDict_keys, METH_NOARGS, "List of the channels of the current event, ascending."},
+	{"values", (PyCFunction)ZSDict_values, METH_NOARGS, "List of the values of the current event, by channel."},
+	{"items", (PyCFunction)ZSDict_items, METH_NOARGS, "List of (channel, value) of the current event."},
+	{"get", (PyCFunction)ZSDict_get, METH_VARARGS, "The value of a channel, or the default (None) if it has none."},
+	{"copy", (PyCFunction)ZSDict_copy, METH_NOARGS, "A dict with copies of the current channels and values."},
+	{nullptr}
 };
 
 using str2item=std::map<std::string, ext_data_structure_item*>; 
@@ -308,19 +927,57 @@ struct dict_of_lists_iteminfo: public base_iteminfo // abstract!
 
 };
 
-struct mult_iteminfo: public dict_of_lists_iteminfo
+// h101.MultiDict: read only mapping channel -> HitList of a zero
+// suppressed multi hit field for the current event, see mult_iteminfo.
+struct MultiDict
+{
+   PyObject ob_base;
+   struct mult_iteminfo* item; // nullptr once the H101 is gone
+};
+
+// h101.HitList: read only sequence view of the hits of one channel in the
+// current event, empty if it has none. There is one per channel, kept
+// over events.
+struct HitList
+{
+   PyObject ob_base;
+   struct mult_iteminfo* item;
+   uint32_t channel;
+};
+
+static PyTypeObject MultiDict_type
+{
+	// fields initialized in mkMultiDict_type, see H101_type
+};
+static PyTypeObject HitList_type
+{
+	// fields initialized in mkHitList_type
+};
+
+struct mult_iteminfo final: public base_iteminfo
 {
     uint32_t *v_length, *v_data;
     uint32_t *m_length, *m_indices, *m_ends;
     bool failed=0;
+    bool missing=0; // the pointers above are not into the event buffer
+    uint32_t max_entries{}; // words of XMI
+    // the current event in CSR form: channel entry e has the hits
+    // value_list[begin(e):ends[e]]. Copied, no python calls per hit.
+    std::vector<uint32_t> chans, ends;
+    std::vector<int32_t> slot;    // channel -> entry, -1 if no hits
+    static const uint32_t max_channel=1<<20; // against broken events
+    std::vector<PyObject*> keys;  // channel -> key, made when first seen
+    std::vector<HitList*> views;  // channel -> view, made when first asked for
+    MultiDict* view;
     mult_iteminfo(uint32_t maxlen, std::string basename,
 		  char* buf, str2item m, primitive t)
-	    : dict_of_lists_iteminfo(maxlen, t)
+	    : base_iteminfo(maxlen, t)
 	    , v_length(   getPayload(buf, m, basename)      )
 	    , v_data(     getPayload(buf, m, basename+"v")  )
 	    , m_length(   getPayload(buf, m, basename+"M")  )
 	    , m_indices(  getPayload(buf, m, basename+"MI") )
 	    , m_ends(     getPayload(buf, m, basename+"ME") )
+	    , view(PyObject_New(MultiDict, &MultiDict_type))
     {
 	static uint32_t zero=0;
         if (!v_length || !v_data || !m_length || !m_indices || !m_ends)
@@ -328,155 +985,990 @@ struct mult_iteminfo: public dict_of_lists_iteminfo
 	   fprintf(stderr, "Required item(s) for ZZM %s not found, it will not be filled.\n", basename.c_str());
 	   v_length=&zero;
 	   m_length=&zero;
+	   missing=1;
 	}
+	else
+	   max_entries=getIfPresent(m, basename+"MI")->_length/4;
+	if (view)
+	   view->item=this;
+    }
+    ~mult_iteminfo()
+    {
+	for (auto* v: views)
+	   if (v)
+	   {
+	      v->item=nullptr;
+	      Py_DECREF(v);
+	   }
+	for (auto* k: keys)
+	   Py_XDECREF(k);
+	if (view)
+	   view->item=nullptr;
+	Py_XDECREF(view);
     }
 
     int map_event() override
     {
 	failed=0;
-	// always clear all nonempty lists in the beginning
-	// if the user has a previously obtained reference to any particular list
-	// there should not be data from prior events in it. 
-	for (auto p:this->current_lists)
-	    PyList_SetSlice(p, 0, PY_SSIZE_T_MAX, NULL); // aka PyList_Clear
-	this->current_lists.clear();
-	PyDict_Clear(this->dict);
+	// views kept from the last event are empty unless their channel
+	// has hits again
+	for (auto c: chans)
+	    slot[c]=-1;
+	chans.clear();
+	ends.clear();
 
-	CHECK(*v_length<=max_values, failed=RFAIL, "Illegal length: %d > %d", *v_length, max_values);
-	CHECK(*v_length==0 || *v_length==m_ends[*m_length-1], failed=RFAIL, "Inconsistent length for ZZM. %s", "");
+	uint32_t vlen=*v_length, mlen=*m_length;
+	CHECK(vlen<=max_values, failed=RFAIL, "Illegal length: %d > %d", vlen, max_values);
+	CHECK(mlen<=max_entries, failed=RFAIL, "Illegal length: %d > %d", mlen, max_entries);
+	CHECK(vlen==0 || (mlen && vlen==m_ends[mlen-1]), failed=RFAIL, "Inconsistent length for ZZM. %s", "");
 
 	uint32_t j=0;
-	for (uint32_t i=0; i<*m_length; i++)
+	for (uint32_t i=0; i<mlen; i++)
 	{
-	   auto k=m_indices[i];
-	   PyObject* list=find_or_make_list(k);
-           for(; j<m_ends[i]; j++)
+	   uint32_t k=m_indices[i], end=m_ends[i];
+	   if (k>=slot.size())
+	   {
+	      CHECK(k<max_channel, failed=RFAIL, "Illegal channel %d >= %d", k, max_channel);
+	      slot.resize(k+1, -1);
+	      keys.resize(k+1, nullptr);
+	      views.resize(k+1, nullptr);
+	   }
+	   CHECK(slot[k]<0, failed=RFAIL, "Duplicate channel %d!", k);
+	   CHECK(j<=end && end<=vlen, failed=RFAIL, "Inconsistent ends for ZZM. %s", "");
+	   if (!keys[k])
 	   {
-	     PyObject* pyVal=this->value_list.at(j);
-	     reinterpret_cast<PyUInt32ScalarObject*>(pyVal)->obval=v_data[j];
-	     PyList_Append(list, pyVal);
+	      keys[k]=PyArrayScalar_New(UInt32);
+	      CHECK(keys[k], failed=RFAIL, "no memory for channel %d", k);
+	      reinterpret_cast<PyUInt32ScalarObject*>(keys[k])->obval=k;
 	   }
+           for(; j<end; j++)
+	     reinterpret_cast<PyUInt32ScalarObject*>(this->value_list[j])->obval=v_data[j];
+	   slot[k]=chans.size();
+	   chans.push_back(k);
+	   ends.push_back(end);
 	}
 	return 0;
     }
 
-};
-
-
-#if 0 ////////////////////////////
-struct finetime_hist
-{
-	const size_t TDCBINS         = 512;
-	const size_t UPDATE_INTERVAL = 1000;   // how often should we update the calibration?
-	const size_t MINSTAT         = 10000;  // min statistics before returning non-NaN results.
-	const size_t STAT_LIFETIME   = 100000; // time after which a count is downscaled to 1/e.
-	std::array<double, TDCBINS> pdf{};
-
-	int newcounts=0;
+    PyObject* get_obj() override
+    {
+       return reinterpret_cast<PyObject*>(view);
+    }
 
-	std::array<double, TDCBINS> cdf{};
+    bool has_channel(Py_ssize_t k) const
+    {
+       return k>=0 && size_t(k)<slot.size() && slot[k]>=0;
+    }
+    // the hits of channel k are value_list[*begin:*end]
+    void hits(uint32_t k, uint32_t* begin, uint32_t* end) const
+    {
+       int32_t e=k<slot.size() ? slot[k] : -1;
+       *begin=e>0 ? ends[e-1] : 0;
+       *end=e>=0 ? ends[e] : 0;
+    }
+    PyObject* get_view(uint32_t k)
+    {
+       if (!views[k])
+       {
+	  views[k]=PyObject_New(HitList, &HitList_type);
+	  if (!views[k])
+	     return nullptr;
+	  views[k]->item=this;
+	  views[k]->channel=k;
+       }
+       return reinterpret_cast<PyObject*>(views[k]);
+    }
 
-	void update_cdf()
+    // {"offsets": per event into "index" (channels) and "hit_offsets",
+    //  "hit_offsets": channel entry j has values[hit_offsets[j]:hit_offsets[j+1]],
+    //  "values"}
+    PyObject* get_column(const batch_t& b) override
+    {
+	if (missing)
+	    return nullptr;
+	int64_t *offsets, *hit_offsets;
+	uint32_t *index, *values;
+	PyObject* o=new_column(b.n+1, NPY_INT64, &offsets);
+	if (!o)
+	    return nullptr;
+	offsets[0]=0;
+	npy_intp nvalues=0;
+	for (npy_intp i=0; i<b.n; i++)
 	{
-	     if (pdf_int<MINSTAT)
-		return;
-	     double s=0;
-
-	     double pdf_int = 0;
-	     for (int i=0; i<TDCBINS; i++)
-		pdf_int+=pdf[i];
-
-	     for (int i=0; i<TDCBINS; i++)
-	     {
-		s+=pdf[i]/2/pdf_int;
-		cdf[i]=s;
-		s+=pdf[i]/2/pdf_int;
-		pdf[i]*=exp(-UPDATE_INTERVAL/STAT_LIFETIME);
-	     }
-	     newcounts=0;
-        }
-
-	double apply(uint32_t fine)
+	    uint32_t vlen=*b.at(v_length, i), mlen=*b.at(m_length, i);
+	    const uint32_t* ends=b.at(m_ends, i);
+	    // same checks as map_event, and the ends must not go back
+	    bool bad=vlen>max_values || (vlen && mlen==0) || (mlen && ends[mlen-1]!=vlen);
+	    for (uint32_t j=1; j<mlen && !bad; j++)
+		bad=ends[j]<ends[j-1];
+	    if (bad)
+	    {
+		Py_DECREF(o);
+		PyErr_Format(PyExc_ValueError, "%s: inconsistent lengths for ZZM (%u values, %u channels)", name, vlen, mlen);
+		return nullptr;
+	    }
+	    offsets[i+1]=offsets[i]+mlen;
+	    nvalues+=vlen;
+	}
+	PyObject* k=new_column(offsets[b.n], NPY_UINT32, &index);
+	PyObject* h=new_column(offsets[b.n]+1, NPY_INT64, &hit_offsets);
+	PyObject* v=new_column(nvalues, npy_type(type), &values);
+	if (k && h && v)
 	{
-	    if (fine>=TDCBINS)
-	        return NAN;
-	    pdf[fine]+=1.0;
-	    newcount++;
-	    if (newcount>=UPDATE_INTERVAL)
-		update_cdf();
-	    return cdf[fine];
+	    int64_t base=0; // first value of the event
+	    hit_offsets[0]=0;
+	    for (npy_intp i=0; i<b.n; i++)
+	    {
+		size_t mlen=offsets[i+1]-offsets[i];
+		const uint32_t* ends=b.at(m_ends, i);
+		memcpy(index+offsets[i], b.at(m_indices, i), mlen*sizeof(uint32_t));
+		for (size_t j=0; j<mlen; j++)
+		    hit_offsets[offsets[i]+j+1]=base+ends[j];
+		uint32_t vlen=*b.at(v_length, i);
+		memcpy(values+base, b.at(v_data, i), vlen*sizeof(uint32_t));
+		base+=vlen;
+	    }
 	}
-	
+	return jagged_dict({{"offsets", o}, {"index", k}, {"hit_offsets", h}, {"values", v}});
+    }
 
-	finetime_hist()
+    // one entry per hit, with the channel as index
+    bool get_entries(const batch_t& b, npy_intp i, std::vector<entry_t>& out) override
+    {
+	uint32_t vlen=*b.at(v_length, i), mlen=*b.at(m_length, i);
+	const uint32_t* ends=b.at(m_ends, i);
+	const uint32_t* chans=b.at(m_indices, i);
+	const uint32_t* d=b.at(v_data, i);
+	if (vlen>max_values || (vlen && mlen==0) || (mlen && ends[mlen-1]!=vlen))
+	    return false;
+	uint32_t j=0;
+	for (uint32_t c=0; c<mlen; c++)
 	{
-	    for (int i=0; i<TDCBINS; i++)
+	    if (ends[c]>vlen)
+		return false;
+	    for (; j<ends[c]; j++)
+		out.push_back({chans[c], as_double(d[j])});
 	}
-};
-
-struct tdc_iteminfo: public base_iteminfo
+	return true;
+    }
+    bool has_entries() override
+    {
+	return !missing;
+    }
+
+};
+
+
+static Py_ssize_t
+HitList_length(HitList* self)
 {
-	const double COARSE_PERIOD=5; //ns
-	const size_t COARSE_WRAP=1024;
+   uint32_t begin{}, end{};
+   if (self->item)
+      self->item->hits(self->channel, &begin, &end);
+   return end-begin;
+}
 
-	std::map<uint32_t, finetime_hist> > hists;
-	multi_iteminfo *coarse{}, *fine{};
-	PyObject* dict;
+// list of copies of the hits in [lo:hi:step]
+static PyObject* HitList_slice(HitList* self, Py_ssize_t lo, Py_ssize_t step, Py_ssize_t n)
+{
+   PyObject* res=PyList_New(n);
+   if (!res || !n)
+      return res;
+   uint32_t begin{}, end{};
+   self->item->hits(self->channel, &begin, &end);
+   for (Py_ssize_t i=0; i<n; i++)
+   {
+      PyObject* v=make_primitive(self->item->type);
+      if (!v)
+      {
+	 Py_DECREF(res);
+	 return nullptr;
+      }
+      reinterpret_cast<PyUInt32ScalarObject*>(v)->obval=
+	      reinterpret_cast<PyUInt32ScalarObject*>(self->item->value_list[begin+lo+i*step])->obval;
+      PyList_SET_ITEM(res, i, v);
+   }
+   return res;
+}
 
-	static tdc_iteminfo* create(uint32_t maxlength, multi_iteminfo *c, multi_iteminfo *f)
-	{
-	     if (c->max_values!=f->max_values)
-		return nullptr;
-	     auto res=new tdc_iteminfo;
-	     res->coarse=c;
-	     res->fine=f;
-	     return res;
-	}
+static PyObject *
+HitList_subscript(HitList* self, PyObject* key)
+{
+   Py_ssize_t n=HitList_length(self);
+   if (PySlice_Check(key))
+   {
+      Py_ssize_t lo, hi, step;
+      if (PySlice_Unpack(key, &lo, &hi, &step)<0)
+	 return nullptr;
+      return HitList_slice(self, lo, step, PySlice_AdjustIndices(n, &lo, &hi, step));
+   }
+   Py_ssize_t i=PyNumber_AsSsize_t(key, PyExc_IndexError);
+   if (i==-1 && PyErr_Occurred())
+      return nullptr;
+   if (i<0)
+      i+=n;
+   if (i<0 || i>=n)
+   {
+      PyErr_SetString(PyExc_IndexError, "HitList index out of range");
+      return nullptr;
+   }
+   uint32_t begin{}, end{};
+   self->item->hits(self->channel, &begin, &end);
+   PyObject* res=self->item->value_list[begin+i];
+   Py_INCREF(res);
+   return res;
+}
 
-	private:
-	tdc_iteminfo(uint32_t maxlength)
-	 : dict_of_lists_iteminfo(maxlength, FLOAT32)
-	{}
-	
-    PyObject* get_obj() override
-    {
-       return dict;
-    }
+static PyObject *
+HitList_item(HitList* self, Py_ssize_t i)
+{
+   PyObject* key=PyLong_FromSsize_t(i);
+   if (!key)
+      return nullptr;
+   PyObject* res=HitList_subscript(self, key);
+   Py_DECREF(key);
+   return res;
+}
 
-    int map_event() override
-    {
-	for (auto p:this->current_lists)
-	    PyList_SetSlice(p, 0, PY_SSIZE_T_MAX, NULL); // aka PyList_Clear
-	this->current_lists.clear();
-	PyDict_Clear(this->dict);
-	if (coarse->failed || fine->failed) 
+// a list with copies of the current hits, which the user may keep over events
+static PyObject *
+HitList_copy(HitList* self, PyObject *Py_UNUSED(ignored))
+{
+   return HitList_slice(self, 0, 1, HitList_length(self));
+}
+
+static PyObject *
+HitList_repr(HitList* self)
+{
+   PyObject* l=HitList_copy(self, nullptr);
+   if (!l)
+      return nullptr;
+   PyObject* res=PyObject_Repr(l);
+   Py_DECREF(l);
+   return res;
+}
+
+// compares like the list it replaces
+static PyObject *
+HitList_richcompare(HitList* self, PyObject* other, int op)
+{
+   PyObject* l=HitList_copy(self, nullptr);
+   if (!l)
+      return nullptr;
+   if (PyObject_TypeCheck(other, &HitList_type))
+      other=HitList_copy(reinterpret_cast<HitList*>(other), nullptr);
+   else
+      Py_INCREF(other);
+   PyObject* res=other ? PyObject_RichCompare(l, other, op) : nullptr;
+   Py_DECREF(l);
+   Py_XDECREF(other);
+   return res;
+}
+
+static void
+HitList_dealloc(HitList* self)
+{
+   Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMappingMethods HitList_mapping=
+{
+	.mp_length=(lenfunc)HitList_length,
+	.mp_subscript=(binaryfunc)HitList_subscript,
+};
+
+static PySequenceMethods HitList_sequence=
+{
+	.sq_length=(lenfunc)HitList_length,
+	.sq_item=(ssizeargfunc)HitList_item,
+};
+
+static PyMethodDef HitList_methods[] =
+{
+	{"copy", (PyCFunction)HitList_copy, METH_NOARGS, "A list with copies of the current hits."},
+	{nullptr}
+};
+
+static Py_ssize_t
+MultiDict_length(MultiDict* self)
+{
+   return self->item ? self->item->chans.size() : 0;
+}
+
+static bool MultiDict_has(MultiDict* self, PyObject* key)
+{
+   return self->item && self->item->has_channel(key_channel(key));
+}
+
+static PyObject *
+MultiDict_subscript(MultiDict* self, PyObject* key)
+{
+   if (!MultiDict_has(self, key))
+   {
+      PyErr_SetObject(PyExc_KeyError, key);
+      return nullptr;
+   }
+   PyObject* res=self->item->get_view(key_channel(key));
+   Py_XINCREF(res);
+   return res;
+}
+
+static int
+MultiDict_contains(MultiDict* self, PyObject* key)
+{
+   return MultiDict_has(self, key);
+}
+
+// new list of f(channel) for the channels of the current event, in order
+template<typename F>
+static PyObject* MultiDict_list(MultiDict* self, F f)
+{
+   Py_ssize_t n=MultiDict_length(self);
+   PyObject* res=PyList_New(n);
+   for (Py_ssize_t i=0; res && i<n; i++)
+   {
+      PyObject* o=f(self->item->chans[i]);
+      if (!o)
+	 Py_CLEAR(res);
+      else
+	 PyList_SET_ITEM(res, i, o);
+   }
+   return res;
+}
+
+static PyObject *
+MultiDict_keys(MultiDict* self, PyObject *Py_UNUSED(ignored))
+{
+   return MultiDict_list(self, [&](uint32_t k)
+   {
+      PyObject* key=self->item->keys[k];
+      Py_INCREF(key);
+      return key;
+   });
+}
+
+static PyObject *
+MultiDict_values(MultiDict* self, PyObject *Py_UNUSED(ignored))
+{
+   return MultiDict_list(self, [&](uint32_t k)
+   {
+      PyObject* v=self->item->get_view(k);
+      Py_XINCREF(v);
+      return v;
+   });
+}
+
+static PyObject *
+MultiDict_items(MultiDict* self, PyObject *Py_UNUSED(ignored))
+{
+   return MultiDict_list(self, [&](uint32_t k)
+   {
+      PyObject* v=self->item->get_view(k);
+      return v ? PyTuple_Pack(2, self->item->keys[k], v) : nullptr;
+   });
+}
+
+static PyObject *
+MultiDict_get(MultiDict* self, PyObject * args)
+{
+   PyObject *key{}, *def=Py_None;
+   if (!PyArg_ParseTuple(args, "O|O:MultiDict::get", &key, &def))
+      return nullptr;
+   if (MultiDict_has(self, key))
+      return MultiDict_subscript(self, key);
+   Py_INCREF(def);
+   return def;
+}
+
+// a dict of lists with the current hits, which the user may keep over events
+static PyObject *
+MultiDict_copy(MultiDict* self, PyObject *Py_UNUSED(ignored))
+{
+   PyObject* res=PyDict_New();
+   Py_ssize_t n=MultiDict_length(self);
+   for (Py_ssize_t i=0; res && i<n; i++)
+   {
+      uint32_t k=self->item->chans[i];
+      HitList* v=reinterpret_cast<HitList*>(self->item->get_view(k));
+      PyObject* l=v ? HitList_copy(v, nullptr) : nullptr;
+      if (!l || PyDict_SetItem(res, self->item->keys[k], l)<0)
+	 Py_CLEAR(res);
+      Py_XDECREF(l);
+   }
+   return res;
+}
+
+static PyObject *
+MultiDict_iter(MultiDict* self)
+{
+   PyObject* keys=MultiDict_keys(self, nullptr);
+   if (!keys)
+      return nullptr;
+   PyObject* res=PyObject_GetIter(keys);
+   Py_DECREF(keys);
+   return res;
+}
+
+static PyObject *
+MultiDict_repr(MultiDict* self)
+{
+   PyObject* d=MultiDict_copy(self, nullptr);
+   if (!d)
+      return nullptr;
+   PyObject* res=PyObject_Repr(d);
+   Py_DECREF(d);
+   return res;
+}
+
+// compares like the dict of lists it replaces
+static PyObject *
+MultiDict_richcompare(MultiDict* self, PyObject* other, int op)
+{
+   if (op!=Py_EQ && op!=Py_NE)
+      Py_RETURN_NOTIMPLEMENTED;
+   PyObject* d=MultiDict_copy(self, nullptr);
+   if (!d)
+      return nullptr;
+   if (PyObject_TypeCheck(other, &MultiDict_type))
+      other=MultiDict_copy(reinterpret_cast<MultiDict*>(other), nullptr);
+   else
+      Py_INCREF(other);
+   PyObject* res=other ? PyObject_RichCompare(d, other, op) : nullptr;
+   Py_DECREF(d);
+   Py_XDECREF(other);
+   return res;
+}
+
+static void
+MultiDict_dealloc(MultiDict* self)
+{
+   Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMappingMethods MultiDict_mapping=
+{
+	.mp_length=(lenfunc)MultiDict_length,
+	.mp_subscript=(binaryfunc)MultiDict_subscript,
+};
+
+static PySequenceMethods MultiDict_sequence=
+{
+	.sq_contains=(objobjproc)MultiDict_contains,
+};
+
+static PyMethodDef MultiDict_methods[] =
+{
+	{"keys", (PyCFunction)MultiDict_keys, METH_NOARGS, "List of the channels with hits in the current event."},
+	{"values", (PyCFunction)MultiDict_values, METH_NOARGS, "List of the HitList views of these channels."},
+	{"items", (PyCFunction)MultiDict_items, METH_NOARGS, "List of (channel, HitList) of the current event."},
+	{"get", (PyCFunction)MultiDict_get, METH_VARARGS, "The HitList of a channel, or the default (None) if it has no hits."},
+	{"copy", (PyCFunction)MultiDict_copy, METH_NOARGS, "A dict of lists with copies of the current hits."},
+	{nullptr}
+};
+
+
+// uniform numbers in [0, 1), made in blocks from independent xorshift64
+// lanes, so that the refill loop vectorizes
+struct block_rng
+{
+   static constexpr int LANES=4, BLOCK=256;
+   uint64_t s[LANES];
+   double buf[BLOCK];
+   int pos=BLOCK;
+
+   block_rng(uint64_t seed=0x5eed)
+   {
+      for (int l=0; l<LANES; l++)
+      {
+	 // splitmix64, so that the lanes differ
+	 uint64_t z=(seed+=0x9e3779b97f4a7c15ULL);
+	 z=(z^(z>>30))*0xbf58476d1ce4e5b9ULL;
+	 z=(z^(z>>27))*0x94d049bb133111ebULL;
+	 s[l]=(z^(z>>31)) | 1;
+      }
+   }
+
+   void refill()
+   {
+      for (int j=0; j<BLOCK; j+=LANES)
+	 for (int l=0; l<LANES; l++)
+	 {
+	    uint64_t x=s[l];
+	    x^=x<<13;
+	    x^=x>>7;
+	    x^=x<<17;
+	    s[l]=x;
+	    buf[j+l]=double(x>>11)*0x1p-53;
+	 }
+      pos=0;
+   }
+
+   double next()
+   {
+      if (pos==BLOCK)
+	 refill();
+      return buf[pos++];
+   }
+};
+
+// parameters of the fine time calibration, see h101/tdc_cal.py
+struct finetime_params
+{
+   uint32_t finebins=1024;
+   double mincount=1e4;         // statistics required before the calibration is updated
+   uint64_t update_interval=2000; // how often the CDF is recalculated
+   double stat_lifetime=1e5;    // how long a count contributes
+};
+
+// Fine time calibration of one TDC channel, as finetime_cal in
+// h101/tdc_cal.py: the PMF of the fine times decays, and the CDF is
+// recalculated from it every update_interval counts. 
+struct finetime_cal
+{
+   std::vector<float> pmf, cdf; // cdf is nan until calibrated
+   uint64_t count{};
+
+   finetime_cal(uint32_t finebins)
+   : pmf(finebins, 0.0f)
+   , cdf(finebins, NAN)
+   {
+   }
+
+   // the prefix sum, only on updates
+   void update_cdf(const finetime_params& p)
+   {
+      double tot=0;
+      for (auto v: pmf)
+	 tot+=v;
+      float scale=exp(-double(p.update_interval)/p.stat_lifetime);
+      double s=0;
+      for (size_t i=0; i<pmf.size(); i++)
+      {
+	 s+=pmf[i]/tot;
+	 cdf[i]=s;
+	 pmf[i]*=scale; // decay
+      }
+   }
+
+   // calibrated fine time in [0, 1], or nan. true if the CDF was updated. 
+   bool cal(uint32_t raw, const finetime_params& p, block_rng& rng, double* res)
+   {
+      if (raw>=pmf.size() || raw==0)
+      {
+	 *res=NAN;
+	 return false;
+      }
+      pmf[raw]+=1;
+      count++;
+      bool update=count>=p.mincount && count%p.update_interval==0;
+      if (update)
+	 update_cdf(p);
+      double lo=cdf[raw-1], hi=cdf[raw];
+      *res=lo+(hi-lo)*rng.next();
+      return update;
+   }
+};
+
+// TDC times from coarse and fine counter fields, with the fine times
+// calibrated on the fly (see finetime_cal).  Per channel, a list of
+// times (coarse - fine) * period in the dict. 
+// The calibrations are read from and written to the cals dict with
+// names prefix + channel, like h101.tdc_cal.allcals. 
+struct tdc_iteminfo: public dict_of_lists_iteminfo
+{
+   base_iteminfo *coarse, *fine;
+   std::string prefix;
+   double period;
+   finetime_params params;
+   PyObject* cals; // or nullptr
+   std::unordered_map<uint32_t, finetime_cal> chans;
+   block_rng rng;
+   std::vector<entry_t> c_tmp, f_tmp;
+   // from prepare: the hits of slot i are hits[offsets[i]:offsets[i+1]]
+   std::vector<entry_t> hits;
+   std::vector<size_t> offsets;
+   std::vector<PyObject*> values; // float64 scalars for the lists
+   uint64_t unpaired{}; // hits without coarse or fine time, skipped
+
+   tdc_iteminfo(base_iteminfo* coarse_, base_iteminfo* fine_, const std::string& prefix_,
+		   double period_, const finetime_params& params_, PyObject* cals_)
+   : dict_of_lists_iteminfo(0, FLOAT64)
+   , coarse(coarse_)
+   , fine(fine_)
+   , prefix(prefix_)
+   , period(period_)
+   , params(params_)
+   , cals(cals_ ? register_obj(cals_) : nullptr)
+   , offsets(1, 0)
+   {
+      max_values=coarse->max_values; // indexed, for expressions
+   }
+
+   ~tdc_iteminfo() override
+   {
+      for (auto v: values)
+	 Py_DECREF(v);
+   }
+
+   finetime_cal& get_cal(uint32_t ch)
+   {
+      auto it=chans.find(ch);
+      if (it!=chans.end())
+	 return it->second;
+      auto& cal=chans.emplace(ch, finetime_cal(params.finebins)).first->second;
+      PyObject* loaded=cals ? PyDict_GetItemString(cals, (prefix+std::to_string(ch)).c_str()) : nullptr;
+      PyObject* seq=loaded ? PySequence_Fast(loaded, "") : nullptr;
+      if (seq && PySequence_Fast_GET_SIZE(seq)==Py_ssize_t(cal.cdf.size()))
+	 for (size_t i=0; i<cal.cdf.size(); i++)
+	    cal.cdf[i]=PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, i));
+      Py_XDECREF(seq);
+      PyErr_Clear(); // not a calibration, start blank
+      return cal;
+   }
+
+   void store_cal(uint32_t ch, const finetime_cal& cal)
+   {
+      if (!cals)
+	 return;
+      PyObject* list=PyList_New(cal.cdf.size());
+      if (!list)
+	 return;
+      for (size_t i=0; i<cal.cdf.size(); i++)
+	 PyList_SET_ITEM(list, i, PyFloat_FromDouble(cal.cdf[i]));
+      PyDict_SetItemString(cals, (prefix+std::to_string(ch)).c_str(), list);
+      Py_DECREF(list);
+   }
+
+   void prepare(const batch_t& b, npy_intp i) override
+   {
+      if (i==0)
+      {
+	 hits.clear();
+	 offsets.assign(1, 0);
+      }
+      c_tmp.clear();
+      f_tmp.clear();
+      if (coarse->get_entries(b, i, c_tmp) && fine->get_entries(b, i, f_tmp))
+      {
+	 // usually the same channels and hits in the same order. Else the
+	 // hits of each channel are paired in order (as zip() in python),
+	 // and only the ones left over are skipped.
+	 auto same_ch=[](const entry_t& a, const entry_t& b) { return a.index==b.index; };
+	 if (c_tmp.size()!=f_tmp.size() || !std::equal(c_tmp.begin(), c_tmp.end(), f_tmp.begin(), same_ch))
+	 {
+	    auto lt=[](const entry_t& a, const entry_t& b) { return a.index<b.index; };
+	    std::stable_sort(c_tmp.begin(), c_tmp.end(), lt);
+	    std::stable_sort(f_tmp.begin(), f_tmp.end(), lt);
+	 }
+	 uint64_t skipped=unpaired;
+	 size_t kc=0, kf=0;
+	 while (kc<c_tmp.size() && kf<f_tmp.size())
+	 {
+	    uint32_t ch=c_tmp[kc].index;
+	    if (f_tmp[kf].index!=ch)
+	    {
+	       (f_tmp[kf].index<ch ? kf : kc)++;
+	       unpaired++;
+	       continue;
+	    }
+	    auto& cal=get_cal(ch);
+	    double f;
+	    if (cal.cal(f_tmp[kf].value>0 ? uint32_t(f_tmp[kf].value) : 0, params, rng, &f))
+	       store_cal(ch, cal);
+	    hits.push_back({ch, (c_tmp[kc].value-f)*period});
+	    kc++;
+	    kf++;
+	 }
+	 unpaired+=c_tmp.size()-kc+f_tmp.size()-kf;
+	 if (!skipped && unpaired)
+	    fprintf(stderr, "%s: hits without matching coarse and fine time, skipped "
+			    "(further ones silently).\n", prefix.c_str());
+      }
+      offsets.push_back(hits.size());
+   }
+
+   int map_event() override
+   {
+      for (auto p:this->current_lists)
+	 PyList_SetSlice(p, 0, PY_SSIZE_T_MAX, NULL); // aka PyList_Clear
+      this->current_lists.clear();
+      PyDict_Clear(this->dict);
+      size_t n=offsets.size()>1 ? offsets[1] : 0;
+      while (values.size()<n)
+	 values.push_back(make_primitive(FLOAT64));
+      PyObject* list{};
+      for (size_t j=0; j<n; j++)
+      {
+	 if (!j || hits[j].index!=hits[j-1].index)
+	    list=find_or_make_list(hits[j].index);
+	 reinterpret_cast<PyFloat64ScalarObject*>(values[j])->obval=hits[j].value;
+	 PyList_Append(list, values[j]);
+      }
+      return 0;
+   }
+
+   bool get_entries(const batch_t& b, npy_intp i, std::vector<entry_t>& out) override
+   {
+      if (size_t(i)+1>=offsets.size())
+	 return false;
+      out.insert(out.end(), hits.begin()+offsets[i], hits.begin()+offsets[i+1]);
+      return true;
+   }
+   bool has_entries() override
+   {
+      return true;
+   }
+
+   // {"offsets", "index", "values"} like a zero suppressed field
+   PyObject* get_column(const batch_t& b) override
+   {
+      int64_t *o;
+      uint32_t *index;
+      double *vals;
+      PyObject* oa=new_column(b.n+1, NPY_INT64, &o);
+      if (!oa)
+	 return nullptr;
+      for (npy_intp i=0; i<=b.n; i++)
+	 o[i]=size_t(i)<offsets.size() ? offsets[i] : offsets.back();
+      size_t n=o[b.n];
+      PyObject* k=new_column(n, NPY_UINT32, &index);
+      PyObject* v=new_column(n, NPY_FLOAT64, &vals);
+      if (k && v)
+	 for (size_t j=0; j<n; j++)
+	 {
+	    index[j]=hits[j].index;
+	    vals[j]=hits[j].value;
+	 }
+      return jagged_dict({{"offsets", oa}, {"index", k}, {"values", v}});
+   }
+};
+
+// Time over threshold from the leading and trailing edges of TDC channels
+// (two tdc_iteminfo).  Per channel, the edges (each already in time order)
+// are merged, and a trailing edge right after a leading one makes a hit.
+// Times are compared modulo the coarse counter period, so hits across
+// the wraparound pair up.  Structure of arrays: in the dict,
+// {"index", "time", "tot", "trig"} numpy arrays of the hits of the event. 
+struct tot_iteminfo: public base_iteminfo
+{
+   struct hit_t
+   {
+      uint32_t ch;
+      double time, tot;
+   };
+   struct edge_t
+   {
+      uint32_t ch;
+      double time;
+      bool trailing;
+   };
+   tdc_iteminfo *lead, *trail;
+   double wrap; // ns, 0: no wraparound
+   const char* buf; // H101::buf
+   // channel -> (field, channel) with the trigger time, from settrig
+   std::unordered_map<uint32_t, std::pair<base_iteminfo*, uint32_t>> trig;
+   std::vector<edge_t> edges;
+   // from prepare: the hits of slot i are hits[offsets[i]:offsets[i+1]]
+   std::vector<hit_t> hits;
+   std::vector<size_t> offsets;
+   std::vector<std::pair<base_iteminfo*, std::vector<entry_t>>> trig_cache;
+   PyObject* dict;
+   // the arrays of dict, for the most hits so far, their length set
+   // to the hits of the event: the same objects in every event
+   PyObject* cols[4]{};
+   npy_intp capacity{-1};
+
+   tot_iteminfo(tdc_iteminfo* lead_, tdc_iteminfo* trail_, double wrap_, const char* buf_)
+   : base_iteminfo(0, FLOAT64)
+   , lead(lead_)
+   , trail(trail_)
+   , wrap(wrap_)
+   , buf(buf_)
+   , offsets(1, 0)
+   , dict(register_obj(PyDict_New()))
+   {
+      max_values=lead->max_values; // indexed, for expressions
+   }
+
+   ~tot_iteminfo()
+   {
+      for (auto c: cols)
+	 Py_XDECREF(c);
+   }
+
+   // (re)allocate the arrays of dict for n hits, if needed
+   int reserve(npy_intp n)
+   {
+      static const char* const names[4]={"index", "time", "tot", "trig"};
+      if (n<=capacity)
+	 return 0;
+      n=std::max(n, 2*capacity);
+      for (int c=0; c<4; c++)
+      {
+	 char* data;
+	 PyObject* a=new_column(n, c ? NPY_FLOAT64 : NPY_UINT32, &data);
+	 if (!a)
+	    return RFAIL;
+	 if (PyDict_SetItemString(dict, names[c], a))
+	 {
+	    Py_DECREF(a);
 	    return RFAIL;
+	 }
+	 Py_XDECREF(cols[c]);
+	 cols[c]=a;
+      }
+      capacity=n;
+      return 0;
+   }
 
-	CHECK(fine->v_length==coarse->v_length, RFAIL, "Inconsistent number of entries between coarse and fine time arrays: len(coarse)=%d, len(fine)=%d"
-	    , coarse->v_length, fine->v_length );
-	CHECK(fine->m_length==coarse->m_length, RFAIL, "Inconsistent number of entries between coarse and fine time index arrays: len(coarse)=%d, len(fine)=%d"
-	    , coarse->m_length, fine->m_length );
+   // into [-wrap/2, wrap/2)
+   double fold(double d) const
+   {
+      return wrap ? d-wrap*floor(d/wrap+0.5) : d;
+   }
 
-	uint32_t j=0;
-	for (uint32_t i=0; i<*(fine->m_length); i++)
-	{
-	   auto k=fine->m_indices[i];
-	   CHECK(fine->m_indices[i]==coarse->m_indices[i], "Index missmatch at i=%d: %d vs %d", i, coarse->m_indices[i], fine->m_indices[i]);
-	   PyObject* list=find_or_make_list(k);
-	   CHECK(fine->m_ends[i]==coarse->m_ends[i], "Ends mismatch at i=%d: %d vs %d", i, coarse->m_ends[i], fine->m_ends[i]);
-           for(; j<m_ends[i]; j++)
-	   {
-	     PyObject* pyVal=this->value_list.at(j);
-	     reinterpret_cast<PyFloat32ScalarObject*>(pyVal)->obval=v_data[j]; // TODO
-	     PyList_Append(list, pyVal);
-	   }
-	}
-	return 0;
-    }
+   void prepare(const batch_t& b, npy_intp i) override
+   {
+      if (i==0)
+      {
+	 hits.clear();
+	 offsets.assign(1, 0);
+      }
+      edges.clear();
+      if (size_t(i)+1<lead->offsets.size() && size_t(i)+1<trail->offsets.size())
+      {
+	 for (size_t k=lead->offsets[i]; k<lead->offsets[i+1]; k++)
+	    edges.push_back({lead->hits[k].index, lead->hits[k].value, false});
+	 for (size_t k=trail->offsets[i]; k<trail->offsets[i+1]; k++)
+	    edges.push_back({trail->hits[k].index, trail->hits[k].value, true});
+      }
+      // by channel, leading before trailing, each still in time order
+      std::stable_sort(edges.begin(), edges.end(),
+		      [](const edge_t& a, const edge_t& b) { return a.ch<b.ch; });
+      for (size_t g=0; g<edges.size(); )
+      {
+	 size_t m=g, end=g;
+	 while (end<edges.size() && edges[end].ch==edges[g].ch)
+	    end++;
+	 while (m<end && !edges[m].trailing)
+	    m++;
+	 // merge [g, m) and [m, end)
+	 const edge_t* prev{};
+	 for (size_t l=g, t=m; l<m || t<end; )
+	 {
+	    bool take_trailing=l==m || (t<end && fold(edges[t].time-edges[l].time)<0);
+	    const edge_t* cur=&edges[take_trailing ? t++ : l++];
+	    if (cur->trailing && prev && !prev->trailing)
+	       hits.push_back({cur->ch, prev->time, fold(cur->time-prev->time)});
+	    prev=cur;
+	 }
+	 g=end;
+      }
+      offsets.push_back(hits.size());
+   }
+
+   // the single hit in the trigger channel, or nan
+   double trig_time(const batch_t& b, npy_intp i, uint32_t ch)
+   {
+      auto it=trig.find(ch);
+      if (it==trig.end())
+	 return NAN;
+      std::vector<entry_t>* entries{};
+      for (auto& c: trig_cache)
+	 if (c.first==it->second.first)
+	    entries=&c.second;
+      if (!entries)
+      {
+	 trig_cache.push_back({it->second.first, {}});
+	 entries=&trig_cache.back().second;
+	 if (!it->second.first->get_entries(b, i, *entries))
+	    entries->clear();
+      }
+      double res=NAN;
+      int n=0;
+      for (auto& e: *entries)
+	 if (e.index==it->second.second)
+	 {
+	    res=e.value;
+	    n++;
+	 }
+      return n==1 ? res : NAN;
+   }
+
+   // fill the arrays with the hits of slot i, at out positions from j
+   void put_hits(const batch_t& b, npy_intp i, size_t j,
+		   uint32_t* index, double* time, double* tot, double* trg)
+   {
+      trig_cache.clear();
+      for (size_t k=offsets[i]; k<offsets[i+1]; k++, j++)
+      {
+	 index[j]=hits[k].ch;
+	 time[j]=hits[k].time;
+	 tot[j]=hits[k].tot;
+	 trg[j]=trig_time(b, i, hits[k].ch);
+      }
+   }
+
+   int map_event() override
+   {
+      npy_intp n=offsets.size()>1 ? offsets[1] : 0;
+      if (reserve(n))
+	 return RFAIL;
+      PyArrayObject* a[4];
+      for (int c=0; c<4; c++)
+      {
+	 a[c]=reinterpret_cast<PyArrayObject*>(cols[c]);
+	 PyArray_DIMS(a[c])[0]=n; // within capacity, 1D: strides stay
+      }
+      put_hits(batch_t{buf, buf, 0, 1}, 0, 0,
+	       reinterpret_cast<uint32_t*>(PyArray_DATA(a[0])),
+	       reinterpret_cast<double*>(PyArray_DATA(a[1])),
+	       reinterpret_cast<double*>(PyArray_DATA(a[2])),
+	       reinterpret_cast<double*>(PyArray_DATA(a[3])));
+      return 0;
+   }
 
+   PyObject* get_obj() override
+   {
+      return dict;
+   }
+
+   // (channel, time over threshold)
+   bool get_entries(const batch_t& b, npy_intp i, std::vector<entry_t>& out) override
+   {
+      if (size_t(i)+1>=offsets.size())
+	 return false;
+      for (size_t k=offsets[i]; k<offsets[i+1]; k++)
+	 out.push_back({hits[k].ch, hits[k].tot});
+      return true;
+   }
+   bool has_entries() override
+   {
+      return true;
+   }
 
+   // {"offsets", "index", "time", "tot", "trig"}
+   PyObject* get_column(const batch_t& b) override
+   {
+      int64_t *o;
+      uint32_t *index;
+      double *time, *tot, *trg;
+      PyObject* oa=new_column(b.n+1, NPY_INT64, &o);
+      if (!oa)
+	 return nullptr;
+      for (npy_intp i=0; i<=b.n; i++)
+	 o[i]=size_t(i)<offsets.size() ? offsets[i] : offsets.back();
+      size_t n=o[b.n];
+      PyObject* k=new_column(n, NPY_UINT32, &index);
+      PyObject* t=new_column(n, NPY_FLOAT64, &time);
+      PyObject* w=new_column(n, NPY_FLOAT64, &tot);
+      PyObject* g=new_column(n, NPY_FLOAT64, &trg);
+      if (k && t && w && g)
+	 for (npy_intp i=0; i<b.n && size_t(i)+1<offsets.size(); i++)
+	    put_hits(b, i, offsets[i], index, time, tot, trg);
+      return jagged_dict({{"offsets", oa}, {"index", k}, {"time", t}, {"tot", w}, {"trig", g}});
+   }
 };
-#endif // 0 -----------------------
 
 
 struct wrts_iteminfo: public base_iteminfo
@@ -509,38 +2001,993 @@ struct wrts_iteminfo: public base_iteminfo
 	   reinterpret_cast<PyFloat32ScalarObject*>(dest)->obval=nanf("");
        }
 
-       int map_event() override
+       static uint64_t raw_ts(uint32_t* const* t)
        {
-	    if (*id==0)
-	    {
-		nanify();
-		return 0;
-	    }
-	    dest->ob_type=np64; //valid value
 	    uint64_t res{};
 	    for (int i=0; i<4; i++)
-		 res+=uint64_t(*(tn[i]))<<(16*i);
+		 res+=uint64_t(*(t[i]))<<(16*i);
+	    return res;
+       }
+
+       // the base of the relative white rabbits, from event i if it has
+       // this timestamp and the base is not set yet (see set_relwr_base)
+       void set_base(const batch_t& b, npy_intp i)
+       {
+	    if (!rel || *rel || *b.at(id, i)==0)
+		 return;
+	    uint32_t* t[4];
+	    for (int k=0; k<4; k++)
+		t[k]=const_cast<uint32_t*>(b.at(tn[k], i));
+	    *rel=raw_ts(t)-10000; // start from counting 10us ago
+       }
+
+       uint64_t get_ts(uint32_t* const* t)
+       {
+	    uint64_t res=raw_ts(t);
 	    if (rel) // we want to use relative white rabbits
 	    {
-		if (*rel==0) // base has not been set yet
+		if (*rel==0) // only filters see events before set_relwr_base
 		{
-		     *rel=res-10000; // start from counting 10us ago
+		     *rel=res-10000;
 		}
 		res-=*rel;
 	    }
-	    reinterpret_cast<PyUInt64ScalarObject*>(dest)->obval=res;
-	    return 0;
+	    return res;
        }
 
-       PyObject* get_obj() override
+       int map_event() override
        {
-	  return dest;
-       }
-};
-
-
+	    if (*id==0)
+	    {
+		nanify();
+		return 0;
+	    }
+	    dest->ob_type=np64; //valid value
+	    reinterpret_cast<PyUInt64ScalarObject*>(dest)->obval=get_ts(tn.data());
+	    return 0;
+       }
+
+       // absolute: uint64, 0 if absent. relative: float64, nan if absent. 
+       PyObject* get_column(const batch_t& b) override
+       {
+	    npy_intp n=b.n;
+	    auto* res=PyArray_SimpleNew(1, &n, rel?NPY_FLOAT64:NPY_UINT64);
+	    if (!res)
+		return nullptr;
+	    void* data=PyArray_DATA(reinterpret_cast<PyArrayObject*>(res));
+	    for (npy_intp i=0; i<n; i++)
+	    {
+		uint32_t* t[4];
+		for (int k=0; k<4; k++)
+		    t[k]=const_cast<uint32_t*>(b.at(tn[k], i));
+		bool present=*b.at(id, i)!=0;
+		if (rel)
+		    reinterpret_cast<double*>(data)[i]=present?double(int64_t(get_ts(t))):NAN;
+		else
+		    reinterpret_cast<uint64_t*>(data)[i]=present?get_ts(t):0;
+	    }
+	    return res;
+       }
+
+       // only if present
+       bool get_entries(const batch_t& b, npy_intp i, std::vector<entry_t>& out) override
+       {
+	    if (*b.at(id, i)==0)
+		return true;
+	    uint32_t* t[4];
+	    for (int k=0; k<4; k++)
+		t[k]=const_cast<uint32_t*>(b.at(tn[k], i));
+	    uint64_t ts=get_ts(t);
+	    out.push_back({0, rel?double(int64_t(ts)):double(ts)});
+	    return true;
+       }
+       bool has_entries() override
+       {
+	    return true;
+       }
+
+       PyObject* get_obj() override
+       {
+	  return dest;
+       }
+};
+
+
+// Expressions over fields, e.g. "TOFD_T - LOS_T[*]", parsed once and
+// compiled to a small stack machine which runs on the event buffer.
+//
+// Every value is a list of entries (see get_entries).  Lists from vectors
+// and zero suppressed fields are indexed (by element or channel), and a
+// binary operation on two indexed lists pairs the entries with the same
+// index, in order.  Scalars, constants, X[c] (channel c of X) and X[*]
+// are not indexed, and are combined with every entry of the other side.
+struct expr_op
+{
+   enum code_t { LOAD, CONST, SELECT, INDEX, UNARY, AGG, BINARY } code;
+   enum fn_t
+   {
+      NEG, NOT, ABS, SQRT, LOG, EXP, FLOOR,                   // UNARY
+      LEN, SUM, MIN, MAX,                                     // AGG
+      ADD, SUB, MUL, DIV, MOD, LT, LE, GT, GE, EQ, NE, AND, OR,
+      BAND, BOR, BXOR, SHL, SHR                               // BINARY
+   } fn;
+   int dst;              // stack slot of the result (and first operand)
+   bool join;            // BINARY: pair by index, else all combinations
+   bool left_outer;      // BINARY, all combinations: index of the left side
+   base_iteminfo* item;  // LOAD
+   double c;             // CONST
+   uint32_t sel;         // SELECT
+};
+
+struct expr_program
+{
+   std::vector<expr_op> ops;
+   std::vector<std::vector<entry_t>> stack;
+   std::vector<entry_t> tmp;
+   bool indexed{}, scalar{}; // of the result
+
+   static void sort_by_index(std::vector<entry_t>& v)
+   {
+      auto lt=[](const entry_t& a, const entry_t& b) { return a.index<b.index; };
+      if (!std::is_sorted(v.begin(), v.end(), lt))
+	  std::stable_sort(v.begin(), v.end(), lt);
+   }
+
+   template<typename F>
+   void combine(std::vector<entry_t>& a, std::vector<entry_t>& b, const expr_op& op, F f)
+   {
+      tmp.clear();
+      if (op.join)
+      {
+	  sort_by_index(a);
+	  sort_by_index(b);
+	  size_t i=0, j=0;
+	  while (i<a.size() && j<b.size())
+	      if (a[i].index<b[j].index)
+		  i++;
+	      else if (b[j].index<a[i].index)
+		  j++;
+	      else
+	      {
+		  tmp.push_back({a[i].index, f(a[i].value, b[j].value)});
+		  i++, j++;
+	      }
+      }
+      else if (op.left_outer)
+	  for (auto& x: a)
+	      for (auto& y: b)
+		  tmp.push_back({x.index, f(x.value, y.value)});
+      else
+	  for (auto& y: b)
+	      for (auto& x: a)
+		  tmp.push_back({y.index, f(x.value, y.value)});
+      a.swap(tmp);
+   }
+
+   static double unary(expr_op::fn_t fn, double x)
+   {
+      switch (fn)
+      {
+	  case expr_op::NEG:   return -x;
+	  case expr_op::NOT:   return !x;
+	  case expr_op::ABS:   return fabs(x);
+	  case expr_op::SQRT:  return sqrt(x);
+	  case expr_op::LOG:   return log(x);
+	  case expr_op::EXP:   return exp(x);
+	  default:             return floor(x);
+      }
+   }
+
+   void binary(const expr_op& op)
+   {
+      auto& a=stack[op.dst];
+      auto& b=stack[op.dst+1];
+      using i64=int64_t;
+      switch (op.fn)
+      {
+	  case expr_op::ADD:  combine(a, b, op, [](double x, double y) { return x+y; }); break;
+	  case expr_op::SUB:  combine(a, b, op, [](double x, double y) { return x-y; }); break;
+	  case expr_op::MUL:  combine(a, b, op, [](double x, double y) { return x*y; }); break;
+	  case expr_op::DIV:  combine(a, b, op, [](double x, double y) { return x/y; }); break;
+	  case expr_op::MOD:  combine(a, b, op, [](double x, double y) { return fmod(x, y); }); break;
+	  case expr_op::LT:   combine(a, b, op, [](double x, double y) { return double(x<y); }); break;
+	  case expr_op::LE:   combine(a, b, op, [](double x, double y) { return double(x<=y); }); break;
+	  case expr_op::GT:   combine(a, b, op, [](double x, double y) { return double(x>y); }); break;
+	  case expr_op::GE:   combine(a, b, op, [](double x, double y) { return double(x>=y); }); break;
+	  case expr_op::EQ:   combine(a, b, op, [](double x, double y) { return double(x==y); }); break;
+	  case expr_op::NE:   combine(a, b, op, [](double x, double y) { return double(x!=y); }); break;
+	  case expr_op::AND:  combine(a, b, op, [](double x, double y) { return double(x && y); }); break;
+	  case expr_op::OR:   combine(a, b, op, [](double x, double y) { return double(x || y); }); break;
+	  case expr_op::BAND: combine(a, b, op, [](double x, double y) { return double(i64(x) & i64(y)); }); break;
+	  case expr_op::BOR:  combine(a, b, op, [](double x, double y) { return double(i64(x) | i64(y)); }); break;
+	  case expr_op::BXOR: combine(a, b, op, [](double x, double y) { return double(i64(x) ^ i64(y)); }); break;
+	  case expr_op::SHL:  combine(a, b, op, [](double x, double y) { return double(uint64_t(x) << (i64(y) & 63)); }); break;
+	  default:            combine(a, b, op, [](double x, double y) { return double(uint64_t(x) >> (i64(y) & 63)); }); break;
+      }
+   }
+
+   // evaluate for event i of b, the result is in stack[0].
+   // false if a field of the event is broken. 
+   bool run(const batch_t& b, npy_intp i)
+   {
+      for (auto& op: ops)
+      {
+	  auto& v=stack[op.dst];
+	  switch (op.code)
+	  {
+	      case expr_op::LOAD:
+		  v.clear();
+		  if (!op.item->get_entries(b, i, v))
+		      return false;
+		  break;
+	      case expr_op::CONST:
+		  v.clear();
+		  v.push_back({0, op.c});
+		  break;
+	      case expr_op::SELECT:
+		  v.erase(std::remove_if(v.begin(), v.end(),
+			  [&](const entry_t& e) { return e.index!=op.sel; }), v.end());
+		  break;
+	      case expr_op::INDEX:
+		  for (auto& e: v)
+		      e.value=e.index;
+		  break;
+	      case expr_op::UNARY:
+		  for (auto& e: v)
+		      e.value=unary(op.fn, e.value);
+		  break;
+	      case expr_op::AGG:
+	      {
+		  if (v.empty() && (op.fn==expr_op::MIN || op.fn==expr_op::MAX))
+		      break; // nothing
+		  double r=op.fn==expr_op::LEN ? v.size() : op.fn==expr_op::SUM ? 0 : v[0].value;
+		  for (auto& e: v)
+		      if (op.fn==expr_op::SUM)
+			  r+=e.value;
+		      else if (op.fn==expr_op::MIN)
+			  r=std::min(r, e.value);
+		      else if (op.fn==expr_op::MAX)
+			  r=std::max(r, e.value);
+		  v.clear();
+		  v.push_back({0, r});
+		  break;
+	      }
+	      case expr_op::BINARY:
+		  binary(op);
+		  break;
+	  }
+      }
+      return true;
+   }
+};
+
+struct expr_iteminfo;
+static void expr_item_kind(base_iteminfo* item, bool* indexed, bool* scalar);
+
+struct expr_error
+{
+   std::string msg;
+   size_t pos;
+};
+
+// recursive descent, emits the ops in postfix order
+struct expr_parser
+{
+   const std::string& src;
+   const std::map<std::string, base_iteminfo*>& fields;
+   expr_program& prog;
+   size_t pos=0;
+   int depth=0;
+
+   struct node_t
+   {
+      bool indexed, scalar;
+   };
+
+   [[noreturn]] void fail(const std::string& msg)
+   {
+      throw expr_error{msg, pos};
+   }
+
+   void skip_ws()
+   {
+      while (pos<src.size() && isspace((unsigned char)src[pos]))
+	  pos++;
+   }
+
+   bool accept(const char* tok)
+   {
+      skip_ws();
+      size_t n=strlen(tok);
+      if (src.compare(pos, n, tok))
+	  return false;
+      // the longer operators are tried first, except "&&" and "||" 
+      if (n==1 && (tok[0]=='&' || tok[0]=='|') && pos+1<src.size() && src[pos+1]==tok[0])
+	  return false;
+      pos+=n;
+      return true;
+   }
+
+   void expect(const char* tok)
+   {
+      if (!accept(tok))
+	  fail(std::string("expected '")+tok+"'");
+   }
+
+   std::string ident()
+   {
+      skip_ws();
+      size_t start=pos;
+      while (pos<src.size() && (isalnum((unsigned char)src[pos]) || src[pos]=='_'))
+	  pos++;
+      return src.substr(start, pos-start);
+   }
+
+   expr_op& emit(expr_op::code_t code, expr_op::fn_t fn=expr_op::NEG)
+   {
+      prog.ops.push_back(expr_op{code, fn, depth-1});
+      return prog.ops.back();
+   }
+
+   void push()
+   {
+      if (++depth>int(prog.stack.size()))
+	  prog.stack.resize(depth);
+   }
+
+   node_t binary(expr_op::fn_t fn, node_t l, node_t r)
+   {
+      depth--;
+      auto& op=emit(expr_op::BINARY, fn);
+      op.join=l.indexed && r.indexed;
+      op.left_outer=l.indexed || !r.indexed;
+      return {l.indexed || r.indexed, l.scalar && r.scalar};
+   }
+
+   node_t primary()
+   {
+      skip_ws();
+      if (accept("("))
+      {
+	  node_t n=expr();
+	  expect(")");
+	  return n;
+      }
+      if (pos<src.size() && (isdigit((unsigned char)src[pos]) || src[pos]=='.'))
+      {
+	  const char* start=src.c_str()+pos;
+	  char* end;
+	  double c=strtod(start, &end);
+	  if (end==start)
+	      fail("bad number");
+	  pos+=end-start;
+	  push();
+	  emit(expr_op::CONST).c=c;
+	  return {false, true};
+      }
+      std::string name=ident();
+      if (name.empty())
+	  fail("expected a field, number or '('");
+      if (accept("("))
+      {
+	  static const std::map<std::string, expr_op::fn_t> funcs={
+	      {"abs", expr_op::ABS}, {"sqrt", expr_op::SQRT}, {"log", expr_op::LOG},
+	      {"exp", expr_op::EXP}, {"floor", expr_op::FLOOR},
+	      {"len", expr_op::LEN}, {"sum", expr_op::SUM}, {"min", expr_op::MIN}, {"max", expr_op::MAX}};
+	  auto it=funcs.find(name);
+	  if (it==funcs.end())
+	      fail("unknown function "+name);
+	  node_t n=expr();
+	  expect(")");
+	  if (it->second<expr_op::LEN)
+	  {
+	      emit(expr_op::UNARY, it->second);
+	      return n;
+	  }
+	  emit(expr_op::AGG, it->second);
+	  return {false, it->second==expr_op::LEN || it->second==expr_op::SUM};
+      }
+      auto it=fields.find(name);
+      if (it==fields.end() || !it->second->has_entries())
+	  fail("no field "+name+" which can be used in expressions");
+      push();
+      emit(expr_op::LOAD).item=it->second;
+      node_t n;
+      expr_item_kind(it->second, &n.indexed, &n.scalar);
+      return n;
+   }
+
+   node_t postfix()
+   {
+      node_t n=primary();
+      for (;;)
+      {
+	  if (accept("["))
+	  {
+	      if (!accept("*"))
+	      {
+		  skip_ws();
+		  const char* start=src.c_str()+pos;
+		  char* end;
+		  unsigned long c=strtoul(start, &end, 0);
+		  if (end==start)
+		      fail("expected a channel number or '*'");
+		  pos+=end-start;
+		  emit(expr_op::SELECT).sel=uint32_t(c);
+		  n.scalar=false;
+	      }
+	      expect("]");
+	      n.indexed=false;
+	  }
+	  else if (accept(":"))
+	  {
+	      if (ident()!="index")
+		  fail("expected 'index'");
+	      emit(expr_op::INDEX);
+	  }
+	  else
+	      return n;
+      }
+   }
+
+   node_t unary()
+   {
+      if (accept("-"))
+      {
+	  node_t n=unary();
+	  emit(expr_op::UNARY, expr_op::NEG);
+	  return n;
+      }
+      if (accept("!"))
+      {
+	  node_t n=unary();
+	  emit(expr_op::UNARY, expr_op::NOT);
+	  return n;
+      }
+      return postfix();
+   }
+
+   // one level of left associative binary operators
+   template<typename Next>
+   node_t level(Next next, std::initializer_list<std::pair<const char*, expr_op::fn_t>> ops)
+   {
+      node_t l=(this->*next)();
+      for (;;)
+      {
+	  bool found=false;
+	  for (auto& o: ops)
+	      if (accept(o.first))
+	      {
+		  node_t r=(this->*next)();
+		  l=binary(o.second, l, r);
+		  found=true;
+		  break;
+	      }
+	  if (!found)
+	      return l;
+      }
+   }
+
+   node_t mul()   { return level(&expr_parser::unary, {{"*", expr_op::MUL}, {"/", expr_op::DIV}, {"%", expr_op::MOD}}); }
+   node_t add()   { return level(&expr_parser::mul, {{"+", expr_op::ADD}, {"-", expr_op::SUB}}); }
+   node_t shift() { return level(&expr_parser::add, {{"<<", expr_op::SHL}, {">>", expr_op::SHR}}); }
+   // as in C, == and != bind weaker than the ordering comparisons
+   node_t rel()   { return level(&expr_parser::shift, {{"<=", expr_op::LE}, {">=", expr_op::GE},
+	   {"<", expr_op::LT}, {">", expr_op::GT}}); }
+   node_t eq()    { return level(&expr_parser::rel, {{"==", expr_op::EQ}, {"!=", expr_op::NE}}); }
+   node_t band()  { return level(&expr_parser::eq, {{"&", expr_op::BAND}}); }
+   node_t bxor()  { return level(&expr_parser::band, {{"^", expr_op::BXOR}}); }
+   node_t bor()   { return level(&expr_parser::bxor, {{"|", expr_op::BOR}}); }
+   node_t land()  { return level(&expr_parser::bor, {{"&&", expr_op::AND}}); }
+   node_t expr()  { return level(&expr_parser::land, {{"||", expr_op::OR}}); }
+
+   void parse()
+   {
+      node_t n=expr();
+      skip_ws();
+      if (pos!=src.size())
+	  fail("unexpected input");
+      prog.indexed=n.indexed;
+      prog.scalar=n.scalar;
+   }
+};
+
+// A field computed from an expression.  In the dict it is a float64, if
+// it always has exactly one value, and a list of them otherwise. 
+struct expr_iteminfo: public base_iteminfo
+{
+   expr_program prog;
+   const char* buf; // H101::buf
+   PyObject* list{};
+   PyFloat64ScalarObject* dest{};
+   std::vector<PyObject*> values; // float64 scalars for the list, grown as needed
+
+   expr_iteminfo(expr_program&& prog_, const char* buf_)
+   : base_iteminfo(0, FLOAT64)
+   , prog(std::move(prog_))
+   , buf(buf_)
+   {
+      if (prog.scalar)
+	 dest=register_obj(reinterpret_cast<PyFloat64ScalarObject*>(make_primitive(FLOAT64)));
+      else
+	 list=register_obj(PyList_New(0));
+   }
+
+   ~expr_iteminfo() override
+   {
+      for (auto v: values)
+	 Py_DECREF(v);
+   }
+
+   int map_event() override
+   {
+      bool ok=prog.run(batch_t{buf, buf, 0, 1}, 0);
+      auto& r=prog.stack[0];
+      if (dest)
+      {
+	 dest->obval=ok ? r[0].value : NAN;
+	 return ok ? 0 : RFAIL;
+      }
+      size_t len=ok ? r.size() : 0;
+      while (values.size()<len)
+	 values.push_back(make_primitive(FLOAT64));
+      for (size_t i=0; i<len; i++)
+	 reinterpret_cast<PyFloat64ScalarObject*>(values[i])->obval=r[i].value;
+      size_t last_len=PyList_Size(list);
+      int res{};
+      if (len<last_len)
+	 res|=PyList_SetSlice(list, len, last_len, nullptr);
+      for (size_t i=last_len; i<len && !res; i++)
+	 res|=PyList_Append(list, values[i]);
+      CHECK(res==0, RFAIL, "PyList ops: res=%d", res);
+      return ok ? 0 : RFAIL;
+   }
+
+   PyObject* get_obj() override
+   {
+      return dest ? reinterpret_cast<PyObject*>(dest) : list;
+   }
+
+   // a float64 column if there is always one value, else
+   // {"offsets", "index", "values"} like a zero suppressed field
+   PyObject* get_column(const batch_t& b) override
+   {
+      if (dest)
+      {
+	  double* out;
+	  PyObject* res=new_column(b.n, NPY_FLOAT64, &out);
+	  for (npy_intp i=0; res && i<b.n; i++)
+	      out[i]=prog.run(b, i) ? prog.stack[0][0].value : NAN;
+	  return res;
+      }
+      int64_t *offsets;
+      uint32_t *index;
+      double *vals;
+      PyObject* o=new_column(b.n+1, NPY_INT64, &offsets);
+      if (!o)
+	  return nullptr;
+      std::vector<entry_t> all;
+      offsets[0]=0;
+      for (npy_intp i=0; i<b.n; i++)
+      {
+	  if (prog.run(b, i))
+	      all.insert(all.end(), prog.stack[0].begin(), prog.stack[0].end());
+	  offsets[i+1]=all.size();
+      }
+      PyObject* k=new_column(all.size(), NPY_UINT32, &index);
+      PyObject* v=new_column(all.size(), NPY_FLOAT64, &vals);
+      if (k && v)
+	  for (size_t j=0; j<all.size(); j++)
+	  {
+	      index[j]=all[j].index;
+	      vals[j]=all[j].value;
+	  }
+      return jagged_dict({{"offsets", o}, {"index", k}, {"values", v}});
+   }
+
+   bool get_entries(const batch_t& b, npy_intp i, std::vector<entry_t>& out) override
+   {
+      if (!prog.run(b, i))
+	  return false;
+      out.insert(out.end(), prog.stack[0].begin(), prog.stack[0].end());
+      return true;
+   }
+   bool has_entries() override
+   {
+      return true;
+   }
+};
+
+// scalars always have one entry.  Vectors, (multi hit) zero suppressed
+// fields and indexed expressions are indexed. 
+static void expr_item_kind(base_iteminfo* item, bool* indexed, bool* scalar)
+{
+   auto* e=dynamic_cast<expr_iteminfo*>(item);
+   *scalar=e ? e->prog.scalar : dynamic_cast<xint32_iteminfo*>(item)!=nullptr;
+   *indexed=e ? e->prog.indexed : !*scalar && item->max_values>0;
+}
+
+// compile src, nullptr with a python exception on errors
+static expr_iteminfo* compile_expr(const std::string& src,
+		const std::map<std::string, base_iteminfo*>& fields, const char* buf)
+{
+   expr_program prog;
+   expr_parser p{src, fields, prog};
+   try
+   {
+      p.parse();
+   }
+   catch (expr_error& e)
+   {
+      PyErr_Format(PyExc_ValueError, "%s at position %zd of '%s'", e.msg.c_str(), e.pos, src.c_str());
+      return nullptr;
+   }
+   return new expr_iteminfo(std::move(prog), buf);
+}
+
+
 #define NO_TPAT_MASK 0x0 // do not check
 
+// Fixed binning, bin 0 is the underflow and nbins+1 the overflow. 
+struct hist_axis
+{
+   uint32_t nbins;
+   double lo, hi;
+   double scale; // bins per unit
+
+   uint32_t bin(double v) const
+   {
+      if (!(v>=lo)) // also nan
+	  return 0;
+      if (v>=hi)
+	  return nbins+1;
+      uint32_t b=1+uint32_t((v-lo)*scale);
+      return b>nbins ? nbins : b; // rounding just below hi
+   }
+};
+
+// h101.Hist: a native 1D or 2D histogram. Plain C layout, no constructor.
+struct Hist
+{
+   PyObject ob_base;
+   hist_axis x, y; // y.nbins==0 for 1D
+   double* data;   // [x bin][y bin], with under- and overflow bins
+   uint64_t entries;
+};
+
+static void hist_fill(Hist* h, double x, double y, double w)
+{
+   size_t b=h->x.bin(x);
+   if (h->y.nbins)
+      b=b*(h->y.nbins+2)+h->y.bin(y);
+   h->data[b]+=w;
+   h->entries++;
+}
+
+// data is null until __init__ succeeded
+static bool hist_ready(Hist* h)
+{
+   if (!h->data)
+      PyErr_SetString(PyExc_RuntimeError, "Hist: not initialised.");
+   return h->data;
+}
+
+static bool parse_axis(PyObject* spec, hist_axis* a)
+{
+   unsigned int nbins{};
+   if (!PyArg_ParseTuple(spec, "Idd:Hist axis", &nbins, &a->lo, &a->hi))
+      return false;
+   if (nbins==0 || !(a->hi>a->lo))
+   {
+      PyErr_SetString(PyExc_ValueError, "Hist: need nbins>0 and hi>lo.");
+      return false;
+   }
+   a->nbins=nbins;
+   a->scale=nbins/(a->hi-a->lo);
+   return true;
+}
+
+static PyObject *
+Hist_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+   return type->tp_alloc(type, 0); // zeroed
+}
+
+static int
+Hist_init(Hist *self, PyObject *args, PyObject *kwds)
+{
+   PyObject *x{}, *y{};
+   char* keywordlist[]={"x", "y", nullptr};
+   if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!|O!:Hist", keywordlist, &PyTuple_Type, &x, &PyTuple_Type, &y))
+      return -1;
+   // the views from contents point into data, so it stays as it is
+   if (self->data)
+   {
+      PyErr_SetString(PyExc_RuntimeError, "Hist: already initialised.");
+      return -1;
+   }
+   hist_axis ax{}, ay{};
+   if (!parse_axis(x, &ax) || (y && !parse_axis(y, &ay)))
+      return -1;
+   size_t n=size_t(ax.nbins+2)*(ay.nbins ? ay.nbins+2 : 1);
+   self->data=(double*)calloc(n, sizeof(double));
+   if (!self->data)
+   {
+      PyErr_NoMemory();
+      return -1;
+   }
+   self->x=ax;
+   self->y=ay;
+   self->entries=0;
+   return 0;
+}
+
+static void
+Hist_dealloc(Hist* self)
+{
+   free(self->data);
+   Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyObject *
+Hist_fill(Hist* self, PyObject * args, PyObject * kwds)
+{
+   double x{}, y{}, w=1.0;
+   char* keywordlist[]={"x", "y", "w", nullptr};
+   if (!PyArg_ParseTupleAndKeywords(args, kwds, "d|dd:Hist::fill", keywordlist, &x, &y, &w))
+      return nullptr;
+   if (!hist_ready(self))
+      return nullptr;
+   hist_fill(self, x, y, w);
+   Py_RETURN_NONE;
+}
+
+static PyObject *
+Hist_reset(Hist* self, PyObject *Py_UNUSED(ignored))
+{
+   if (!hist_ready(self))
+      return nullptr;
+   memset(self->data, 0, size_t(self->x.nbins+2)*(self->y.nbins ? self->y.nbins+2 : 1)*sizeof(double));
+   self->entries=0;
+   Py_RETURN_NONE;
+}
+
+// numpy view of the bins, including under- and overflow. Not a copy,
+// it changes with the histogram, and keeps it alive. 
+static PyObject *
+Hist_get_contents(Hist* self, void*)
+{
+   if (!hist_ready(self))
+      return nullptr;
+   npy_intp dims[2]={self->x.nbins+2, self->y.nbins+2};
+   PyObject* res=PyArray_SimpleNewFromData(self->y.nbins?2:1, dims, NPY_FLOAT64, self->data);
+   if (!res)
+      return nullptr;
+   Py_INCREF(self);
+   if (PyArray_SetBaseObject(reinterpret_cast<PyArrayObject*>(res), reinterpret_cast<PyObject*>(self))<0)
+   {
+      Py_DECREF(res);
+      return nullptr;
+   }
+   return res;
+}
+
+static PyObject *
+Hist_get_entries(Hist* self, void*)
+{
+   return PyLong_FromUnsignedLongLong(self->entries);
+}
+
+static PyObject *
+Hist_get_axes(Hist* self, void*)
+{
+   if (!self->y.nbins)
+      return Py_BuildValue("((Idd))", self->x.nbins, self->x.lo, self->x.hi);
+   return Py_BuildValue("((Idd)(Idd))", self->x.nbins, self->x.lo, self->x.hi,
+		   self->y.nbins, self->y.lo, self->y.hi);
+}
+
+static PyMethodDef Hist_methods[] =
+{
+	{"fill", (PyCFunction)Hist_fill, METH_VARARGS | METH_KEYWORDS, "Fill x (and y) with weight w (default 1)."},
+	{"reset", (PyCFunction)Hist_reset, METH_NOARGS, "Clear all bins."},
+	{nullptr}
+};
+
+static PyGetSetDef Hist_getset[] =
+{
+	{"contents", (getter)Hist_get_contents, nullptr, "numpy view of the bins, index 0 and -1 are under- and overflow."},
+	{"entries", (getter)Hist_get_entries, nullptr, "Number of fills."},
+	{"axes", (getter)Hist_get_axes, nullptr, "(nbins, lo, hi) for each axis."},
+	{nullptr}
+};
+
+static PyTypeObject Hist_type
+{
+	// fields initialized in mkHist_type, see H101_type
+};
+
+// numpy scalar type of a primitive
+template<primitive P> struct scalar_obj;
+template<> struct scalar_obj<UINT32> { using type=PyUInt32ScalarObject; };
+template<> struct scalar_obj<INT32>  { using type=PyInt32ScalarObject; };
+
+// the single value items (xint32_iteminfo) of one type, as plain
+// (source, scalar) pairs sorted by offset, mapped in one loop
+template<primitive P>
+struct scalar_group
+{
+   using obj_t=typename scalar_obj<P>::type;
+   struct entry
+   {
+      const uint32_t* src;
+      obj_t* dest;
+   };
+   std::vector<entry> entries;
+
+   void add(xint32_iteminfo* ii)
+   {
+      entries.push_back({ii->src, reinterpret_cast<obj_t*>(ii->dest)});
+   }
+   void sort()
+   {
+      std::sort(entries.begin(), entries.end(),
+		[](const entry& a, const entry& b) { return a.src<b.src; });
+   }
+   void map() const
+   {
+      for (auto& e: entries)
+	 e.dest->obval=decltype(e.dest->obval)(*e.src);
+   }
+};
+
+// an array item with the parts of the event buffer it reads, to look up
+// in the blocks changed by the decoder, see ext_data_track_dirty
+template<class T>
+struct tracked
+{
+   struct span
+   {
+      uint32_t lo, max;      // bytes of the event buffer
+      const uint32_t* count; // words in use, nullptr for all of max
+   };
+   T* item;
+   const uint32_t* length; // of the item, shorter ones are just mapped
+   span spans[5]; // at most, for mult_iteminfo
+   int nspans{};
+   static const uint32_t min_length=8; // below, mapping is as cheap as the lookup
+
+   // [p, p+bytes) of the event buffer buf, clipped to it. With count,
+   // only the words up to the current count matter: if the count
+   // changes, so does its own block.
+   void add(const char* buf, size_t buflen, const uint32_t* p, size_t bytes,
+	    const uint32_t* count=nullptr)
+   {
+      auto* c=reinterpret_cast<const char*>(p);
+      if (c<buf || c>=buf+buflen || !bytes)
+	 return; // not in the event buffer, e.g. missing ZZM items
+      size_t lo=c-buf;
+      spans[nspans++]={uint32_t(lo), uint32_t(std::min(bytes, buflen-lo)), count};
+   }
+   bool dirty(const uint64_t* bits) const
+   {
+      if (*length<min_length)
+	 return true;
+      for (int i=0; i<nspans; i++)
+      {
+	 auto& s=spans[i];
+	 uint32_t n=s.count ? uint32_t(std::min(uint64_t(*s.count)*4, uint64_t(s.max))) : s.max;
+	 if (!n)
+	    continue;
+	 uint32_t first=s.lo>>EXT_DATA_DIRTY_BLOCK_SHIFT;
+	 uint32_t last=(s.lo+n-1)>>EXT_DATA_DIRTY_BLOCK_SHIFT;
+	 for (uint32_t w=first/64; w<=last/64; w++)
+	 {
+	    uint64_t mask=~uint64_t(0);
+	    if (w==first/64)
+	       mask&=~uint64_t(0)<<(first%64);
+	    if (w==last/64)
+	       mask&=~uint64_t(0)>>(63-last%64);
+	    if (bits[w]&mask)
+	       return true;
+	 }
+      }
+      return false;
+   }
+};
+
+// the items of H101, grouped by kind for getevent: one loop per kind,
+// without virtual calls, in the order of the event buffer. Items of other
+// kinds (timestamps, calibrations, expressions, addfield) follow in their
+// order, after the raw items they are computed from. 
+// Arrays in which the decoder changed nothing keep their mapping from the
+// last event, scalars are cheaper to copy than to check.
+struct map_plan
+{
+   size_t nitems{}; // of H101::items, when built
+   scalar_group<UINT32> u32;
+   scalar_group<INT32> i32;
+   std::vector<tracked<vector_iteminfo>> vectors;
+   std::vector<tracked<dict_iteminfo>> dicts;
+   std::vector<tracked<mult_iteminfo>> mults;
+   std::vector<base_iteminfo*> others;
+
+   void build(const std::vector<base_iteminfo*>& items, const char* buf, size_t buflen)
+   {
+      *this=map_plan();
+      nitems=items.size();
+      for (auto* ii: items)
+	 if (auto* x=dynamic_cast<xint32_iteminfo*>(ii))
+	 {
+	    if (x->type==INT32)
+	       i32.add(x);
+	    else
+	       u32.add(x);
+	 }
+	 else if (auto* v=dynamic_cast<vector_iteminfo*>(ii))
+	 {
+	    // max_values is the byte size of the payload item
+	    vectors.push_back({v, v->length});
+	    vectors.back().add(buf, buflen, v->length, 4);
+	    vectors.back().add(buf, buflen, v->data, v->max_values, v->length);
+	 }
+	 else if (auto* d=dynamic_cast<dict_iteminfo*>(ii))
+	 {
+	    dicts.push_back({d, d->length});
+	    dicts.back().add(buf, buflen, d->length, 4);
+	    dicts.back().add(buf, buflen, d->keys, d->maxlen, d->length);
+	    dicts.back().add(buf, buflen, d->data, d->maxlen, d->length);
+	 }
+	 else if (auto* m=dynamic_cast<mult_iteminfo*>(ii))
+	 {
+	    mults.push_back({m, m->v_length});
+	    auto& t=mults.back();
+	    t.add(buf, buflen, m->v_length, 4);
+	    t.add(buf, buflen, m->v_data, m->max_values, m->v_length);
+	    t.add(buf, buflen, m->m_length, 4);
+	    t.add(buf, buflen, m->m_indices, 4*size_t(m->max_entries), m->m_length);
+	    t.add(buf, buflen, m->m_ends, 4*size_t(m->max_entries), m->m_length);
+	 }
+	 else
+	    others.push_back(ii);
+      u32.sort();
+      i32.sort();
+      auto by_offset=[](auto& list, auto key)
+      {
+	 std::sort(list.begin(), list.end(), [&](auto& a, auto& b) { return key(a.item)<key(b.item); });
+      };
+      by_offset(vectors, [](vector_iteminfo* v) { return v->length; });
+      by_offset(dicts, [](dict_iteminfo* d) { return d->length; });
+      by_offset(mults, [](mult_iteminfo* m) { return m->v_length; });
+   }
+
+   // dirty: the blocks changed since the last map, nullptr for all
+   void map(const uint64_t* dirty) const
+   {
+      u32.map();
+      i32.map();
+      for (auto& v: vectors)
+	 if (!dirty || v.dirty(dirty))
+	    v.item->map_event();
+      for (auto& d: dicts)
+	 if (!dirty || d.dirty(dirty))
+	    d.item->map_event();
+      for (auto& m: mults)
+	 if (!dirty || m.dirty(dirty))
+	    m.item->map_event();
+      for (auto* ii: others)
+	 ii->map_event();
+   }
+};
+
+// filled by getevent and getbatch
+struct hist_filler
+{
+   Hist* hist;
+   base_iteminfo *x, *y; // y is nullptr for 1D
+   bool x_index, y_index; // use entry_t::index instead of the value
+};
+
 struct H101
 {
   PyObject ob_base;
@@ -549,37 +2996,231 @@ struct H101
    PyObject* unpacker   {}; // to be set from python
    unsigned short tpat_mask = NO_TPAT_MASK; // to be overwritten from python
    int fd;
+   std::string path{}; // if reading a file
    std::vector<std::string> fieldnames{};
    PyObject* dict {};
    ext_data_client *client;
    std::map<std::string, ext_data_structure_item*> itemmap;
    char* buf{};
    size_t buflen{};
+   PyObject* bufobj{}; // numpy array owning buf, the base of the views
+   PyObject* views{};  // from getviews, made on first use
    std::vector<base_iteminfo*> items;
+   map_plan plan; // items, grouped for getevent
+   uint64_t* dirty{}; // blocks of buf changed by the decoder, owned by client
+   size_t dirty_words{};
    std::map<std::string, base_iteminfo*> str2iteminfo;
+   std::vector<base_iteminfo*> stateful; // need prepare() for each event
+   std::vector<base_iteminfo*> hidden; // in str2iteminfo, but not in the dict
    uint64_t relwr_base{}; // offset for 'relative white rabbit'. 
+   std::vector<wrts_iteminfo*> relwr; // the _REL items, which share it
    // for fast filtering:
    uint32_t* tpat_len{};
-   uint32_t* tpat;
+   uint32_t* tpat{};
+   // for getbatch:
+   char* batchbuf{};
+   size_t batch_slots{};
+   size_t batch_stride{};
+   int batch_errno{}; // failure after the events of the last getbatch
+   // set while a method runs ext_data calls without the GIL
+   bool busy{};
+   // from mkhist:
+   std::vector<hist_filler> hists;
+   std::vector<entry_t> xs, ys;
+   std::vector<base_iteminfo*> hist_exprs; // axes which are expressions
+   // from addfilter, all have to pass (after tpat_mask):
+   std::vector<expr_iteminfo*> filters;
+   // decode only what the filters need first, see update_prefilter
+   bool partial_decode = true; // to be overwritten from python
+   bool prefilter_dirty{}; // filters changed
+   bool prefilter_on{};    // ext_data_fetch_event filters
+   bool prefilter_partial{};
+   unsigned short prefilter_mask = NO_TPAT_MASK;
+   // timing statistics, see H101_stats
+   unsigned int timing{}; // 0: off, n: time the items of every n-th event. from python
+   bool stat_clock{}; // the client measures its waiting
+   uint64_t stat_events{}, stat_count{};
+   uint64_t stat_fetch{}, stat_map{}; // ticks, fetch includes the waiting
+   uint64_t stat_wait0{}, stat_t0{}; // at the last reset
+   // H101(lazy=True): fields are mapped when they are looked up, see LazyDict
+   bool lazy{};
+   struct LazyDict* lazydict{};
+   uint64_t lazy_event{}; // counts the events of getevent
+   std::unordered_map<std::string, base_iteminfo*> dict_items; // by name in dict
+   std::vector<base_iteminfo*> eager; // addfield callbacks, still called for each event
 };
 
+// h101.LazyDict: getdict() of H101(lazy=True), a read only mapping over
+// the dict of fields. Looking up a field maps it for the current event,
+// once, so fields which are not looked up cost nothing. 
+struct LazyDict
+{
+   PyObject ob_base;
+   H101* h;        // nullptr once the H101 is gone
+   PyObject* dict; // H101::dict
+};
 
-#define GETPTR(name) (reinterpret_cast<uint32_t*>(self->buf + name->_offset))
+static PyTypeObject LazyDict_type
+{
+	// fields initialized in mkLazyDict_type, see H101_type
+};
 
+// the value of key (borrowed), mapped for the current event.
+// nullptr without exception if there is no such field. 
+static PyObject* LazyDict_lookup(LazyDict* self, PyObject* key)
+{
+   PyObject* res=PyDict_GetItemWithError(self->dict, key);
+   if (!res || !self->h)
+      return res;
+   Py_ssize_t len;
+   const char* name=PyUnicode_AsUTF8AndSize(key, &len);
+   if (!name)
+      return nullptr;
+   auto it=self->h->dict_items.find(std::string(name, len));
+   if (it!=self->h->dict_items.end() && it->second->mapped!=self->h->lazy_event)
+   {
+      it->second->map_event();
+      it->second->mapped=self->h->lazy_event;
+   }
+   return res;
+}
 
-static void
-pythonize_reg_item(H101* self, const char* str, base_iteminfo* mapped)
+static Py_ssize_t
+LazyDict_length(LazyDict* self)
 {
-	PyObject* name = PyUnicode_FromString(strdup(str));
-        //Py_XINCREF(name);
-    	mapped->name=str;
-	if (mapped->get_obj()!=nullptr && mapped->get_obj()!=Py_None)
-	   PyDict_SetItem(self->dict, name, mapped->get_obj());
-	self->items.push_back(mapped);
-	self->str2iteminfo[str]=mapped;
+   return PyDict_Size(self->dict);
 }
 
-static void pythonize_wrts(H101* self, const std::string& base)
+static PyObject *
+LazyDict_subscript(LazyDict* self, PyObject* key)
+{
+   PyObject* res=LazyDict_lookup(self, key);
+   if (!res && !PyErr_Occurred())
+      PyErr_SetObject(PyExc_KeyError, key);
+   Py_XINCREF(res);
+   return res;
+}
+
+static int
+LazyDict_contains(LazyDict* self, PyObject* key)
+{
+   return PyDict_Contains(self->dict, key);
+}
+
+static PyObject *
+LazyDict_get(LazyDict* self, PyObject * args)
+{
+   PyObject *key{}, *def=Py_None;
+   if (!PyArg_ParseTuple(args, "O|O:LazyDict::get", &key, &def))
+      return nullptr;
+   PyObject* res=LazyDict_lookup(self, key);
+   if (!res && PyErr_Occurred())
+      return nullptr;
+   res=res ? res : def;
+   Py_INCREF(res);
+   return res;
+}
+
+static PyObject *
+LazyDict_keys(LazyDict* self, PyObject *Py_UNUSED(ignored))
+{
+   return PyDict_Keys(self->dict);
+}
+
+// a dict with all fields mapped, i.e. what getdict gives without lazy
+static PyObject *
+LazyDict_all(LazyDict* self)
+{
+   PyObject *key, *value;
+   Py_ssize_t pos=0;
+   while (PyDict_Next(self->dict, &pos, &key, &value))
+      if (!LazyDict_lookup(self, key) && PyErr_Occurred())
+	 return nullptr;
+   Py_INCREF(self->dict);
+   return self->dict;
+}
+
+static PyObject *
+LazyDict_values(LazyDict* self, PyObject *Py_UNUSED(ignored))
+{
+   PyObject* d=LazyDict_all(self);
+   PyObject* res=d ? PyDict_Values(d) : nullptr;
+   Py_XDECREF(d);
+   return res;
+}
+
+static PyObject *
+LazyDict_items(LazyDict* self, PyObject *Py_UNUSED(ignored))
+{
+   PyObject* d=LazyDict_all(self);
+   PyObject* res=d ? PyDict_Items(d) : nullptr;
+   Py_XDECREF(d);
+   return res;
+}
+
+static PyObject *
+LazyDict_iter(LazyDict* self)
+{
+   return PyObject_GetIter(self->dict);
+}
+
+static PyObject *
+LazyDict_repr(LazyDict* self)
+{
+   PyObject* d=LazyDict_all(self);
+   PyObject* res=d ? PyObject_Repr(d) : nullptr;
+   Py_XDECREF(d);
+   return res;
+}
+
+static void
+LazyDict_dealloc(LazyDict* self)
+{
+   Py_XDECREF(self->dict);
+   Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMappingMethods LazyDict_mapping=
+{
+	.mp_length=(lenfunc)LazyDict_length,
+	.mp_subscript=(binaryfunc)LazyDict_subscript,
+};
+
+static PySequenceMethods LazyDict_sequence=
+{
+	.sq_contains=(objobjproc)LazyDict_contains,
+};
+
+static PyMethodDef LazyDict_methods[] =
+{
+	{"keys", (PyCFunction)LazyDict_keys, METH_NOARGS, "List of the field names, without mapping them."},
+	{"values", (PyCFunction)LazyDict_values, METH_NOARGS, "List of all field values, maps all fields."},
+	{"items", (PyCFunction)LazyDict_items, METH_NOARGS, "List of (name, value) of all fields, maps all fields."},
+	{"get", (PyCFunction)LazyDict_get, METH_VARARGS, "The value of a field (mapped), or the default (None)."},
+	{nullptr}
+};
+
+
+#define GETPTR(name) (reinterpret_cast<uint32_t*>(self->buf + name->_offset))
+
+
+static void
+pythonize_reg_item(H101* self, const char* str, base_iteminfo* mapped)
+{
+	PyObject* name = PyUnicode_FromString(strdup(str));
+        //Py_XINCREF(name);
+    	mapped->name=strdup(str); // str might be temporary
+	if (mapped->get_obj()!=nullptr && mapped->get_obj()!=Py_None)
+	   PyDict_SetItem(self->dict, name, mapped->get_obj());
+	self->items.push_back(mapped);
+	self->str2iteminfo[str]=mapped;
+	if (mapped->get_obj()!=nullptr && mapped->get_obj()!=Py_None)
+	   self->dict_items[str]=mapped;
+	if (dynamic_cast<pyimp_iteminfo*>(mapped))
+	   self->eager.push_back(mapped);
+}
+
+static void pythonize_wrts(H101* self, const std::string& base)
 {
    auto& m = self->itemmap;
    std::string idname=base+"_ID";
@@ -604,7 +3245,19 @@ static void pythonize_wrts(H101* self, const std::string& base)
    pythonize_reg_item(self, base.c_str(), new wrts_iteminfo(idptr, tn, nullptr));
    
    std::string relname=base+"_REL";
-   pythonize_reg_item(self, relname.c_str(), new wrts_iteminfo(idptr, tn, &(self->relwr_base)));
+   auto* rel=new wrts_iteminfo(idptr, tn, &(self->relwr_base));
+   pythonize_reg_item(self, relname.c_str(), rel);
+   self->relwr.push_back(rel);
+}
+
+// The relative white rabbits count from the first timestamp of the
+// stream, in event order and then item order. Set before anything of
+// the events is mapped, so getevent, getbatch and lazy lookups agree.
+static void set_relwr_base(H101* self, const batch_t& b)
+{
+   for (npy_intp i=0; i<b.n && !self->relwr_base; i++)
+	for (auto* ii: self->relwr)
+	     ii->set_base(b, i);
 }
 
 
@@ -687,183 +3340,1173 @@ static void pythonize1(H101* self) // stage 1: process raw items
 	     //printf("Mapped %s\n", item->_var_name);
 	}
 
-	// also fetch TPAT and TPATv
-	self->tpat_len=GETPTR(self->itemmap.at("TPAT"));
-	self->tpat=GETPTR(self->itemmap.at("TPATv"));
+	// also fetch TPAT and TPATv
+	auto* tpat=getIfPresent(m, "TPAT");
+	auto* tpatv=getIfPresent(m, "TPATv");
+	if (tpat && tpatv)
+	{
+		self->tpat_len=GETPTR(tpat);
+		self->tpat=GETPTR(tpatv);
+	}
+}
+
+static void pythonize2(H101* self)  // stage 2: process stage one processors
+{
+	auto& m = self->str2iteminfo;
+	for (auto& it: m)
+	{
+	}
+}
+
+
+#undef GETPTR
+
+static void
+H101_dealloc(H101* self)
+{
+    //printf("%s entered\n", __FUNCTION__ );
+    if (self->dict)
+       Py_XDECREF(self->dict);
+    Py_XDECREF(self->views);
+    if (self->lazydict)
+    {
+       self->lazydict->h=nullptr;
+       Py_DECREF(self->lazydict);
+    }
+    Py_XDECREF(self->bufobj); // buf lives on while there are views
+    if (self->batchbuf) free(self->batchbuf);
+    for (auto v: self->items)
+	   delete v;
+    for (auto& f: self->hists)
+	   Py_DECREF(f.hist);
+    for (auto v: self->hist_exprs)
+	   delete v;
+    for (auto v: self->hidden)
+	   delete v;
+    for (auto v: self->filters)
+	   delete v;
+    // todo: who owns the ext_data_structure_item?
+    if (self->client) ext_data_close(self->client); // also unmaps files
+
+    Py_XDECREF(self->triggermap);
+    Py_XDECREF(self->unpacker);
+    PyObject saved=self->ob_base;
+    self->~H101();  // call the destructor.  
+    self->ob_base=saved;
+    Py_TYPE(self)->tp_free((PyObject *) self);
+    //printf("%s done\n", __FUNCTION__ );
+}
+
+static PyObject *
+H101_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+	//printf("%s entered\n", __FUNCTION__ );
+   	H101 *self = (H101 *) type->tp_alloc(type, 0);
+	if (!self)
+	    return nullptr;
+	assert((void*)self == (void*)(&self->ob_base)); // no vtable plz
+
+	// call the C++ constructor without destroying the python header
+	// there has to be a better way for this
+	PyObject saved=self->ob_base;
+	new (self) H101(); // default init
+	self->ob_base=saved;
+        //printf("%s exiting\n", __FUNCTION__ );
+	return (PyObject*) self;
+}
+
+/* PyObject* VarPyLong_alloc()
+{
+   PyObject* res=malloc(MAX_PYLONG_SIZE);
+   PyLong_assign
+}*/
+
+
+// for H101(fields=[...]): which server items to map
+struct field_select
+{
+   std::vector<std::string> patterns;
+   std::vector<size_t> hits; // per pattern, to report typos
+};
+
+// An item is wanted if its name matches, or its name without one of the
+// suffixes of the companion items pythonize1 needs (Xv, XI, XM, XMI, XME
+// for X, X_ID and X_WR_Tn for the white rabbit X and X_REL).
+static int field_selected(const char* name, void* arg)
+{
+   auto* fs=static_cast<field_select*>(arg);
+   std::string n=name;
+   if (n=="TPAT" || n=="TPATv") // for tpat_mask
+	return 1;
+   std::vector<std::string> cand{n};
+   const static std::string suffixes[]={"v", "I", "E", "M", "MI", "ME"};
+   const static std::string wr_suffixes[]={"_ID", "_WR_T1", "_WR_T2", "_WR_T3", "_WR_T4"};
+   auto ends_with=[&](const std::string& suf)
+   {
+      return n.size()>suf.size() && !n.compare(n.size()-suf.size(), suf.size(), suf);
+   };
+   for (auto& suf: suffixes)
+	if (ends_with(suf))
+	   cand.push_back(n.substr(0, n.size()-suf.size()));
+   for (auto& suf: wr_suffixes)
+	if (ends_with(suf))
+	{
+	   cand.push_back(n.substr(0, n.size()-suf.size()));
+	   cand.push_back(cand.back()+"_REL");
+	}
+   int res=0;
+   for (size_t i=0; i<fs->patterns.size(); i++)
+	for (auto& c: cand)
+	   if (!fnmatch(fs->patterns[i].c_str(), c.c_str(), 0))
+	   {
+		fs->hits[i]++;
+		res=1;
+		break;
+	   }
+   return res;
+}
+
+// fields may be a single pattern or a sequence of them
+static bool parse_fields(PyObject* fields, field_select* fs)
+{
+   if (PyUnicode_Check(fields))
+   {
+	fs->patterns.push_back(PyUnicode_AsUTF8(fields));
+	fs->hits.push_back(0);
+	return true;
+   }
+   PyObject* seq=PySequence_Fast(fields, "H101: fields must be a string or a sequence of strings.");
+   if (!seq)
+	return false;
+   for (Py_ssize_t i=0; i<PySequence_Fast_GET_SIZE(seq); i++)
+   {
+	PyObject* o=PySequence_Fast_GET_ITEM(seq, i);
+	const char* str=PyUnicode_Check(o)?PyUnicode_AsUTF8(o):nullptr;
+	if (!str)
+	{
+	   Py_DECREF(seq);
+	   PyErr_SetString(PyExc_TypeError, "H101: fields must be a string or a sequence of strings.");
+	   return false;
+	}
+	fs->patterns.push_back(str);
+	fs->hits.push_back(0);
+   }
+   Py_DECREF(seq);
+   return true;
+}
+
+static int
+H101_init(H101 *self, PyObject *args, PyObject *kwds)
+{
+    noerrno;
+    //printf("%s entered\n", __FUNCTION__ );
+    // at some point, we would like to call our c++ constructor.
+    auto base=self->ob_base; // don't mess with python
+    //new (self) H101(); 
+    self->ob_base=base;
+    char* keywordlist[]={"fd", "path", "prefetch", "fields", "lazy", nullptr};
+    const char* path{};
+    unsigned int prefetch_mb{}; // ring size for the reader thread, 0: read in getevent
+    PyObject* fields{}; // glob patterns of the items to map, default all
+    int lazy{};
+    field_select fs;
+    self->fd=-1;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|izIOp", keywordlist, &(self->fd), &path, &prefetch_mb, &fields, &lazy))
+		return -1;
+	if ((self->fd==-1) == !path)
+	{
+		PyErr_SetString(PyExc_TypeError, "H101: exactly one of fd or path is required.");
+		return -1;
+	}
+	if (fields && fields!=Py_None && !parse_fields(fields, &fs))
+		return -1;
+
+	if (path) // recorded file: map it, no read() or copying
+	{
+		self->path = path;
+		self->client = ext_data_from_file(path);
+	}
+	else
+		self->client = ext_data_from_fd(self->fd);
+	if (!self->client)
+	{
+		PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+		return -1;
+	}
+
+        //new (&self->itemmap) decltype(self->itemmap);
+	self->dict = PyDict_New();
+	Py_XINCREF(self->dict);
+	Py_XINCREF(Py_None);
+	self->triggermap=Py_None;
+	Py_XINCREF(Py_None);
+	self->unpacker=Py_None;
+	int res{};
+	uint32_t map_success = 0;
+	printf("errno=%d\n", errno);
+	ext_data_structure_info* info = ext_data_struct_info_alloc();
+	printf("errno=%d\n", errno);
+	if (!fs.patterns.empty())
+		ext_data_struct_info_select(info, field_selected, &fs);
+	// waits for the unpacker to send its headers
+	Py_BEGIN_ALLOW_THREADS
+	res=ext_data_setup(self->client, NULL, 0, info, &map_success, 0, "", nullptr);
+	Py_END_ALLOW_THREADS
+	for (size_t i=0; i<fs.patterns.size(); i++)
+		if (!fs.hits[i])
+		{
+			PyErr_Format(PyExc_ValueError, "H101: no field matches '%s'.", fs.patterns[i].c_str());
+			return -1;
+		}
+       	CHECK_EXT(res==0, RFAIL, "setup");
+	if (prefetch_mb)
+	{
+		res=ext_data_prefetch(self->client, size_t(prefetch_mb)<<20);
+		CHECK_EXT(res==0, RFAIL, "prefetch");
+	}
+
+	struct ext_data_structure_item* items=ext_data_struct_info_get_items(info);
+	int tot=0;
+
+	while(items)
+	{
+		if (0 && items->_var_name[0]!='N')
+			printf("%s 0x%x, %d\n", items->_var_name, items->_var_type, items->_length);
+		self->itemmap[items->_var_name]=items;
+		tot+=items->_length;
+		items=items->_next_off_item;
+	}
+	npy_intp bufsize=tot;
+	self->bufobj=PyArray_SimpleNew(1, &bufsize, NPY_UINT8);
+	if (!self->bufobj)
+		return -1;
+	self->buf=reinterpret_cast<char*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(self->bufobj)));
+	self->buflen=tot;
+        auto& m=self->itemmap;
+
+        pythonize1(self);
+        pythonize2(self);
+	if (lazy)
+	{
+		self->lazy=true;
+		self->lazydict=PyObject_New(LazyDict, &LazyDict_type);
+		if (!self->lazydict)
+			return -1;
+		self->lazydict->h=self;
+		self->lazydict->dict=self->dict;
+		Py_INCREF(self->dict);
+	}
+	else
+	{
+		// getevent maps only the arrays the decoder changed,
+		// without the bitmap all of them
+		self->dirty=ext_data_track_dirty(self->client, 0, &self->dirty_words);
+		if (!self->dirty)
+			self->dirty_words=0;
+	}
+        //printf("%s done\n", __FUNCTION__);
+	return 0;
+}
+
+static PyObject * 
+H101_addfield(H101* self, PyObject * args, PyObject * kwds)
+{
+   PyObject * outp{}, * callback{};
+   char * name{};
+   char* keywordlist[]={"name", "outp", "callback",  nullptr};
+   if (!PyArg_ParseTupleAndKeywords(args, kwds, "sOO:H101::addfield", keywordlist, &name, &outp, &callback))
+   {
+	Py_XINCREF(Py_False);
+	return Py_False;
+   }
+   Py_XINCREF(outp);
+   Py_XINCREF(callback);
+   auto* ii=new pyimp_iteminfo(outp, callback);
+   pythonize_reg_item(self, name, ii);
+
+   Py_XINCREF(Py_True);
+   return Py_True;
+}
+
+// check the tpat of the event in ev (which has the layout of self->buf)
+static bool tpat_good(H101* self, const char* ev)
+{
+   if (self->tpat_mask==NO_TPAT_MASK || !self->tpat_len) // no TPAT from this unpacker
+	return true;
+   auto rebase=[&](uint32_t* p)
+   {
+	return reinterpret_cast<const uint32_t*>(ev + (reinterpret_cast<char*>(p) - self->buf));
+   };
+   const uint32_t* tpat_len=rebase(self->tpat_len);
+   const uint32_t* tpat=rebase(self->tpat);
+   for (uint32_t i=0; i<*tpat_len; i++)
+       if (tpat[i] & self->tpat_mask)
+	    return true;
+   return false;
+}
+
+// true if any entry is non-zero (and not nan). Checked before anything
+// is mapped, without the GIL.
+static bool filter_good(expr_iteminfo* f, const batch_t& b)
+{
+   if (!f->prog.run(b, 0))
+	return false;
+   for (auto& e: f->prog.stack[0])
+       if (e.value!=0 && e.value==e.value)
+	    return true;
+   return false;
+}
+
+static bool event_good(H101* self, const char* ev)
+{
+   if (!tpat_good(self, ev))
+	return false;
+   batch_t b{self->buf, ev, 0, 1};
+   for (auto* f: self->filters)
+       if (!filter_good(f, b))
+	    return false;
+   return true;
+}
+
+static int event_accept(const void* ev, void* self)
+{
+   return event_good(reinterpret_cast<H101*>(self), reinterpret_cast<const char*>(ev));
+}
+
+static bool has_filters(H101* self)
+{
+   return self->tpat_mask!=NO_TPAT_MASK || !self->filters.empty();
+}
+
+// the fields a filter reads, also through expressions
+static void filter_fields(base_iteminfo* item, field_select& fs)
+{
+   if (auto* e=dynamic_cast<expr_iteminfo*>(item))
+   {
+	for (auto& op: e->prog.ops)
+	     if (op.code==expr_op::LOAD)
+		  filter_fields(op.item, fs);
+	return;
+   }
+   fs.patterns.push_back(item->name);
+   fs.hits.push_back(0);
+}
+
+// With partial_decode, the filters run inside of ext_data_fetch_event,
+// after decoding the items they read (and TPAT), and the rest of the
+// event is only decoded if they pass.  Called before fetching, as
+// tpat_mask is set directly from python.  Needs the GIL.
+static bool update_prefilter(H101* self)
+{
+     bool on=self->partial_decode && has_filters(self);
+     if (!self->prefilter_dirty && on==self->prefilter_on
+	 && self->prefilter_mask==self->tpat_mask && self->prefilter_partial==self->partial_decode)
+	  return true;
+     std::vector<uint32_t> ranges;
+     if (on)
+     {
+	  field_select fs;
+	  for (auto* f: self->filters)
+	       filter_fields(f, fs);
+	  for (auto& it: self->itemmap)
+	       if (field_selected(it.first.c_str(), &fs))
+	       {
+		    ranges.push_back(it.second->_offset);
+		    ranges.push_back(it.second->_length);
+	       }
+     }
+     noerrno;
+     int res=ext_data_set_prefilter(self->client, 0, ranges.data(), ranges.size()/2,
+		     on?event_accept:nullptr, self);
+     if (res)
+     {
+	  PyErr_Format(PyExc_OSError, "H101: set_prefilter: %s (%s)",
+			  ext_data_last_error(self->client), strerror(errno));
+	  return false;
+     }
+     self->prefilter_dirty=false;
+     self->prefilter_on=on;
+     self->prefilter_mask=self->tpat_mask;
+     self->prefilter_partial=self->partial_decode;
+     return true;
+}
+
+// fill the mkhist histograms from event i of b
+static void fill_hists(H101* self, const batch_t& b, npy_intp i)
+{
+     auto& xs=self->xs;
+     auto& ys=self->ys;
+     for (auto& f: self->hists)
+     {
+	  xs.clear();
+	  if (!f.x->get_entries(b, i, xs))
+	       continue;
+	  auto xval=[&](const entry_t& e) { return f.x_index ? double(e.index) : e.value; };
+	  auto yval=[&](const entry_t& e) { return f.y_index ? double(e.index) : e.value; };
+	  if (!f.y)
+	       for (auto& e: xs)
+		    hist_fill(f.hist, xval(e), 0, 1.0);
+	  else if (f.y==f.x) // e.g. channel vs. value of the same field: pairs
+	       for (auto& e: xs)
+		    hist_fill(f.hist, xval(e), yval(e), 1.0);
+	  else // all combinations
+	  {
+	       ys.clear();
+	       if (!f.y->get_entries(b, i, ys))
+		    continue;
+	       for (auto& ex: xs)
+		    for (auto& ey: ys)
+			 hist_fill(f.hist, xval(ex), yval(ey), 1.0);
+	  }
+     }
+}
+
+// start timing a getevent or getbatch call, 0 if timing is off
+static uint64_t stat_begin(H101* self)
+{
+     if (bool(self->timing)!=self->stat_clock)
+     {
+	  self->stat_clock=self->timing;
+	  ext_data_set_wait_clock(self->client, self->timing?stat_ticks:nullptr);
+	  if (!self->stat_t0)
+	       self->stat_t0=stat_ticks();
+     }
+     return self->timing ? stat_ticks() : 0;
+}
+
+// f() for ii, with its time (and one call) counted weight times
+template<typename F>
+static void stat_timed(base_iteminfo* ii, uint64_t weight, bool call, F f)
+{
+     uint64_t t0=stat_ticks();
+     f();
+     ii->ticks+=(stat_ticks()-t0)*weight;
+     ii->calls+=call?weight:0;
+}
+
+// The ext_data calls may block in read(), so they run without the GIL.
+// The client is then not protected by it, so other threads using the
+// same H101 meanwhile get an exception instead.
+static bool H101_acquire(H101* self, const char* what)
+{
+     if (self->busy)
+     {
+	  PyErr_Format(PyExc_RuntimeError, "%s: H101 is in use by another thread.", what);
+	  return false;
+     }
+     self->busy=true;
+     return true;
+}
+
+static PyObject *
+H101_getevent(H101* self, PyObject *Py_UNUSED(ignored))
+{
+     int res{};
+     if (!H101_acquire(self, "H101.getevent"))
+	  return nullptr;
+     if (!update_prefilter(self))
+     {
+	  self->busy=false;
+	  return nullptr;
+     }
+     uint64_t t0=stat_begin(self);
+     // fetch (and decode) without the GIL, event_good does not touch python
+     Py_BEGIN_ALLOW_THREADS
+     do
+     {
+        noerrno;
+        res=ext_data_fetch_event(self->client, self->buf, self->buflen, 0); 
+     } while (res==1 && !self->prefilter_on && !event_good(self, self->buf));
+     Py_END_ALLOW_THREADS
+     // busy until the event is mapped, self->buf is shared
+     if (res!=1)
+	self->busy=false;
+     if (res==0)
+     {
+	Py_XINCREF(Py_False);
+	return Py_False;
+     }
+     CHECK_EXT(res==1, nullptr, "fetch_event");
+     self->stat_events++;
+     uint64_t t1=t0 ? stat_ticks() : 0;
+     batch_t b{self->buf, self->buf, 0, 1};
+     self->lazy_event++; // the lazily mapped fields are outdated
+     set_relwr_base(self, b);
+     if (t0 && ++self->stat_count%self->timing==0) // sampled, per item
+     {
+	for (auto* ii: self->stateful)
+	   stat_timed(ii, self->timing, false, [&]() { ii->prepare(b, 0); });
+	for (auto& ii: self->lazy ? self->eager : self->items)
+	   stat_timed(ii, self->timing, true, [&]() { ii->map_event(); });
+     }
+     else
+     {
+	for (auto* ii: self->stateful)
+	   ii->prepare(b, 0);
+	if (self->lazy)
+	   for (auto* ii: self->eager)
+	      ii->map_event();
+	else
+	{
+	   const uint64_t* dirty=self->dirty;
+	   if (self->plan.nitems!=self->items.size()) // fields were added
+	   {
+	      self->plan.build(self->items, self->buf, self->buflen);
+	      dirty=nullptr; // the new ones have not been mapped yet
+	   }
+	   self->plan.map(dirty);
+	}
+     }
+     // all is mapped up to here
+     std::fill(self->dirty, self->dirty+self->dirty_words, 0);
+     if (!self->hists.empty())
+	fill_hists(self, b, 0);
+     if (t0)
+     {
+	self->stat_fetch+=t1-t0;
+	self->stat_map+=stat_ticks()-t1;
+     }
+     self->busy=false;
+     Py_XINCREF(Py_True);
+     return Py_True;
+}
+// raise OSError for a failed ext_data call
+static PyObject* ext_error(H101* self, const char* what)
+{
+     PyErr_Format(PyExc_OSError, "%s: %s (%s)", what, ext_data_last_error(self->client), strerror(errno));
+     return nullptr;
+}
+
+// size of the slots getbatch decodes into at a time. Larger batches are
+// fetched in chunks, whose columns are joined (see column_joiner).
+static const size_t batch_chunk_bytes=1<<20;
+
+static PyObject *
+H101_getbatch(H101* self, PyObject * args, PyObject * kwds)
+{
+     int n{};
+     char* keywordlist[]={"n", nullptr};
+     if (!PyArg_ParseTupleAndKeywords(args, kwds, "i:H101::getbatch", keywordlist, &n))
+	  return nullptr;
+     if (n<=0)
+     {
+	  PyErr_SetString(PyExc_ValueError, "H101.getbatch: n must be positive.");
+	  return nullptr;
+     }
+     // busy first, another thread may still be decoding into batchbuf
+     if (!H101_acquire(self, "H101.getbatch"))
+	  return nullptr;
+     // slots of one chunk, see column_joiner
+     size_t stride=(self->buflen+7)&~size_t(7);
+     size_t slots=std::max<size_t>(1, std::min<size_t>(n, batch_chunk_bytes/stride));
+     if (slots>self->batch_slots || stride!=self->batch_stride)
+     {
+	  self->batch_stride=stride;
+	  free(self->batchbuf);
+	  self->batchbuf=(char*)malloc(slots*self->batch_stride);
+	  self->batch_slots=self->batchbuf?slots:0;
+	  if (!self->batchbuf)
+	  {
+	       self->busy=false;
+	       return PyErr_NoMemory();
+	  }
+     }
+     if (self->batch_errno)
+     {
+	  errno=self->batch_errno;
+	  self->batch_errno=0;
+	  self->busy=false;
+	  return ext_error(self, "H101.getbatch");
+     }
+     if (!update_prefilter(self))
+     {
+	  self->busy=false;
+	  return nullptr;
+     }
+     std::vector<std::vector<PyObject*>> parts(self->items.size());
+     auto drop_parts=[&]() {
+	  for (auto& pp: parts)
+	       for (auto* p: pp)
+		    Py_DECREF(p);
+     };
+     npy_intp total=0;
+     while (total<n)
+     {
+	  uint64_t t0=stat_begin(self);
+	  int res{};
+	  int want=std::min<npy_intp>(n-total, self->batch_slots);
+	  Py_BEGIN_ALLOW_THREADS
+	  noerrno;
+	  res=ext_data_fetch_events(self->client, self->batchbuf, self->buflen, self->batch_stride, want, 0,
+			  has_filters(self) && !self->prefilter_on?event_accept:nullptr, self);
+	  Py_END_ALLOW_THREADS
+	  if (res<0 && total && errno!=EAGAIN)
+	       self->batch_errno=errno; // hand out the chunks before first
+	  if (res<0 && !total)
+	  {
+	       self->busy=false;
+	       return ext_error(self, "H101.getbatch");
+	  }
+	  if (res<=0)
+	       break;
+	  self->stat_events+=res;
+	  total+=res;
+	  uint64_t t1=t0 ? stat_ticks() : 0;
+	  batch_t b{self->buf, self->batchbuf, self->batch_stride, res};
+	  set_relwr_base(self, b);
+	  for (npy_intp i=0; i<b.n; i++)
+	       for (auto* ii: self->stateful)
+		    ii->prepare(b, i);
+	  for (npy_intp i=0; i<b.n && !self->hists.empty(); i++)
+	       fill_hists(self, b, i);
+	  for (size_t k=0; k<self->items.size(); k++)
+	  {
+	       auto* ii=self->items[k];
+	       PyObject* col{};
+	       if (t0) // once per chunk, always timed
+		    stat_timed(ii, 1, true, [&]() { col=ii->get_column(b); });
+	       else
+		    col=ii->get_column(b);
+	       if (col)
+		    parts[k].push_back(col);
+	       else if (PyErr_Occurred())
+	       {
+		    drop_parts();
+		    self->busy=false;
+		    return nullptr;
+	       }
+	       // else not supported
+	  }
+	  if (t0)
+	  {
+	       self->stat_fetch+=t1-t0;
+	       self->stat_map+=stat_ticks()-t1;
+	  }
+	  if (res<want)
+	       break; // end of data, no data available now, or failure
+     }
+     self->busy=false;
+     if (!total)
+	  Py_RETURN_NONE;
+     column_joiner joiner;
+     bool chunked=false;
+     for (auto& pp: parts)
+     {
+	  chunked|=pp.size()>1;
+	  if (pp.size()>1)
+	       joiner.reserve(pp);
+     }
+     PyObject* dict=chunked && !joiner.alloc() ? nullptr : PyDict_New();
+     for (size_t k=0; k<self->items.size() && dict; k++)
+     {
+	  if (parts[k].empty())
+	       continue;
+	  PyObject* col=parts[k].size()>1 ? joiner.join(parts[k]) : (Py_INCREF(parts[k][0]), parts[k][0]);
+	  if (!col || PyDict_SetItemString(dict, self->items[k]->name, col))
+	       Py_CLEAR(dict);
+	  Py_XDECREF(col);
+     }
+     drop_parts();
+     return dict;
+}
+
+// positioning. Event numbers count all events, also those not passing the filters
+static PyObject *
+H101_seek(H101* self, PyObject * args)
+{
+     unsigned long long event_no{};
+     if (!PyArg_ParseTuple(args, "K:H101::seek", &event_no))
+	  return nullptr;
+     if (!H101_acquire(self, "H101.seek"))
+	  return nullptr;
+     int res{};
+     Py_BEGIN_ALLOW_THREADS
+     noerrno;
+     res=ext_data_seek_event(self->client, event_no);
+     Py_END_ALLOW_THREADS
+     self->busy=false;
+     if (res<0)
+	  return ext_error(self, "H101.seek");
+     return PyBool_FromLong(res);
+}
+
+static PyObject *
+H101_skip(H101* self, PyObject * args)
+{
+     unsigned long long n=1;
+     if (!PyArg_ParseTuple(args, "|K:H101::skip", &n))
+	  return nullptr;
+     if (!H101_acquire(self, "H101.skip"))
+	  return nullptr;
+     int res{};
+     Py_BEGIN_ALLOW_THREADS
+     noerrno;
+     res=ext_data_skip_events(self->client, n);
+     Py_END_ALLOW_THREADS
+     self->busy=false;
+     if (res<0)
+	  return ext_error(self, "H101.skip");
+     return PyBool_FromLong(res);
 }
 
-static void pythonize2(H101* self)  // stage 2: process stage one processors
+static PyObject *
+H101_rewind(H101* self, PyObject *Py_UNUSED(ignored))
 {
-	auto& m = self->str2iteminfo;
-	for (auto& it: m)
-	{
-	}
+     if (!H101_acquire(self, "H101.rewind"))
+	  return nullptr;
+     int res{};
+     Py_BEGIN_ALLOW_THREADS
+     noerrno;
+     res=ext_data_seek_event(self->client, 0);
+     Py_END_ALLOW_THREADS
+     self->busy=false;
+     if (res<0)
+	  return ext_error(self, "H101.rewind");
+     Py_RETURN_NONE;
 }
 
+static PyObject *
+H101_tell(H101* self, PyObject *Py_UNUSED(ignored))
+{
+     if (!H101_acquire(self, "H101.tell"))
+	  return nullptr;
+     self->busy=false;
+     return PyLong_FromUnsignedLongLong(ext_data_tell_event(self->client));
+}
 
-#undef GETPTR
+static PyObject *
+H101_index(H101* self, PyObject * args, PyObject * kwds)
+{
+     PyObject* sidecar=Py_True;
+     char* keywordlist[]={"sidecar", nullptr};
+     if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:H101::index", keywordlist, &sidecar))
+	  return nullptr;
+     std::string name;
+     if (sidecar==Py_True)
+	  name=self->path+".idx";
+     else if (PyUnicode_Check(sidecar))
+	  name=PyUnicode_AsUTF8(sidecar);
+     else if (sidecar!=Py_False && sidecar!=Py_None)
+     {
+	  PyErr_SetString(PyExc_TypeError, "H101.index: sidecar must be True, False or a file name.");
+	  return nullptr;
+     }
+     if (!H101_acquire(self, "H101.index"))
+	  return nullptr;
+     int64_t res{};
+     const char* sidecar_name=name.empty()?nullptr:name.c_str();
+     Py_BEGIN_ALLOW_THREADS
+     noerrno;
+     res=ext_data_index_events(self->client, sidecar_name);
+     Py_END_ALLOW_THREADS
+     self->busy=false;
+     if (res<0)
+	  return ext_error(self, "H101.index");
+     return PyLong_FromLongLong(res);
+}
 
-static void
-H101_dealloc(H101* self)
+// axis (field, nbins, lo, hi): "NAME" uses the values of the field,
+// "NAME:index" the channels (zero suppressed) or element numbers (vectors),
+// anything else is compiled as an expression
+static base_iteminfo* hist_field(H101* self, PyObject* spec, PyObject** axis, bool* index)
 {
-    //printf("%s entered\n", __FUNCTION__ );
-    if (self->dict)
-       Py_XDECREF(self->dict);
-    if (self->buf) free(self->buf);
-    for (auto v: self->items)
-	   delete v;
-    // todo: who owns the ext_data_structure_item?
-    if (self->client) free(self->client);
+     if (!PyTuple_Check(spec) || PyTuple_Size(spec)!=4 || !PyUnicode_Check(PyTuple_GET_ITEM(spec, 0)))
+     {
+	  PyErr_SetString(PyExc_TypeError, "H101.mkhist: axes are (field, nbins, lo, hi).");
+	  return nullptr;
+     }
+     std::string name=PyUnicode_AsUTF8(PyTuple_GET_ITEM(spec, 0));
+     *index=name.size()>6 && !name.compare(name.size()-6, 6, ":index");
+     if (*index)
+	  name.resize(name.size()-6);
+     auto it=self->str2iteminfo.find(name);
+     base_iteminfo* res{};
+     if (it!=self->str2iteminfo.end() && it->second->has_entries())
+	  res=it->second;
+     else
+     {
+	  *index=false;
+	  res=compile_expr(PyUnicode_AsUTF8(PyTuple_GET_ITEM(spec, 0)), self->str2iteminfo, self->buf);
+	  if (!res)
+	       return nullptr;
+	  self->hist_exprs.push_back(res);
+     }
+     *axis=PyTuple_GetSlice(spec, 1, 4);
+     return res;
+}
 
-    PyObject saved=self->ob_base;
-    self->~H101();  // call the destructor.  
-    self->ob_base=saved;
-    Py_TYPE(self)->tp_free((PyObject *) self);
-    Py_XDECREF(self->triggermap);
-    Py_XDECREF(self->unpacker);
-    //printf("%s done\n", __FUNCTION__ );
+// a field usable for native filling, nullptr with a KeyError
+static base_iteminfo* find_field(H101* self, const char* name, const char* what)
+{
+     auto it=self->str2iteminfo.find(name);
+     if (it==self->str2iteminfo.end() || !it->second->has_entries())
+     {
+	  PyErr_Format(PyExc_KeyError, "%s: no field %s.", what, name);
+	  return nullptr;
+     }
+     return it->second;
 }
 
-static PyObject *
-H101_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+static bool check_params(const finetime_params& p, const char* what)
 {
-	//printf("%s entered\n", __FUNCTION__ );
-   	H101 *self = (H101 *) type->tp_alloc(type, 0);
-	if (!self)
-	    return nullptr;
-	assert((void*)self == (void*)(&self->ob_base)); // no vtable plz
+     if (p.finebins<2 || p.update_interval==0)
+     {
+	  PyErr_Format(PyExc_ValueError, "%s: need finebins>1 and update_interval>0.", what);
+	  return false;
+     }
+     return true;
+}
 
-	// call the C++ constructor without destroying the python header
-	// there has to be a better way for this
-	PyObject saved=self->ob_base;
-	new (self) H101(); // default init
-	self->ob_base=saved;
-        //printf("%s exiting\n", __FUNCTION__ );
-	return (PyObject*) self;
+static bool check_new_name(H101* self, const std::string& name, const char* what)
+{
+     if (self->str2iteminfo.count(name))
+     {
+	  PyErr_Format(PyExc_ValueError, "%s: field %s exists already.", what, name.c_str());
+	  return false;
+     }
+     return true;
 }
 
-/* PyObject* VarPyLong_alloc()
+static PyObject *
+H101_addtdc(H101* self, PyObject * args, PyObject * kwds)
 {
-   PyObject* res=malloc(MAX_PYLONG_SIZE);
-   PyLong_assign
-}*/
+     char *name{}, *coarse{}, *fine{}, *prefix{};
+     double period=5.0; // ns
+     PyObject* cals{};
+     finetime_params p;
+     unsigned long long update_interval=p.update_interval;
+     char* keywordlist[]={"name", "coarse", "fine", "period", "cals", "prefix",
+	     "finebins", "mincount", "update_interval", "stat_lifetime", nullptr};
+     if (!PyArg_ParseTupleAndKeywords(args, kwds, "sss|dO!zIdKd:H101::addtdc", keywordlist,
+			     &name, &coarse, &fine, &period, &PyDict_Type, &cals, &prefix,
+			     &p.finebins, &p.mincount, &update_interval, &p.stat_lifetime))
+	  return nullptr;
+     p.update_interval=update_interval;
+     if (!check_params(p, "H101.addtdc") || !check_new_name(self, name, "H101.addtdc"))
+	  return nullptr;
+     auto* c=find_field(self, coarse, "H101.addtdc");
+     auto* f=c ? find_field(self, fine, "H101.addtdc") : nullptr;
+     if (!f)
+	  return nullptr;
+     auto* ii=new tdc_iteminfo(c, f, prefix?prefix:name, period, p, cals);
+     self->stateful.push_back(ii);
+     pythonize_reg_item(self, name, ii);
+     Py_RETURN_NONE;
+}
 
+static PyObject *
+H101_addtot(H101* self, PyObject * args, PyObject * kwds)
+{
+     char *name{}, *lc{}, *lf{}, *tc{}, *tf{}, *prefix{};
+     double period=5.0; // ns
+     unsigned int wrap=1024; // coarse counts
+     PyObject* cals{};
+     finetime_params p;
+     unsigned long long update_interval=p.update_interval;
+     char* keywordlist[]={"name", "lead_coarse", "lead_fine", "trail_coarse", "trail_fine",
+	     "period", "wrap", "cals", "prefix",
+	     "finebins", "mincount", "update_interval", "stat_lifetime", nullptr};
+     if (!PyArg_ParseTupleAndKeywords(args, kwds, "sssss|dIO!zIdKd:H101::addtot", keywordlist,
+			     &name, &lc, &lf, &tc, &tf, &period, &wrap, &PyDict_Type, &cals, &prefix,
+			     &p.finebins, &p.mincount, &update_interval, &p.stat_lifetime))
+	  return nullptr;
+     p.update_interval=update_interval;
+     // the calibrated edges are fields as well, e.g. for triggers
+     std::string base=prefix?prefix:name;
+     std::string lname=base+"_lead", tname=base+"_trail";
+     if (!check_params(p, "H101.addtot") || !check_new_name(self, name, "H101.addtot")
+	 || !check_new_name(self, lname, "H101.addtot") || !check_new_name(self, tname, "H101.addtot"))
+	  return nullptr;
+     base_iteminfo* src[4]{};
+     const char* names[4]={lc, lf, tc, tf};
+     for (int i=0; i<4; i++)
+	  if (!(src[i]=find_field(self, names[i], "H101.addtot")))
+	       return nullptr;
+     auto* lead=new tdc_iteminfo(src[0], src[1], lname, period, p, cals);
+     auto* trail=new tdc_iteminfo(src[2], src[3], tname, period, p, cals);
+     for (auto* ii: {lead, trail})
+     {
+	  self->stateful.push_back(ii);
+	  self->hidden.push_back(ii);
+     }
+     self->str2iteminfo[lname]=lead;
+     self->str2iteminfo[tname]=trail;
+     auto* tot=new tot_iteminfo(lead, trail, wrap*period, self->buf);
+     self->stateful.push_back(tot); // after its edges
+     pythonize_reg_item(self, name, tot);
+     Py_RETURN_NONE;
+}
 
-static int
-H101_init(H101 *self, PyObject *args, PyObject *kwds)
+static PyObject *
+H101_settrig(H101* self, PyObject * args, PyObject * kwds)
 {
-    noerrno;
-    //printf("%s entered\n", __FUNCTION__ );
-    // at some point, we would like to call our c++ constructor.
-    auto base=self->ob_base; // don't mess with python
-    //new (self) H101(); 
-    self->ob_base=base;
-    char* keywordlist[]={"fd", nullptr};
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "I", keywordlist, &(self->fd)))
-		return -1;
+     char *name{};
+     PyObject* map{};
+     char* keywordlist[]={"name", "trig", nullptr};
+     if (!PyArg_ParseTupleAndKeywords(args, kwds, "sO!:H101::settrig", keywordlist, &name, &PyDict_Type, &map))
+	  return nullptr;
+     auto it=self->str2iteminfo.find(name);
+     auto* tot=it==self->str2iteminfo.end() ? nullptr : dynamic_cast<tot_iteminfo*>(it->second);
+     if (!tot)
+     {
+	  PyErr_Format(PyExc_KeyError, "H101.settrig: no time over threshold field %s.", name);
+	  return nullptr;
+     }
+     decltype(tot->trig) trig;
+     PyObject *key, *value;
+     Py_ssize_t pos=0;
+     while (PyDict_Next(map, &pos, &key, &value))
+     {
+	  unsigned int ch{}, tch{};
+	  const char* field{};
+	  if (!PyArg_Parse(key, "I", &ch) || !PyArg_ParseTuple(value, "sI", &field, &tch))
+	  {
+	       PyErr_SetString(PyExc_TypeError, "H101.settrig: trig is {channel: (field, channel)}.");
+	       return nullptr;
+	  }
+	  auto* f=find_field(self, field, "H101.settrig");
+	  if (!f)
+	       return nullptr;
+	  trig[ch]={f, tch};
+     }
+     tot->trig.swap(trig);
+     Py_RETURN_NONE;
+}
 
-        //new (&self->itemmap) decltype(self->itemmap);
-	self->dict = PyDict_New();
-	Py_XINCREF(self->dict);
-	self->client = ext_data_from_fd(self->fd);
-	Py_XINCREF(Py_None);
-	self->triggermap=Py_None;
-	Py_XINCREF(Py_None);
-	self->unpacker=Py_None;
-	int res{};
-	uint32_t map_success = 0;
-	printf("errno=%d\n", errno);
-	ext_data_structure_info* info = ext_data_struct_info_alloc();
-	printf("errno=%d\n", errno);
-	res=ext_data_setup(self->client, NULL, 0, info, &map_success, 0, "", nullptr);
-       	CHECK_EXT(res==0, RFAIL, "setup");
+// the items of a filter are read before prepare(), which rules out the
+// calibrated fields, also inside of expressions
+static base_iteminfo* stateful_item(H101* self, base_iteminfo* item)
+{
+     if (std::find(self->stateful.begin(), self->stateful.end(), item)!=self->stateful.end())
+	  return item;
+     if (auto* e=dynamic_cast<expr_iteminfo*>(item))
+	  for (auto& op: e->prog.ops)
+	       if (op.code==expr_op::LOAD)
+		    if (auto* res=stateful_item(self, op.item))
+			 return res;
+     return nullptr;
+}
 
-	struct ext_data_structure_item* items=ext_data_struct_info_get_items(info);
-	int tot=0;
+// d[name]=value, stealing the reference
+static PyObject* stat_dict(PyObject* d, const char* name, PyObject* value)
+{
+     if (d && value)
+	  PyDict_SetItemString(d, name, value);
+     Py_XDECREF(value);
+     return d;
+}
 
-	while(items)
-	{
-		if (0 && items->_var_name[0]!='N')
-			printf("%s 0x%x, %d\n", items->_var_name, items->_var_type, items->_length);
-		self->itemmap[items->_var_name]=items;
-		tot+=items->_length;
-		items=items->_next_off_item;
-	}
-	self->buf=(char*)malloc(tot);
-	self->buflen=tot;
-        auto& m=self->itemmap;
+static PyObject *
+H101_stats(H101* self, PyObject * args, PyObject * kwds)
+{
+     int reset=0;
+     char* keywordlist[]={"reset", nullptr};
+     if (!PyArg_ParseTupleAndKeywords(args, kwds, "|p:H101::stats", keywordlist, &reset))
+	  return nullptr;
+     if (!H101_acquire(self, "H101.stats"))
+	  return nullptr;
+     double tick=self->stat_t0 ? stat_tick_seconds() : 0;
+     double elapsed=self->stat_t0 ? (stat_ticks()-self->stat_t0)*tick : 0;
+     double wait=(ext_data_wait_time(self->client)-self->stat_wait0)*tick;
+     double fetch=self->stat_fetch*tick;
+     PyObject* items=PyDict_New();
+     auto add_items=[&](const std::vector<base_iteminfo*>& v)
+     {
+	  for (auto* ii: v)
+	       if (ii->calls || ii->ticks)
+		    stat_dict(items, ii->name, Py_BuildValue("{s:K,s:d}",
+				    "calls", (unsigned long long)ii->calls, "seconds", ii->ticks*tick));
+     };
+     add_items(self->items);
+     add_items(self->hidden);
+     PyObject* res=PyDict_New();
+     stat_dict(res, "events", PyLong_FromUnsignedLongLong(self->stat_events));
+     if (self->stat_t0)
+     {
+	  stat_dict(res, "elapsed", PyFloat_FromDouble(elapsed));
+	  stat_dict(res, "events_per_second", PyFloat_FromDouble(elapsed>0 ? self->stat_events/elapsed : 0));
+	  stat_dict(res, "wait", PyFloat_FromDouble(wait));
+	  stat_dict(res, "decode", PyFloat_FromDouble(std::max(fetch-wait, 0.0)));
+	  stat_dict(res, "map", PyFloat_FromDouble(self->stat_map*tick));
+     }
+     stat_dict(res, "items", items);
+     if (reset)
+     {
+	  self->stat_events=self->stat_count=self->stat_fetch=self->stat_map=0;
+	  self->stat_wait0=ext_data_wait_time(self->client);
+	  self->stat_t0=self->timing ? stat_ticks() : 0;
+	  for (auto* v: {&self->items, &self->hidden})
+	       for (auto* ii: *v)
+		    ii->ticks=ii->calls=0;
+     }
+     self->busy=false;
+     return res;
+}
 
-        pythonize1(self);
-        pythonize2(self);
-        //printf("%s done\n", __FUNCTION__);
-	return 0;
+static PyObject *
+H101_addfilter(H101* self, PyObject * args, PyObject * kwds)
+{
+     char *formula{};
+     char* keywordlist[]={"formula", nullptr};
+     if (!PyArg_ParseTupleAndKeywords(args, kwds, "s:H101::addfilter", keywordlist, &formula))
+	  return nullptr;
+     auto* ii=compile_expr(formula, self->str2iteminfo, self->buf);
+     if (!ii)
+	  return nullptr;
+     if (auto* st=stateful_item(self, ii))
+     {
+	  PyErr_Format(PyExc_ValueError, "H101.addfilter: %s is not available before mapping.", st->name);
+	  delete ii;
+	  return nullptr;
+     }
+     // the filters are used without the GIL
+     if (!H101_acquire(self, "H101.addfilter"))
+     {
+	  delete ii;
+	  return nullptr;
+     }
+     self->filters.push_back(ii);
+     self->prefilter_dirty=true;
+     self->busy=false;
+     Py_RETURN_NONE;
 }
 
-static PyObject * 
-H101_addfield(H101* self, PyObject * args, PyObject * kwds)
+static PyObject *
+H101_clearfilters(H101* self, PyObject *Py_UNUSED(ignored))
 {
-   PyObject * outp{}, * callback{};
-   char * name{};
-   char* keywordlist[]={"name", "outp", "callback",  nullptr};
-   if (!PyArg_ParseTupleAndKeywords(args, kwds, "sOO:H101::addfield", keywordlist, &name, &outp, &callback))
-   {
-	Py_XINCREF(Py_False);
-	return Py_False;
-   }
-   Py_XINCREF(outp);
-   Py_XINCREF(callback);
-   auto* ii=new pyimp_iteminfo(outp, callback);
-   pythonize_reg_item(self, name, ii);
+     if (!H101_acquire(self, "H101.clearfilters"))
+	  return nullptr;
+     for (auto v: self->filters)
+	   delete v;
+     self->filters.clear();
+     self->prefilter_dirty=true;
+     self->busy=false;
+     Py_RETURN_NONE;
+}
 
-   Py_XINCREF(Py_True);
-   return Py_True;
+static PyObject *
+H101_addexpr(H101* self, PyObject * args, PyObject * kwds)
+{
+     char *name{}, *formula{};
+     char* keywordlist[]={"name", "formula", nullptr};
+     if (!PyArg_ParseTupleAndKeywords(args, kwds, "ss:H101::addexpr", keywordlist, &name, &formula))
+	  return nullptr;
+     if (self->str2iteminfo.count(name))
+     {
+	  PyErr_Format(PyExc_ValueError, "H101.addexpr: field %s exists already.", name);
+	  return nullptr;
+     }
+     auto* ii=compile_expr(formula, self->str2iteminfo, self->buf);
+     if (!ii)
+	  return nullptr;
+     pythonize_reg_item(self, name, ii);
+     Py_RETURN_NONE;
 }
 
 static PyObject *
-H101_getevent(H101* self, PyObject *Py_UNUSED(ignored))
+H101_mkhist(H101* self, PyObject * args, PyObject * kwds)
 {
-     while (1)
+     PyObject *x{}, *y{};
+     char* keywordlist[]={"x", "y", nullptr};
+     if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O:H101::mkhist", keywordlist, &x, &y))
+	  return nullptr;
+     if (y==Py_None)
+	  y=nullptr;
+     hist_filler f{};
+     PyObject *xaxis{}, *yaxis{};
+     f.x=hist_field(self, x, &xaxis, &f.x_index);
+     if (f.x && y)
+	  f.y=hist_field(self, y, &yaxis, &f.y_index);
+     if (!f.x || (y && !f.y))
      {
-        noerrno;
-        int res=ext_data_fetch_event(self->client, self->buf, self->buflen, 0); 
-        if (res==0)
-        {
-   	   Py_XINCREF(Py_False);
-	   return Py_False;
-        }
-        CHECK_EXT(res==1, nullptr, "fetch_event");
-	if (self->tpat_mask!=NO_TPAT_MASK)
-	{
-	   bool good=false;
-	   for (int i=0; i<*self->tpat_len; i++)
-	       if (self->tpat[i] & self->tpat_mask)
-	       {
-		    good=true;
-		    break;
-	       }
-	   if (!good)
-		   continue;
-	}
-        for (auto& ii: self->items)
-        {
-   	   ii->map_event();
-        }
-        Py_XINCREF(Py_True);
-        return Py_True;
+	  Py_XDECREF(xaxis);
+	  return nullptr;
      }
+     PyObject* h=PyObject_CallFunctionObjArgs(reinterpret_cast<PyObject*>(&Hist_type), xaxis, yaxis, nullptr);
+     Py_DECREF(xaxis);
+     Py_XDECREF(yaxis);
+     if (!h)
+	  return nullptr;
+     f.hist=reinterpret_cast<Hist*>(h);
+     Py_INCREF(h); // ours, for filling
+     self->hists.push_back(f);
+     return h;
 }
+
 static PyObject *
 H101_getdict(H101* self, PyObject *Py_UNUSED(ignored))
 {
 	//printf("ref count: %p -> %d\n", self->dict, Py_REFCNT(self->dict));
+	if (self->lazydict)
+	{
+		Py_INCREF(self->lazydict);
+		return reinterpret_cast<PyObject*>(self->lazydict);
+	}
 	Py_XINCREF(self->dict);
 	return self->dict;
 }
 
+// read only numpy view of item in buf, 0-d for single values.
+// Py_None for types numpy can not show directly. 
+static PyObject* item_view(H101* self, ext_data_structure_item* item)
+{
+	int npy_t;
+	switch (item->_var_type & EXT_DATA_ITEM_TYPE_MASK)
+	{
+	case EXT_DATA_ITEM_TYPE_INT32:
+		npy_t=NPY_INT32;
+		break;
+	case EXT_DATA_ITEM_TYPE_UINT32:
+		npy_t=NPY_UINT32;
+		break;
+	case EXT_DATA_ITEM_TYPE_FLOAT32:
+		npy_t=NPY_FLOAT32;
+		break;
+	default:
+		Py_RETURN_NONE;
+	}
+	npy_intp n=item->_length/4;
+	int nd=n==1 && !item->_var_ctrl_name[0] ? 0 : 1;
+	PyObject* res=PyArray_NewFromDescr(&PyArray_Type, PyArray_DescrFromType(npy_t), nd, &n, nullptr,
+			self->buf+item->_offset, NPY_ARRAY_CARRAY_RO, nullptr);
+	if (!res)
+		return nullptr;
+	Py_INCREF(self->bufobj);
+	if (PyArray_SetBaseObject(reinterpret_cast<PyArrayObject*>(res), self->bufobj)<0)
+	{
+		Py_DECREF(res);
+		return nullptr;
+	}
+	return res;
+}
+
+static PyObject *
+H101_getviews(H101* self, PyObject *Py_UNUSED(ignored))
+{
+	if (!self->views)
+	{
+		PyObject* d=PyDict_New();
+		for (auto& it: self->itemmap)
+		{
+			PyObject* v=d ? item_view(self, it.second) : nullptr;
+			if (!v || (v!=Py_None && PyDict_SetItemString(d, it.first.c_str(), v)<0))
+				Py_CLEAR(d);
+			Py_XDECREF(v);
+		}
+		if (!d)
+			return nullptr;
+		self->views=d;
+	}
+	Py_INCREF(self->views);
+	return self->views;
+}
+
 static PyMemberDef H101_members[] = {
 	{"triggermap", T_OBJECT_EX, offsetof(H101, triggermap)},
 	{"unpacker",   T_OBJECT_EX, offsetof(H101, unpacker)},
 	{"tpat_mask",  T_USHORT,    offsetof(H101, tpat_mask)},
+	{"partial_decode", T_BOOL,  offsetof(H101, partial_decode)},
+	{"timing",     T_UINT,      offsetof(H101, timing)},
 	{nullptr, 0, 0}
 };
 
@@ -871,6 +4514,21 @@ static PyMethodDef H101_methods[] =
 {
 	{"getevent", (PyCFunction)H101_getevent, METH_NOARGS, "Reads the next event."},
 	{"getdict", (PyCFunction)H101_getdict, METH_NOARGS, "Get the dictionary of parsed h101 fields"},
+	{"getviews", (PyCFunction)H101_getviews, METH_NOARGS, "Get a dict of read only numpy views of the raw items of the current event, by STRUCT name."},
+	{"seek", (PyCFunction)H101_seek, METH_VARARGS, "Position at event n (files only). False if the file has fewer events."},
+	{"skip", (PyCFunction)H101_skip, METH_VARARGS, "Skip n (default 1) events without unpacking them. False at the end."},
+	{"rewind", (PyCFunction)H101_rewind, METH_NOARGS, "Start at the first event again (files only)."},
+	{"tell", (PyCFunction)H101_tell, METH_NOARGS, "Number of the next event."},
+	{"index", (PyCFunction)H101_index, METH_VARARGS | METH_KEYWORDS, "Index all events of the file (using/writing sidecar path.idx by default), returns their number."},
+	{"getbatch", (PyCFunction)H101_getbatch, METH_VARARGS | METH_KEYWORDS, "Reads up to n events, returns a dict of numpy arrays (one entry per event), or None at the end."},
+	{"mkhist", (PyCFunction)H101_mkhist, METH_VARARGS | METH_KEYWORDS, "Native histogram of x=(field, nbins, lo, hi) (and y), filled by getevent and getbatch."},
+	{"addtdc", (PyCFunction)H101_addtdc, METH_VARARGS | METH_KEYWORDS, "Add TDC times with natively calibrated fine times from coarse and fine fields."},
+	{"addtot", (PyCFunction)H101_addtot, METH_VARARGS | METH_KEYWORDS, "Add time over threshold hits from leading and trailing TDC edge fields."},
+	{"settrig", (PyCFunction)H101_settrig, METH_VARARGS | METH_KEYWORDS, "Set the trigger channels {channel: (field, channel)} of a time over threshold field."},
+	{"stats", (PyCFunction)H101_stats, METH_VARARGS | METH_KEYWORDS, "Event counts and, with timing set, where the time goes."},
+	{"addfilter", (PyCFunction)H101_addfilter, METH_VARARGS | METH_KEYWORDS, "Only return events for which the expression is true, checked before mapping."},
+	{"clearfilters", (PyCFunction)H101_clearfilters, METH_NOARGS, "Remove the filters from addfilter."},
+	{"addexpr", (PyCFunction)H101_addexpr, METH_VARARGS | METH_KEYWORDS, "Add a field computed natively from an expression over other fields."},
 	{"addfield", (PyCFunction)H101_addfield, METH_VARARGS | METH_KEYWORDS, "Add an iteminfo field filled from python."},
 	{nullptr}
 };
@@ -901,6 +4559,109 @@ void mkH101_type()
 }    
 
 
+void mkZSDict_type()
+{
+    memset(&ZSDict_type, 0, sizeof(ZSDict_type));
+    ZSDict_type.tp_basicsize = sizeof(ZSDict);
+    ZSDict_type.tp_itemsize = 0;
+    ZSDict_type.tp_name = "h101.ZSDict";
+    ZSDict_type.tp_doc = PyDoc_STR("Read only mapping channel -> value of a zero suppressed field for the current event");
+    ZSDict_type.tp_flags = Py_TPFLAGS_DEFAULT;
+#ifdef Py_TPFLAGS_MAPPING
+    ZSDict_type.tp_flags |= Py_TPFLAGS_MAPPING; // for match, python 3.10
+#endif
+    ZSDict_type.tp_as_mapping = &ZSDict_mapping;
+    ZSDict_type.tp_as_sequence = &ZSDict_sequence;
+#define SetZSDict(name, cast) ZSDict_type.tp_ ## name = cast ZSDict_ ## name ;
+    SetZSDict(dealloc, (destructor));
+    SetZSDict(methods,);
+    SetZSDict(iter, (getiterfunc));
+    SetZSDict(repr, (reprfunc));
+    SetZSDict(richcompare, (richcmpfunc));
+}
+
+
+void mkMultiDict_type()
+{
+    memset(&MultiDict_type, 0, sizeof(MultiDict_type));
+    MultiDict_type.tp_basicsize = sizeof(MultiDict);
+    MultiDict_type.tp_itemsize = 0;
+    MultiDict_type.tp_name = "h101.MultiDict";
+    MultiDict_type.tp_doc = PyDoc_STR("Read only mapping channel -> HitList of a zero suppressed multi hit field for the current event");
+    MultiDict_type.tp_flags = Py_TPFLAGS_DEFAULT;
+#ifdef Py_TPFLAGS_MAPPING
+    MultiDict_type.tp_flags |= Py_TPFLAGS_MAPPING;
+#endif
+    MultiDict_type.tp_as_mapping = &MultiDict_mapping;
+    MultiDict_type.tp_as_sequence = &MultiDict_sequence;
+#define SetMultiDict(name, cast) MultiDict_type.tp_ ## name = cast MultiDict_ ## name ;
+    SetMultiDict(dealloc, (destructor));
+    SetMultiDict(methods,);
+    SetMultiDict(iter, (getiterfunc));
+    SetMultiDict(repr, (reprfunc));
+    SetMultiDict(richcompare, (richcmpfunc));
+}
+
+
+void mkHitList_type()
+{
+    memset(&HitList_type, 0, sizeof(HitList_type));
+    HitList_type.tp_basicsize = sizeof(HitList);
+    HitList_type.tp_itemsize = 0;
+    HitList_type.tp_name = "h101.HitList";
+    HitList_type.tp_doc = PyDoc_STR("Read only view of the hits of one channel of a zero suppressed multi hit field in the current event");
+    HitList_type.tp_flags = Py_TPFLAGS_DEFAULT;
+#ifdef Py_TPFLAGS_SEQUENCE
+    HitList_type.tp_flags |= Py_TPFLAGS_SEQUENCE;
+#endif
+    HitList_type.tp_as_mapping = &HitList_mapping;
+    HitList_type.tp_as_sequence = &HitList_sequence;
+#define SetHitList(name, cast) HitList_type.tp_ ## name = cast HitList_ ## name ;
+    SetHitList(dealloc, (destructor));
+    SetHitList(methods,);
+    SetHitList(repr, (reprfunc));
+    SetHitList(richcompare, (richcmpfunc));
+}
+
+
+void mkLazyDict_type()
+{
+    memset(&LazyDict_type, 0, sizeof(LazyDict_type));
+    LazyDict_type.tp_basicsize = sizeof(LazyDict);
+    LazyDict_type.tp_itemsize = 0;
+    LazyDict_type.tp_name = "h101.LazyDict";
+    LazyDict_type.tp_doc = PyDoc_STR("The fields of H101(lazy=True), mapped for the current event when looked up");
+    LazyDict_type.tp_flags = Py_TPFLAGS_DEFAULT;
+#ifdef Py_TPFLAGS_MAPPING
+    LazyDict_type.tp_flags |= Py_TPFLAGS_MAPPING;
+#endif
+    LazyDict_type.tp_as_mapping = &LazyDict_mapping;
+    LazyDict_type.tp_as_sequence = &LazyDict_sequence;
+#define SetLazyDict(name, cast) LazyDict_type.tp_ ## name = cast LazyDict_ ## name ;
+    SetLazyDict(dealloc, (destructor));
+    SetLazyDict(methods,);
+    SetLazyDict(iter, (getiterfunc));
+    SetLazyDict(repr, (reprfunc));
+}
+
+
+void mkHist_type()
+{
+    memset(&Hist_type, 0, sizeof(Hist_type));
+    Hist_type.tp_basicsize = sizeof(Hist);
+    Hist_type.tp_itemsize = 0;
+    Hist_type.tp_name = "h101.Hist";
+    Hist_type.tp_doc = PyDoc_STR("Hist(x=(nbins, lo, hi), y=None): a native histogram with fixed binning");
+    Hist_type.tp_flags = Py_TPFLAGS_DEFAULT;
+#define SetHist(name, cast) Hist_type.tp_ ## name = cast Hist_ ## name ;
+    SetHist(new,);
+    SetHist(init,(initproc));
+    SetHist(dealloc, (destructor));
+    SetHist(methods,);
+    SetHist(getset,);
+}
+
+
 PyMODINIT_FUNC
 PyInit__h101(void)
 {
@@ -909,6 +4670,16 @@ PyInit__h101(void)
     import_array();
     mkH101_type();
     if (PyType_Ready(&H101_type)<0) return nullptr;
+    mkHist_type();
+    if (PyType_Ready(&Hist_type)<0) return nullptr;
+    mkZSDict_type();
+    if (PyType_Ready(&ZSDict_type)<0) return nullptr;
+    mkMultiDict_type();
+    if (PyType_Ready(&MultiDict_type)<0) return nullptr;
+    mkHitList_type();
+    if (PyType_Ready(&HitList_type)<0) return nullptr;
+    mkLazyDict_type();
+    if (PyType_Ready(&LazyDict_type)<0) return nullptr;
 
     PyObject *m = PyModule_Create(&h101module);
     if (!m) return nullptr;
@@ -918,6 +4689,36 @@ PyInit__h101(void)
 	Py_DECREF(m);
 	return nullptr;
     }
+   Py_INCREF(&Hist_type);
+   if (PyModule_AddObject(m, "Hist", reinterpret_cast<PyObject*>(&Hist_type))<0)
+    {
+	Py_DECREF(m);
+	return nullptr;
+    }
+   Py_INCREF(&ZSDict_type);
+   if (PyModule_AddObject(m, "ZSDict", reinterpret_cast<PyObject*>(&ZSDict_type))<0)
+    {
+	Py_DECREF(m);
+	return nullptr;
+    }
+   Py_INCREF(&MultiDict_type);
+   if (PyModule_AddObject(m, "MultiDict", reinterpret_cast<PyObject*>(&MultiDict_type))<0)
+    {
+	Py_DECREF(m);
+	return nullptr;
+    }
+   Py_INCREF(&HitList_type);
+   if (PyModule_AddObject(m, "HitList", reinterpret_cast<PyObject*>(&HitList_type))<0)
+    {
+	Py_DECREF(m);
+	return nullptr;
+    }
+   Py_INCREF(&LazyDict_type);
+   if (PyModule_AddObject(m, "LazyDict", reinterpret_cast<PyObject*>(&LazyDict_type))<0)
+    {
+	Py_DECREF(m);
+	return nullptr;
+    }
     //printf("initialized module\n");   
     return m;
 }
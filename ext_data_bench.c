@@ -0,0 +1,546 @@
+/* Microbenchmark for the ext_data_client event decoding.
+ *
+ * Synthetic events are bit-packed the way the unpacker sends them
+ * (only transmitted words, offset skips for absent array entries),
+ * and then decoded with each available implementation of
+ * ext_data_write_bitpacked_event().  The output buffers are checked
+ * to be byte-identical to the scalar decoder, including the words
+ * that are skipped.  The raw data byte swap of ext_data_get_raw_data()
+ * is timed on synthetic blocks of a few sizes.
+ *
+ * Recorded STRUCT files (from an unpacker, --ntuple=RAW,STRUCT,file,
+ * or from ext_data_gen) are read through a client, and the stages of
+ * ext_data_fetch_event() are timed separately for each event:
+ * ext_data_get_raw_data() (if the events have raw data), the unpacking
+ * (ext_data_write_bitpacked_event() or ext_data_write_packed_event())
+ * and, with every second item selected, ext_data_struct_map_items().
+ *
+ * Cycles are the time stamp counter (i.e. at the nominal clock) on
+ * x86, else nanoseconds.
+ *
+ * Usage: ext_data_bench [events] [repetitions] [file.struct ...]
+ */
+
+#define EXT_DATA_CLIENT_INTERNALS
+#include "ext_data_client.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <inttypes.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define BENCH_STRUCT_WORDS  4096
+
+/* One synthetic event mix: how many words are transmitted, and what
+ * values they carry.
+ */
+struct bench_mix
+{
+  const char *_name;
+  const char *_descr;
+  double      _present;  /* fraction of struct words transmitted */
+  double      _small;    /* 0..31 (counts, indices, zero) */
+  double      _13bit;    /* 32..8191 (TDC fine/coarse, ADC) */
+  double      _nan;      /* cleared float */
+  /* remaining: full 32 bits (timestamps) */
+};
+
+static const struct bench_mix bench_mixes[] = {
+  { "sparse", "few hits, mostly zero counts",         0.10, 0.90, 0.08, 0.00 },
+  { "short",  "a handful of hits, short events",      0.005, 0.50, 0.50, 0.00 },
+  { "tdc",    "high multiplicity multi-hit TDC data", 0.80, 0.25, 0.73, 0.00 },
+  { "mixed",  "some of everything",                   0.50, 0.45, 0.35, 0.05 },
+  { "trace",  "sampling ADC traces, no zero suppression", 1.00, 0.05, 0.95, 0.00 },
+  { "wide",   "timestamps and raw 32 bit words",      0.50, 0.10, 0.10, 0.05 },
+};
+
+static uint32_t bench_rand_state = 12345;
+
+static uint32_t bench_rand(void)
+{
+  /* xorshift32 - just needs to be deterministic */
+  uint32_t x = bench_rand_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return bench_rand_state = x;
+}
+
+static double bench_uniform(void)
+{
+  return bench_rand() / 4294967296.;
+}
+
+static uint8_t *bench_pack_word(uint8_t *p, uint32_t skip, uint32_t value)
+{
+  if (value < 0x2000)
+    {
+      while (skip)
+	{
+	  *(p++) = (uint8_t) (0x80 | (skip & 0x7f));
+	  skip >>= 7;
+	}
+      if (value < 0x20)
+	*(p++) = (uint8_t) value;
+      else
+	{
+	  *(p++) = (uint8_t) (0x20 | (value >> 8));
+	  *(p++) = (uint8_t) value;
+	}
+    }
+  else if (value == 0x7fc00000)
+    {
+      while (skip >= 0x10)
+	{
+	  *(p++) = (uint8_t) (0x80 | (skip & 0x7f));
+	  skip >>= 7;
+	}
+      *(p++) = (uint8_t) (0x60 | skip);
+    }
+  else
+    {
+      while (skip >= 0x20)
+	{
+	  *(p++) = (uint8_t) (0x80 | (skip & 0x7f));
+	  skip >>= 7;
+	}
+      *(p++) = (uint8_t) (0x40 | skip);
+      *(p++) = (uint8_t) (value >> 24);
+      *(p++) = (uint8_t) (value >> 16);
+      *(p++) = (uint8_t) (value >> 8);
+      *(p++) = (uint8_t) value;
+    }
+  return p;
+}
+
+/* Pack one random event of the mix.  Returns the end pointer. */
+static uint8_t *bench_pack_event(uint8_t *p, const struct bench_mix *mix)
+{
+  uint32_t i, last = 0;
+
+  for (i = 0; i < BENCH_STRUCT_WORDS; i++)
+    {
+      double r;
+      uint32_t value;
+
+      /* The last word is always sent, so the event ends there. */
+      if (i != BENCH_STRUCT_WORDS - 1 && bench_uniform() >= mix->_present)
+	continue;
+
+      r = bench_uniform();
+      if ((r -= mix->_small) < 0)
+	value = bench_rand() % 0x20;
+      else if ((r -= mix->_13bit) < 0)
+	value = 0x20 + bench_rand() % (0x2000 - 0x20);
+      else if ((r -= mix->_nan) < 0)
+	value = 0x7fc00000;
+      else
+	value = bench_rand() | 0x2000;
+
+      p = bench_pack_word(p, i - last, value);
+      last = i + 1;
+    }
+  return p;
+}
+
+static double bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static uint64_t bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+/* Cost of reading the clock, subtracted from the per event stages. */
+static uint64_t bench_cycles_overhead(void)
+{
+  uint64_t best = (uint64_t) -1;
+  int i;
+
+  for (i = 0; i < 1000; i++)
+    {
+      uint64_t t0 = bench_cycles();
+      uint64_t t1 = bench_cycles();
+
+      if (t1 - t0 < best)
+	best = t1 - t0;
+    }
+  return best;
+}
+
+static const char *bench_impls[] = { "scalar", "ssse3", "avx2" };
+#define BENCH_NUM_IMPLS (sizeof (bench_impls) / sizeof (bench_impls[0]))
+
+/* The byte swap of ext_data_get_raw_data(), on blocks of raw data of
+ * a few sizes.
+ */
+static void bench_raw(int reps)
+{
+  static const size_t words[] = { 16, 256, 4096, 65536 };
+  size_t k, i;
+  int r;
+
+  printf ("%-8s %-8s %10s %10s %10s %10s\n",
+	  "raw", "words", "bytes/ev", "cyc/ev", "cyc/byte", "MB/s");
+
+  for (k = 0; k < sizeof (words) / sizeof (words[0]); k++)
+    {
+      size_t n = words[k];
+      size_t blocks = (1 << 20) / n; /* 4 MiB per repetition */
+      uint32_t *src = (uint32_t *) malloc (n * blocks * sizeof (uint32_t));
+      uint32_t *dest = (uint32_t *) malloc (n * sizeof (uint32_t));
+      uint64_t c = (uint64_t) -1;
+      double t = 1e30;
+
+      if (!src || !dest)
+	{
+	  perror("malloc");
+	  exit(1);
+	}
+
+      for (i = 0; i < n * blocks; i++)
+	src[i] = bench_rand();
+
+      for (r = 0; r < reps; r++)
+	{
+	  double t0 = bench_now(), t1;
+	  uint64_t c0 = bench_cycles(), c1;
+
+	  for (i = 0; i < blocks; i++)
+	    ext_data_ntohl_copy(dest, src + i * n, n);
+	  c1 = (bench_cycles() - c0) / blocks;
+	  t1 = (bench_now() - t0) / (double) blocks;
+	  if (c1 < c)
+	    c = c1;
+	  if (t1 < t)
+	    t = t1;
+	}
+
+      printf ("%-8s %-8zd %10zd %10.1f %10.3f %10.1f\n",
+	      "ntohl", n, n * sizeof (uint32_t), (double) c,
+	      (double) c / (double) (n * sizeof (uint32_t)),
+	      (double) (n * sizeof (uint32_t)) / t * 1e-6);
+
+      free(src);
+      free(dest);
+    }
+}
+
+static int bench_select_half(const char *name, void *arg)
+{
+  int *n = (int *) arg;
+
+  (void) name;
+  return (*n)++ % 2 == 0;
+}
+
+enum
+  {
+    BENCH_STAGE_RAW,
+    BENCH_STAGE_BITPACKED,
+    BENCH_STAGE_PACKED,
+    BENCH_STAGE_MAP,
+    BENCH_NUM_STAGES
+  };
+
+static const char *bench_stages[BENCH_NUM_STAGES] =
+  { "raw", "bitpack", "packed", "map" };
+
+/* Time the stages of ext_data_fetch_event() on the events of a file.
+ * With @half, every second item is selected, such that the events are
+ * unpacked to the server layout and then mapped.
+ */
+static int bench_file(const char *filename, int half, int reps,
+		      uint64_t overhead)
+{
+  struct ext_data_client *client;
+  struct ext_data_structure_info *struct_info;
+  struct ext_data_structure_item *item;
+  uint32_t map_success;
+  size_t dest_size = 0, unpack_size;
+  char *dest, *unpack;
+  int select_count = 0;
+  int r, k;
+
+  uint64_t best[BENCH_NUM_STAGES];
+  uint64_t events[BENCH_NUM_STAGES];
+  uint64_t bytes[BENCH_NUM_STAGES];
+
+  client = ext_data_from_file(filename);
+  struct_info = ext_data_struct_info_alloc();
+
+  if (!client || !struct_info)
+    {
+      perror(filename);
+      return 1;
+    }
+
+  if (half)
+    ext_data_struct_info_select(struct_info, bench_select_half,
+				&select_count);
+
+  if (ext_data_setup(client, NULL, 0, struct_info, &map_success, 0,
+		     "", NULL) != 0)
+    {
+      fprintf (stderr, "%s: %s\n", filename, ext_data_last_error(client));
+      return 1;
+    }
+
+  for (item = ext_data_struct_info_get_items(struct_info); item;
+       item = item->_next_off_item)
+    if (item->_offset + item->_length > dest_size)
+      dest_size = item->_offset + item->_length;
+
+  unpack = (char *) ext_data_unpack_array(client, 0, &unpack_size);
+  dest = (char *) malloc (dest_size ? dest_size : 1);
+
+  if (!dest)
+    {
+      perror("malloc");
+      return 1;
+    }
+
+  if (!unpack)
+    {
+      unpack = dest;
+      unpack_size = dest_size;
+    }
+
+  for (k = 0; k < BENCH_NUM_STAGES; k++)
+    best[k] = (uint64_t) -1;
+
+  for (r = 0; r < reps; r++)
+    {
+      uint64_t cycles[BENCH_NUM_STAGES] = { 0 };
+      uint32_t *src, *end_src;
+      int packed_len;
+      int ret;
+
+      memset(events, 0, sizeof (events));
+      memset(bytes, 0, sizeof (bytes));
+
+      if (ext_data_seek_event(client, 0) < 0)
+	{
+	  fprintf (stderr, "%s: %s\n", filename, ext_data_last_error(client));
+	  return 1;
+	}
+
+      while ((ret = ext_data_fetch_event_data(client, 0, &src, &end_src,
+					       &packed_len)) == 1)
+	{
+	  const void *raw;
+	  ssize_t raw_words;
+	  uint64_t c0, c1;
+	  int stage;
+
+	  c0 = bench_cycles();
+	  ext_data_get_raw_data(client, &raw, &raw_words);
+	  c1 = bench_cycles();
+	  if (raw_words)
+	    {
+	      cycles[BENCH_STAGE_RAW] += c1 - c0 - overhead;
+	      events[BENCH_STAGE_RAW]++;
+	      bytes[BENCH_STAGE_RAW] += (uint64_t) raw_words * sizeof (uint32_t);
+	    }
+
+	  c0 = bench_cycles();
+	  if (packed_len >= 0)
+	    {
+	      stage = BENCH_STAGE_BITPACKED;
+	      ret = ext_data_write_bitpacked_event(unpack, unpack_size,
+						   (uint8_t *) src,
+						   (uint8_t *) src + packed_len);
+	    }
+	  else
+	    {
+	      stage = BENCH_STAGE_PACKED;
+	      ret = ext_data_write_packed_event(client, unpack, 0,
+						src, end_src);
+	    }
+	  c1 = bench_cycles();
+	  if (ret)
+	    {
+	      fprintf (stderr, "%s: unpack failure (%d).\n", filename, ret);
+	      return 1;
+	    }
+	  cycles[stage] += c1 - c0 - overhead;
+	  events[stage]++;
+	  bytes[stage] += packed_len >= 0 ? (uint64_t) packed_len :
+	    (uint64_t) ((char *) end_src - (char *) src);
+
+	  if (unpack != dest)
+	    {
+	      c0 = bench_cycles();
+	      ext_data_map_event(client, dest, 0);
+	      c1 = bench_cycles();
+	      cycles[BENCH_STAGE_MAP] += c1 - c0 - overhead;
+	      events[BENCH_STAGE_MAP]++;
+	      bytes[BENCH_STAGE_MAP] += dest_size;
+	    }
+	}
+
+      if (ret < 0)
+	{
+	  fprintf (stderr, "%s: %s\n", filename, ext_data_last_error(client));
+	  return 1;
+	}
+
+      for (k = 0; k < BENCH_NUM_STAGES; k++)
+	if (cycles[k] < best[k])
+	  best[k] = cycles[k];
+    }
+
+  for (k = 0; k < BENCH_NUM_STAGES; k++)
+    {
+      if (!events[k])
+	continue;
+      printf ("%-8s %-8s %10" PRIu64 " %10.0f %10.1f %10.3f\n",
+	      half ? "half" : "all", bench_stages[k], events[k],
+	      (double) bytes[k] / (double) events[k],
+	      (double) best[k] / (double) events[k],
+	      bytes[k] ? (double) best[k] / (double) bytes[k] : 0.);
+    }
+
+  free(dest);
+  ext_data_close(client);
+  ext_data_struct_info_free(struct_info);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t events = argc > 1 ? (size_t) atol(argv[1]) : 1000;
+  int reps = argc > 2 ? atoi(argv[2]) : 20;
+  size_t size = BENCH_STRUCT_WORDS * sizeof (uint32_t);
+  size_t m, e, k;
+  int r, f;
+  uint64_t overhead = bench_cycles_overhead();
+
+  /* Worst case is 7 bytes per word. */
+  uint8_t *packed = (uint8_t *) malloc (events * 7 * BENCH_STRUCT_WORDS);
+  uint8_t **ev_start = (uint8_t **) malloc ((events + 1) * sizeof (uint8_t *));
+  char *ref = (char *) malloc (size);
+  char *dest = (char *) malloc (size);
+
+  if (!packed || !ev_start || !ref || !dest)
+    {
+      perror("malloc");
+      return 1;
+    }
+
+  printf ("%-8s %-8s %10s %10s %10s %10s %10s %8s\n",
+	  "mix", "impl", "bytes/ev", "ns/event", "cyc/ev", "cyc/byte",
+	  "MB/s", "speedup");
+
+  for (m = 0; m < sizeof (bench_mixes) / sizeof (bench_mixes[0]); m++)
+    {
+      const struct bench_mix *mix = &bench_mixes[m];
+      double t_scalar = 0;
+      uint8_t *p = packed;
+
+      for (e = 0; e < events; e++)
+	{
+	  ev_start[e] = p;
+	  p = bench_pack_event(p, mix);
+	}
+      ev_start[events] = p;
+
+      printf ("# %s: %s\n", mix->_name, mix->_descr);
+
+      for (k = 0; k < BENCH_NUM_IMPLS; k++)
+	{
+	  double t;
+	  uint64_t c;
+
+	  if (ext_data_select_bitpacked(bench_impls[k]) != 0)
+	    continue; /* not supported by this CPU */
+
+	  /* Verify: identical output, also for skipped words. */
+	  for (e = 0; e < events; e++)
+	    {
+	      int ret;
+
+	      ext_data_select_bitpacked("scalar");
+	      ext_data_rand_fill(ref, size);
+	      memcpy(dest, ref, size);
+	      ret = ext_data_write_bitpacked_event(ref, size,
+						   ev_start[e], ev_start[e+1]);
+	      ext_data_select_bitpacked(bench_impls[k]);
+	      if (ret != 0 ||
+		  ext_data_write_bitpacked_event(dest, size,
+						 ev_start[e], ev_start[e+1]) != 0 ||
+		  memcmp(ref, dest, size) != 0)
+		{
+		  fprintf (stderr, "%s: %s differs from scalar for event %zd.\n",
+			   mix->_name, bench_impls[k], e);
+		  return 1;
+		}
+	    }
+
+	  /* Best of the repetitions, the machine may be busy. */
+	  t = 1e30;
+	  c = (uint64_t) -1;
+	  for (r = 0; r < reps; r++)
+	    {
+	      double t0 = bench_now(), t1;
+	      uint64_t c0 = bench_cycles(), c1;
+
+	      for (e = 0; e < events; e++)
+		ext_data_write_bitpacked_event(dest, size,
+					       ev_start[e], ev_start[e+1]);
+	      c1 = bench_cycles() - c0;
+	      t1 = (bench_now() - t0) / (double) events;
+	      if (t1 < t)
+		t = t1;
+	      if (c1 < c)
+		c = c1;
+	    }
+
+	  if (k == 0)
+	    t_scalar = t;
+
+	  printf ("%-8s %-8s %10.0f %10.1f %10.1f %10.3f %10.1f %7.2fx\n",
+		  mix->_name, bench_impls[k],
+		  (double) (p - packed) / events,
+		  t * 1e9,
+		  (double) c / events,
+		  (double) c / (double) (p - packed),
+		  (double) (p - packed) / events / t * 1e-6,
+		  t_scalar / t);
+	}
+    }
+
+  free(packed);
+  free(ev_start);
+  free(ref);
+  free(dest);
+
+  bench_raw(reps);
+
+  if (argc > 3)
+    printf ("%-8s %-8s %10s %10s %10s %10s\n",
+	    "items", "stage", "events", "bytes/ev", "cyc/ev", "cyc/byte");
+
+  for (f = 3; f < argc; f++)
+    {
+      printf ("# %s\n", argv[f]);
+      if (bench_file(argv[f], 0, reps, overhead) ||
+	  bench_file(argv[f], 1, reps, overhead))
+	return 1;
+    }
+  return 0;
+}
@@ -34,6 +34,10 @@
 #include <sys/select.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include <stdio.h>
 
@@ -79,6 +83,12 @@ struct ext_data_structure_info
 
   struct ext_data_structure_info *_server_struct_info;
 
+  /* Restricts the items copied from the server, see
+   * ext_data_struct_info_select().
+   */
+  int       (*_select)(const char *name, void *arg);
+  void       *_select_arg;
+
   uint32_t    _map_success;
 
   const char *_last_error;
@@ -103,6 +113,9 @@ struct ext_data_client_struct
   uint32_t *_orig_pack_list;
   uint32_t *_orig_pack_list_end;
 
+  uint32_t *_orig_pack_prog; /* see ext_data_compile_pack_list() */
+  uint32_t *_orig_pack_prog_end;
+
   size_t    _dest_struct_size;
 
   uint32_t  _dest_max_pack_items;
@@ -113,9 +126,20 @@ struct ext_data_client_struct
 
   uint32_t *_dest_reverse_pack;
 
+  uint8_t  *_dest_present; /* per word, for bit-packed writing */
+
   uint32_t *_map_list;
   uint32_t *_map_list_end;
 
+  /* See ext_data_set_prefilter(). */
+  uint32_t  _prefix_size; /* in the unpack (orig or dest) layout */
+  int     (*_prefilter)(const void *event,void *arg);
+  void     *_prefilter_arg;
+
+  /* See ext_data_track_dirty(). */
+  uint64_t *_dirty;
+  size_t    _dirty_words;
+
   struct ext_data_structure_info *_struct_info_msg;
 };
 
@@ -136,6 +160,16 @@ struct ext_data_client
   size_t _buf_used;
   size_t _buf_filled;
 
+  /* If reading from a mapped file, _buf points into the mapping. */
+  void  *_file_map;
+  size_t _file_map_size;
+  struct timespec _file_map_mtime; /* to match the sidecar index */
+
+  /* If set, messages are read by a background thread, see
+   * ext_data_prefetch().  _buf is then unused.
+   */
+  struct ext_data_prefetch *_prefetch;
+
   uint32_t *_raw_ptr;  /* This is not allocated; just used. */
   uint32_t  _raw_words;
   uint32_t *_raw_swapped;
@@ -150,6 +184,24 @@ struct ext_data_client
   int _state;
 
   int _fetched_event;
+
+  int _pending_errno; /* failure held back by ext_data_fetch_events() */
+
+  /* Number of the next event (NTUPLE_FILL message).  For mapped
+   * files, _index has the offsets of the messages of events
+   * 0.._index_events-1, see ext_data_seek_event().
+   */
+  uint64_t  _event_no;
+  uint64_t *_index;
+  uint64_t  _index_events;
+  uint64_t  _index_alloc;
+  int       _index_complete; /* all events of the file are in _index */
+
+  /* Time blocked waiting for data, see ext_data_set_wait_clock(). */
+  uint64_t (*_wait_clock)(void);
+  uint64_t  _wait_time;
+
+  int _write_bitpacked; /* see ext_data_write_bitpacked() */
 };
 
 /* Layout of the structure information generated.
@@ -197,11 +249,38 @@ struct ext_data_structure_info *ext_data_struct_info_alloc()
 
   struct_info->_server_struct_info = NULL;
 
+  struct_info->_select = NULL;
+  struct_info->_select_arg = NULL;
+
   struct_info->_last_error = NULL;
 
   return struct_info;
 }
 
+int ext_data_struct_info_select(struct ext_data_structure_info *struct_info,
+				int (*select)(const char *name, void *arg),
+				void *arg)
+{
+  if (!struct_info)
+    {
+      errno = EFAULT;
+      return -1;
+    }
+
+  if (struct_info->_items)
+    {
+      struct_info->_last_error =
+	"Selection only applies to struct_info without items.";
+      errno = EINVAL;
+      return -1;
+    }
+
+  struct_info->_select = select;
+  struct_info->_select_arg = arg;
+
+  return 0;
+}
+
 
 struct ext_data_structure_item* ext_data_struct_info_get_items(struct ext_data_structure_info * info)
 {
@@ -431,6 +510,57 @@ struct ext_data_structure_item* ext_data_structure_item_copy(const struct ext_da
 }
 
 
+/* Add the server items picked by the @to->_select callback to @to,
+ * together with their controlling items, packed one after another.
+ * Returns the size of the resulting structure, or (size_t) -1.
+ */
+static size_t ext_data_structure_item_select(struct ext_data_structure_info *to,
+					     const struct ext_data_structure_info *from)
+{
+  const struct ext_data_structure_item *src;
+  const struct ext_data_structure_item *ctrl;
+  size_t offset = 0;
+
+  /* _map_success of the server items is free until matching. */
+
+  for (src = from->_items; src; src = src->_next_off_item)
+    ((struct ext_data_structure_item *) src)->_map_success =
+      (uint32_t) to->_select(src->_var_name, to->_select_arg);
+
+  for (src = from->_items; src; src = src->_next_off_item)
+    if (src->_map_success && *src->_var_ctrl_name)
+      for (ctrl = from->_items; ctrl; ctrl = ctrl->_next_off_item)
+	if (strcmp(ctrl->_var_name, src->_var_ctrl_name) == 0)
+	  ((struct ext_data_structure_item *) ctrl)->_map_success = 1;
+
+  /* Controlling items come before the arrays in the server list, so
+   * ext_data_struct_info_item() finds them.
+   */
+
+  for (src = from->_items; src; src = src->_next_off_item)
+    {
+      if (!src->_map_success)
+	continue;
+
+      if (ext_data_struct_info_item(to, offset, src->_length,
+				    src->_var_type, "", -1,
+				    src->_var_name, src->_var_ctrl_name,
+				    (int) src->_limit_max, src->_flags) != 0)
+	return (size_t) -1;
+
+      offset += src->_length;
+    }
+
+  if (!offset)
+    {
+      to->_last_error = "No items selected.";
+      errno = EINVAL;
+      return (size_t) -1;
+    }
+
+  return offset;
+}
+
 int ext_data_struct_info_item(struct ext_data_structure_info *struct_info,
 			      size_t offset, size_t size,
 			      int type,
@@ -948,6 +1078,9 @@ ext_data_struct_map_items(const struct ext_data_client_struct *clistr,
     }
 }
 
+static struct external_writer_buf_header *
+ext_data_prefetch_peek(struct ext_data_client *client);
+
 /* This function is intended for internal use.  It ensures an entire
  * message is ready in the receive buffer.  It does not consume the
  * message.
@@ -958,6 +1091,9 @@ ext_data_peek_message(struct ext_data_client *client)
 {
   struct external_writer_buf_header *header;
 
+  if (client->_prefetch)
+    return ext_data_prefetch_peek(client);
+
   for ( ; ; )
     {
       size_t avail = client->_buf_filled - client->_buf_used;
@@ -971,6 +1107,17 @@ ext_data_peek_message(struct ext_data_client *client)
 	    break; /* An entire message is available. */
 	}
 
+      if (client->_file_map)
+	{
+	  /* The entire file is mapped, there is nothing more to read. */
+	  if (client->_buf_used == client->_buf_filled)
+	    client->_last_error = "Out of data.";
+	  else
+	    client->_last_error = "Out of data while receiving message.";
+	  errno = EBADMSG;
+	  return NULL;
+	}
+
       if (client->_buf_filled == client->_buf_alloc)
 	{
 	  /* Buffer filled to the end. */
@@ -1003,10 +1150,14 @@ ext_data_peek_message(struct ext_data_client *client)
 	}
 
       size_t remain = client->_buf_alloc - client->_buf_filled;
+      uint64_t t0 = client->_wait_clock ? client->_wait_clock() : 0;
 
       ssize_t n =
 	read(client->_fd,client->_buf+client->_buf_filled,remain);
 
+      if (client->_wait_clock)
+	client->_wait_time += client->_wait_clock() - t0;
+
       if (n == 0)
 	{
 	  /* Out of data. */
@@ -1064,15 +1215,266 @@ ext_data_peek_message(struct ext_data_client *client)
   return header;
 }
 
+/* Background reading (prefetch).
+ *
+ * A thread reads messages from the file descriptor (using
+ * ext_data_peek_message() on a private reader context) and copies
+ * each complete message into a single-producer / single-consumer
+ * ring.  The consumer (the fetch routines) then gets message pointers
+ * into the ring.  Messages are never split across the end of the
+ * ring; a zero request word marks that the rest of the ring was
+ * skipped.
+ *
+ * _head and _tail are byte counters that only increase, the ring
+ * position is the counter modulo the ring size.  They are only
+ * written by the consumer and producer respectively.  The mutex and
+ * condition variable are only touched when one side has to sleep.
+ */
+
+#define EXT_DATA_PREFETCH_WAIT_DATA   0x01 /* consumer waits for data */
+#define EXT_DATA_PREFETCH_WAIT_SPACE  0x02 /* producer waits for space */
+
+struct ext_data_prefetch
+{
+  struct ext_data_client *_reader; /* owns the fd buffer */
+  pthread_t _thread;
+
+  char   *_ring;
+  size_t  _ring_size;
+
+  size_t  _head;     /* consumer */
+  size_t  _tail;     /* producer */
+  size_t  _release;  /* consumed, but not yet handed back (consumer) */
+
+  int     _waiting;
+  int     _done;     /* producer stopped, _errno and _last_error valid */
+  int     _errno;
+  const char *_last_error;
+
+  pthread_mutex_t _lock;
+  pthread_cond_t  _cond;
+};
+
+static void ext_data_prefetch_wake(struct ext_data_prefetch *pf, int who)
+{
+  if (__atomic_load_n(&pf->_waiting, __ATOMIC_SEQ_CST) & who)
+    {
+      pthread_mutex_lock(&pf->_lock);
+      pthread_cond_broadcast(&pf->_cond);
+      pthread_mutex_unlock(&pf->_lock);
+    }
+}
+
+static void ext_data_prefetch_unlock(void *lock)
+{
+  pthread_mutex_unlock((pthread_mutex_t *) lock);
+}
+
+static void *ext_data_prefetch_thread(void *arg)
+{
+  struct ext_data_prefetch *pf = (struct ext_data_prefetch *) arg;
+  struct ext_data_client *reader = pf->_reader;
+
+  for ( ; ; )
+    {
+      struct external_writer_buf_header *header;
+      uint32_t length, request;
+      size_t pos, skip, head;
+
+      header = ext_data_peek_message(reader);
+
+      if (header == NULL)
+	{
+	  pthread_mutex_lock(&pf->_lock);
+	  pf->_errno = errno;
+	  pf->_last_error = reader->_last_error;
+	  __atomic_store_n(&pf->_done, 1, __ATOMIC_SEQ_CST);
+	  pthread_cond_broadcast(&pf->_cond);
+	  pthread_mutex_unlock(&pf->_lock);
+	  return NULL;
+	}
+
+      length  = ntohl(header->_length);
+      request = ntohl(header->_request) & EXTERNAL_WRITER_REQUEST_LO_MASK;
+
+      /* Does the message fit before the end of the ring? */
+      pos = pf->_tail % pf->_ring_size;
+      skip = 0;
+      if (pf->_ring_size - pos < length)
+	skip = pf->_ring_size - pos;
+
+      /* Wait for the consumer to free enough space. */
+      head = __atomic_load_n(&pf->_head, __ATOMIC_SEQ_CST);
+
+      if (pf->_tail - head + skip + length > pf->_ring_size)
+	{
+	  pthread_mutex_lock(&pf->_lock);
+	  pthread_cleanup_push(ext_data_prefetch_unlock, &pf->_lock);
+	  __atomic_or_fetch(&pf->_waiting, EXT_DATA_PREFETCH_WAIT_SPACE,
+			    __ATOMIC_SEQ_CST);
+	  while (pf->_tail - __atomic_load_n(&pf->_head, __ATOMIC_SEQ_CST) +
+		 skip + length > pf->_ring_size)
+	    pthread_cond_wait(&pf->_cond, &pf->_lock);
+	  __atomic_and_fetch(&pf->_waiting, ~EXT_DATA_PREFETCH_WAIT_SPACE,
+			     __ATOMIC_SEQ_CST);
+	  pthread_cleanup_pop(1);
+	}
+
+      if (skip)
+	{
+	  /* Rest of ring unused, mark it. */
+	  *((uint32_t *) (pf->_ring + pos)) = 0;
+	  pos = 0;
+	}
+
+      memcpy(pf->_ring + pos, header, length);
+      reader->_buf_used += length;
+
+      __atomic_store_n(&pf->_tail, pf->_tail + skip + length,
+		       __ATOMIC_SEQ_CST);
+
+      ext_data_prefetch_wake(pf, EXT_DATA_PREFETCH_WAIT_DATA);
+
+      /* Nothing is read after the end of data.  The consumer does
+       * not consume these, so we are done.
+       */
+      if (request == EXTERNAL_WRITER_BUF_DONE ||
+	  request == EXTERNAL_WRITER_BUF_ABORT)
+	return NULL;
+    }
+}
+
+static struct external_writer_buf_header *
+ext_data_prefetch_peek(struct ext_data_client *client)
+{
+  struct ext_data_prefetch *pf = client->_prefetch;
+  struct external_writer_buf_header *header;
+  size_t pos;
+
+  if (pf->_release)
+    {
+      /* Now the previous message(s) may be overwritten. */
+      __atomic_store_n(&pf->_head, pf->_head + pf->_release,
+		       __ATOMIC_SEQ_CST);
+      pf->_release = 0;
+      ext_data_prefetch_wake(pf, EXT_DATA_PREFETCH_WAIT_SPACE);
+    }
+
+  if (__atomic_load_n(&pf->_tail, __ATOMIC_SEQ_CST) == pf->_head)
+    {
+      uint64_t t0 = client->_wait_clock ? client->_wait_clock() : 0;
+
+      pthread_mutex_lock(&pf->_lock);
+      __atomic_or_fetch(&pf->_waiting, EXT_DATA_PREFETCH_WAIT_DATA,
+			__ATOMIC_SEQ_CST);
+      while (__atomic_load_n(&pf->_tail, __ATOMIC_SEQ_CST) == pf->_head &&
+	     !__atomic_load_n(&pf->_done, __ATOMIC_SEQ_CST))
+	pthread_cond_wait(&pf->_cond, &pf->_lock);
+      __atomic_and_fetch(&pf->_waiting, ~EXT_DATA_PREFETCH_WAIT_DATA,
+			 __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock(&pf->_lock);
+
+      if (client->_wait_clock)
+	client->_wait_time += client->_wait_clock() - t0;
+
+      if (__atomic_load_n(&pf->_tail, __ATOMIC_SEQ_CST) == pf->_head)
+	{
+	  /* Producer is done, and all its messages are used. */
+	  client->_last_error = pf->_last_error;
+	  errno = pf->_errno;
+	  return NULL;
+	}
+    }
+
+  pos = pf->_head % pf->_ring_size;
+  header = (struct external_writer_buf_header *) (pf->_ring + pos);
+
+  if (header->_request == 0)
+    {
+      /* Skipped end of ring, the message is at the start. */
+      __atomic_store_n(&pf->_head, pf->_head + pf->_ring_size - pos,
+		       __ATOMIC_SEQ_CST);
+      header = (struct external_writer_buf_header *) pf->_ring;
+    }
+
+  return header;
+}
+
+/* Consume the event message last returned by ext_data_peek_message().
+ * With prefetch, the memory is only handed back to the reader thread
+ * at the next peek, as the message is unpacked after consuming it.
+ * For mapped files, new events are added to the index on the way.
+ */
+static void ext_data_consume_message(struct ext_data_client *client,
+				     uint32_t length)
+{
+  if (client->_file_map &&
+      client->_event_no == client->_index_events &&
+      !client->_index_complete)
+    {
+      if (client->_index_events == client->_index_alloc)
+	{
+	  uint64_t alloc = client->_index_alloc ?
+	    2 * client->_index_alloc : 0x10000;
+	  uint64_t *index = (uint64_t *)
+	    realloc (client->_index, alloc * sizeof (uint64_t));
+
+	  /* Without memory, we just do not index further. */
+	  if (index)
+	    {
+	      client->_index = index;
+	      client->_index_alloc = alloc;
+	    }
+	}
+      if (client->_index_events < client->_index_alloc)
+	client->_index[client->_index_events++] = client->_buf_used;
+    }
+
+  client->_event_no++;
+
+  if (client->_prefetch)
+    client->_prefetch->_release += length;
+  else
+    client->_buf_used += length;
+}
+
+static void ext_data_free(struct ext_data_client *client);
+
+static void ext_data_prefetch_stop(struct ext_data_client *client)
+{
+  struct ext_data_prefetch *pf = client->_prefetch;
+
+  if (!pf)
+    return;
+
+  /* The thread may sit in read() or wait for space, both are
+   * cancellation points.
+   */
+  pthread_cancel(pf->_thread);
+  pthread_join(pf->_thread, NULL);
+
+  pthread_mutex_destroy(&pf->_lock);
+  pthread_cond_destroy(&pf->_cond);
+
+  ext_data_free(pf->_reader);
+  free(pf->_ring);
+  free(pf);
+
+  client->_prefetch = NULL;
+}
+
 static void ext_data_clistr_free(struct ext_data_client_struct *clistr)
 {
   free((char *) clistr->_id);
 
   free(clistr->_orig_array);
   free(clistr->_orig_pack_list);
+  free(clistr->_orig_pack_prog);
   free(clistr->_dest_pack_list);
   free(clistr->_dest_reverse_pack);
+  free(clistr->_dest_present);
   free(clistr->_map_list);
+  free(clistr->_dirty);
 
   ext_data_struct_info_free(clistr->_struct_info_msg);
 }
@@ -1081,13 +1483,19 @@ static void ext_data_free(struct ext_data_client *client)
 {
   int i;
 
-  free(client->_buf);
+  ext_data_prefetch_stop(client);
+
+  if (client->_file_map)
+    munmap(client->_file_map, client->_file_map_size);
+  else
+    free(client->_buf);
 
   for (i = 0; i < client->_num_structures; i++)
     ext_data_clistr_free(client->_structures+i);
 
   free(client->_structures);
   free(client->_raw_swapped);
+  free(client->_index);
 
   free(client); /* Note! we also free the structure itself. */
 }
@@ -1106,6 +1514,8 @@ void ext_data_clear_client_struct(struct ext_data_client_struct *clistr)
 
   clistr->_orig_pack_list = NULL;
   clistr->_orig_pack_list_end = NULL;
+  clistr->_orig_pack_prog = NULL;
+  clistr->_orig_pack_prog_end = NULL;
 
   clistr->_dest_struct_size = 0;
   clistr->_dest_max_pack_items = 0;
@@ -1114,10 +1524,18 @@ void ext_data_clear_client_struct(struct ext_data_client_struct *clistr)
   clistr->_dest_pack_list = NULL;
   clistr->_dest_pack_list_end = NULL;
   clistr->_dest_reverse_pack = NULL;
+  clistr->_dest_present = NULL;
 
   clistr->_map_list = NULL;
   clistr->_map_list_end = NULL;
 
+  clistr->_prefix_size = 0;
+  clistr->_prefilter = NULL;
+  clistr->_prefilter_arg = NULL;
+
+  clistr->_dirty = NULL;
+  clistr->_dirty_words = 0;
+
   clistr->_struct_info_msg = NULL;
 }
 
@@ -1145,6 +1563,13 @@ struct ext_data_client *ext_data_create_client(size_t buf_alloc)
   client->_buf_used = 0;
   client->_buf_filled = 0;
 
+  client->_file_map = NULL;
+  client->_file_map_size = 0;
+  client->_file_map_mtime.tv_sec = 0;
+  client->_file_map_mtime.tv_nsec = 0;
+
+  client->_prefetch = NULL;
+
   client->_raw_ptr = NULL;
   client->_raw_words = 0;
   client->_raw_swapped = NULL;
@@ -1155,6 +1580,19 @@ struct ext_data_client *ext_data_create_client(size_t buf_alloc)
 
   client->_fetched_event = 0;
 
+  client->_pending_errno = 0;
+
+  client->_event_no = 0;
+  client->_index = NULL;
+  client->_index_events = 0;
+  client->_index_alloc = 0;
+  client->_index_complete = 0;
+
+  client->_wait_clock = NULL;
+  client->_wait_time = 0;
+
+  client->_write_bitpacked = 0;
+
   if (buf_alloc)
     {
       /* Get us a buffer for reading. */
@@ -1483,6 +1921,74 @@ struct ext_data_client *ext_data_from_fd(int fd)
   return client;
 }
 
+struct ext_data_client *ext_data_from_file(const char *filename)
+{
+  struct ext_data_client *client;
+  struct stat st;
+  void *map;
+  int fd;
+
+  for ( ; ; )
+    {
+      fd = open(filename, O_RDONLY);
+      if (fd != -1)
+	break;
+      if (errno == EINTR)
+	continue;
+      return NULL; // errno already set
+    }
+
+  if (fstat(fd, &st) == -1)
+    goto errno_close_return_NULL;
+
+  if (!S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+      errno = EINVAL;
+      goto errno_close_return_NULL;
+    }
+
+  map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (map == MAP_FAILED)
+    goto errno_close_return_NULL;
+
+  /* The mapping keeps the file alive, we need not keep it open. */
+  close(fd);
+
+  /* We walk through the file front to back, let the kernel know. */
+  madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+  if (!(client = ext_data_create_client(0)))
+    {
+      int errsv = errno;
+      munmap(map, (size_t) st.st_size);
+      errno = errsv;
+      return NULL;
+    }
+
+  client->_fd = -1;
+  client->_file_map = map;
+  client->_file_map_size = (size_t) st.st_size;
+  client->_file_map_mtime = st.st_mtim;
+
+  /* All data is already 'received'. */
+  client->_buf = (char *) map;
+  client->_buf_alloc = client->_file_map_size;
+  client->_buf_filled = client->_file_map_size;
+
+  client->_state = EXT_DATA_STATE_OPEN;
+
+  return client;
+
+ errno_close_return_NULL:
+  {
+    int errsv = errno;
+    close(fd);
+    errno = errsv;
+  }
+  return NULL;
+}
+
 struct ext_data_client *ext_data_open_out()
 {
   struct ext_data_client *client;
@@ -1496,6 +2002,26 @@ struct ext_data_client *ext_data_open_out()
   return client;
 }
 
+int ext_data_write_bitpacked(struct ext_data_client *client,int bitpacked)
+{
+  if (!client)
+    {
+      /* client->_last_error = "Client context NULL."; */
+      errno = EFAULT;
+      return -1;
+    }
+
+  if (client->_state != EXT_DATA_STATE_OPEN_OUT)
+    {
+      client->_last_error = "Bit-packing must be chosen before setup.";
+      errno = EINVAL;
+      return -1;
+    }
+
+  client->_write_bitpacked = bitpacked;
+  return 0;
+}
+
 int ext_data_nonblocking_fd(struct ext_data_client *client)
 {
   if (!client)
@@ -1512,6 +2038,13 @@ int ext_data_nonblocking_fd(struct ext_data_client *client)
       return -1;
     }
 
+  if (client->_prefetch)
+    {
+      client->_last_error = "Prefetch thread owns the file descriptor.";
+      errno = EBUSY;
+      return -1;
+    }
+
   if (fcntl(client->_fd,F_SETFL,
 	    fcntl(client->_fd,F_GETFL) | O_NONBLOCK) == -1)
     {
@@ -1523,36 +2056,294 @@ int ext_data_nonblocking_fd(struct ext_data_client *client)
   return client->_fd;
 }
 
-const char *ext_data_extr_str(uint32_t **p, uint32_t *length_left)
-{
-  uint32_t str_len, str_align_len;
-  const char *str;
-  if (*length_left < sizeof(uint32_t))
-    return NULL;
-  str_len = ntohl((*p)[0]);
-  (*p)++;
-  *length_left -= sizeof(uint32_t);
-  str_align_len = ((str_len+1) + 3) & ~3;
-  if (*length_left < str_align_len)
-    return NULL;
-  str = (const char *) (*p);
-  if (str[str_len] != 0)
-    return NULL;
-  *p = (uint32_t *) (((char *) (*p)) + str_align_len);
-  *length_left -= str_align_len;
-  return str;
-}
-
-/* Handle messages that come during setup phase. */
-static int ext_data_setup_messages(struct ext_data_client *client)
+int ext_data_prefetch(struct ext_data_client *client, size_t ring_size)
 {
-  struct ext_data_client_struct *clistr = NULL;
+  struct ext_data_prefetch *pf;
+  struct ext_data_client *reader;
+  sigset_t all, old;
+  int ret;
 
-  for ( ; ; )
+  if (!client)
     {
-      struct external_writer_buf_header *header;
-
-      header = ext_data_peek_message(client);
+      /* client->_last_error = "Client context NULL."; */
+      errno = EFAULT;
+      return -1;
+    }
+
+  if (client->_state != EXT_DATA_STATE_SETUP_READ)
+    {
+      client->_last_error = "Client context has not had setup (for reading).";
+      errno = EFAULT;
+      return -1;
+    }
+
+  if (client->_prefetch)
+    {
+      client->_last_error = "Prefetch already running.";
+      errno = EBUSY;
+      return -1;
+    }
+
+  if (client->_file_map)
+    {
+      client->_last_error = "No prefetch for mapped files (not needed).";
+      errno = EINVAL;
+      return -1;
+    }
+
+  /* Since the end of the ring may be skipped, it must be able to
+   * hold two messages of maximum size.
+   */
+  if (ring_size < 2 * client->_buf_alloc)
+    ring_size = 2 * client->_buf_alloc;
+  ring_size = (ring_size + 0xfff) & ~(size_t) 0xfff;
+
+  pf = (struct ext_data_prefetch *) malloc (sizeof (struct ext_data_prefetch));
+
+  if (!pf)
+    goto enomem_return;
+
+  memset(pf, 0, sizeof (struct ext_data_prefetch));
+
+  pf->_ring = (char *) malloc (ring_size);
+  pf->_ring_size = ring_size;
+
+  if (!pf->_ring ||
+      !(pf->_reader = reader = ext_data_create_client(0)))
+    {
+      free(pf->_ring);
+      free(pf);
+      goto enomem_return;
+    }
+
+  /* The reader takes over the receive buffer, with whatever data it
+   * already holds.
+   */
+  reader->_fd         = client->_fd;
+  reader->_buf        = client->_buf;
+  reader->_buf_alloc  = client->_buf_alloc;
+  reader->_buf_used   = client->_buf_used;
+  reader->_buf_filled = client->_buf_filled;
+  reader->_state      = client->_state;
+
+  pthread_mutex_init(&pf->_lock, NULL);
+  pthread_cond_init(&pf->_cond, NULL);
+
+  /* Signals are for the main thread. */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  ret = pthread_create(&pf->_thread, NULL, ext_data_prefetch_thread, pf);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (ret)
+    {
+      reader->_buf = NULL; /* still ours */
+      ext_data_free(reader);
+      pthread_mutex_destroy(&pf->_lock);
+      pthread_cond_destroy(&pf->_cond);
+      free(pf->_ring);
+      free(pf);
+      client->_last_error = "Failure starting prefetch thread.";
+      errno = ret;
+      return -1;
+    }
+
+  client->_buf = NULL;
+  client->_buf_alloc = 0;
+  client->_buf_used = 0;
+  client->_buf_filled = 0;
+
+  client->_prefetch = pf;
+
+  return 0;
+
+ enomem_return:
+  client->_last_error = "Memory allocation failure (prefetch).";
+  errno = ENOMEM;
+  return -1;
+}
+
+const char *ext_data_extr_str(uint32_t **p, uint32_t *length_left)
+{
+  uint32_t str_len, str_align_len;
+  const char *str;
+  if (*length_left < sizeof(uint32_t))
+    return NULL;
+  str_len = ntohl((*p)[0]);
+  (*p)++;
+  *length_left -= sizeof(uint32_t);
+  str_align_len = ((str_len+1) + 3) & ~3;
+  if (*length_left < str_align_len)
+    return NULL;
+  str = (const char *) (*p);
+  if (str[str_len] != 0)
+    return NULL;
+  *p = (uint32_t *) (((char *) (*p)) + str_align_len);
+  *length_left -= str_align_len;
+  return str;
+}
+
+/* Counterpart of ext_data_extr_str(), for the writer. */
+
+static uint32_t *ext_data_insert_str(uint32_t *p, const char *str)
+{
+  uint32_t str_len = (uint32_t) strlen(str);
+  uint32_t str_align_len = ((str_len+1) + 3) & ~3;
+
+  *(p++) = htonl(str_len);
+  memset(p, 0, str_align_len);
+  memcpy(p, str, str_len);
+  return (uint32_t *) (((char *) p) + str_align_len);
+}
+
+/* The pack list is compiled into a program, such that the per-event
+ * unpacking of non-packed events does not have to look at each item.
+ * Items with consecutive destination offsets are merged into runs,
+ * which are byte-swap-copied in bulk.  Loops get the control item
+ * offset and limits, followed either by the runs of the loop body
+ * (which are cut when the loop count is reached), or, when item k of
+ * each loop iteration j is at base_k + 4*j (as for zero-suppressed
+ * arrays with several members), just the base offsets.
+ *
+ * EXT_DATA_PACK_PROG_RUN      n, offset
+ * EXT_DATA_PACK_PROG_LOOP     offset, max_loops, loop_size, nruns,
+ *                             nruns * (n, offset)
+ * EXT_DATA_PACK_PROG_STRIDED  offset, max_loops, loop_size,
+ *                             loop_size * base_offset
+ */
+
+#define EXT_DATA_PACK_PROG_RUN      1
+#define EXT_DATA_PACK_PROG_LOOP     2
+#define EXT_DATA_PACK_PROG_STRIDED  3
+
+/* Merge items with consecutive destination offsets into runs.  With
+ * op given, each run is prefixed by it (static items).
+ */
+
+static uint32_t *ext_data_pack_prog_runs(uint32_t *d,
+					 uint32_t *o,uint32_t *oend,
+					 uint32_t op,uint32_t *nruns)
+{
+  uint32_t *run = NULL;
+
+  *nruns = 0;
+
+  for ( ; o < oend; o += 2)
+    {
+      uint32_t offset = o[1];
+
+      if (run &&
+	  offset == run[1] + run[0] * (uint32_t) sizeof(uint32_t))
+	run[0]++;
+      else
+	{
+	  if (op)
+	    *(d++) = op;
+	  run = d;
+	  *(d++) = 1;
+	  *(d++) = offset;
+	  (*nruns)++;
+	}
+    }
+  return d;
+}
+
+static int ext_data_compile_pack_list(struct ext_data_client_struct *clistr)
+{
+  uint32_t *o    = clistr->_orig_pack_list;
+  uint32_t *oend = clistr->_orig_pack_list_end;
+  uint32_t *d;
+  size_t words;
+
+  /* A static item becomes at most a run of three words, loop items
+   * a run of two.  Loop headers grow by one word.
+   */
+  words = (size_t) (oend - o) * 3 / 2 + 2;
+
+  free(clistr->_orig_pack_prog);
+  clistr->_orig_pack_prog =
+    (uint32_t *) malloc (words * sizeof(uint32_t));
+
+  if (!clistr->_orig_pack_prog)
+    return -1;
+
+  d = clistr->_orig_pack_prog;
+
+  while (o < oend)
+    {
+      uint32_t *static_end = o;
+      uint32_t nruns;
+
+      /* Static items up to the next loop. */
+      while (static_end < oend &&
+	     !(static_end[0] & EXTERNAL_WRITER_MARK_LOOP))
+	static_end += 2;
+
+      d = ext_data_pack_prog_runs(d, o, static_end,
+				  EXT_DATA_PACK_PROG_RUN, &nruns);
+      o = static_end;
+
+      if (o < oend)
+	{
+	  uint32_t offset    = o[1];
+	  uint32_t max_loops = o[2];
+	  uint32_t loop_size = o[3];
+	  uint32_t items = max_loops * loop_size;
+	  uint32_t *items_start = o + 4;
+	  uint32_t j, k;
+	  /* The stride is taken from the first iteration, so there
+	   * must be one.  Else use the generic loop.
+	   */
+	  int strided = (loop_size > 1 && max_loops > 0);
+
+	  for (j = 0; strided && j < max_loops; j++)
+	    for (k = 0; k < loop_size; k++)
+	      if (items_start[2 * (j * loop_size + k) + 1] !=
+		  items_start[2 * k + 1] + j * (uint32_t) sizeof(uint32_t))
+		{
+		  strided = 0;
+		  break;
+		}
+
+	  *(d++) = strided ?
+	    EXT_DATA_PACK_PROG_STRIDED : EXT_DATA_PACK_PROG_LOOP;
+	  *(d++) = offset;
+	  *(d++) = max_loops;
+	  *(d++) = loop_size;
+
+	  if (strided)
+	    {
+	      for (k = 0; k < loop_size; k++)
+		*(d++) = items_start[2 * k + 1];
+	    }
+	  else
+	    {
+	      uint32_t *nruns_p = d++;
+
+	      d = ext_data_pack_prog_runs(d, items_start,
+					  items_start + 2 * items, 0, &nruns);
+	      *nruns_p = nruns;
+	    }
+
+	  o = items_start + 2 * items;
+	}
+    }
+
+  clistr->_orig_pack_prog_end = d;
+
+  return 0;
+}
+
+/* Handle messages that come during setup phase. */
+static int ext_data_setup_messages(struct ext_data_client *client)
+{
+  struct ext_data_client_struct *clistr = NULL;
+
+  for ( ; ; )
+    {
+      struct external_writer_buf_header *header;
+
+      header = ext_data_peek_message(client);
 
       if (header == NULL)
 	return -1;
@@ -1730,6 +2521,14 @@ static int ext_data_setup_messages(struct ext_data_client *client)
 	    errno = EPROTO;
 	    return -1;
 	  }
+
+	if (ext_data_compile_pack_list(clistr) != 0)
+	  {
+	    client->_last_error =
+	      "Memory allocation failure (pack program).";
+	    errno = ENOMEM;
+	    return -1;
+	  }
 	
 	/*
   	fprintf (stderr,
@@ -1986,6 +2785,18 @@ static int ext_data_setup_messages(struct ext_data_client *client)
 		return -1;
 	      }
 
+	    /* With a mapped file, all messages are in the mapping
+	     * already, no receive buffer to resize.
+	     */
+	    if (client->_file_map)
+	      break;
+
+	    /* Never shrink: the buffer may already hold more than
+	     * newsize of data (read ahead from a pipe).
+	     */
+	    if (newsize <= client->_buf_alloc)
+	      break;
+
 	    char *newbuf = (char *) realloc (client->_buf,newsize);
 
 	    if (!newbuf)
@@ -2048,6 +2859,127 @@ static int ext_data_setup_messages(struct ext_data_client *client)
   return 0;
 }
 
+/* Produce the pack list from the items of the structure, for writing
+ * with only struct_info (no struct_layout_info).  The order is the
+ * one of the items: plain items word by word, and for each
+ * controlling item a loop with all its (array) items, as the
+ * struct_writer does.  Float items are cleared with NaN, the others
+ * with zero.
+ */
+
+static int ext_data_struct_info_pack_list(struct ext_data_client *client,
+					  struct ext_data_client_struct *clistr,
+					  const struct ext_data_structure_info *
+					  struct_info,
+					  size_t size_buf)
+{
+  struct ext_data_structure_item *item, *child;
+  uint32_t *o;
+  size_t n = 0;
+  int pass;
+
+  for (pass = 0; pass < 2; pass++)
+    {
+      o = clistr->_dest_pack_list;
+
+      for (item = struct_info->_items; item; item = item->_next_off_item)
+	{
+	  uint32_t max_loops, loop_size = 0;
+	  uint32_t mark = EXTERNAL_WRITER_MARK_CLEAR_ZERO;
+	  uint32_t i;
+
+	  if (item->_ctrl_item)
+	    continue;
+
+	  if (item->_offset + item->_length > size_buf)
+	    {
+	      client->_last_error =
+		"Structure item outside buffer.";
+	      errno = EINVAL;
+	      return -1;
+	    }
+
+	  for (child = struct_info->_items; child;
+	       child = child->_next_off_item)
+	    if (child->_ctrl_item == item)
+	      loop_size++;
+
+	  if ((item->_var_type & EXT_DATA_ITEM_TYPE_MASK) ==
+	      EXT_DATA_ITEM_TYPE_FLOAT32)
+	    mark = EXTERNAL_WRITER_MARK_CLEAR_NAN;
+
+	  if (!loop_size)
+	    {
+	      for (i = 0; i < item->_length / sizeof (uint32_t); i++)
+		{
+		  if (pass)
+		    {
+		      *(o++) = mark;
+		      *(o++) = item->_offset + i * (uint32_t) sizeof (uint32_t);
+		    }
+		  else
+		    n += 2;
+		}
+	      continue;
+	    }
+
+	  max_loops = item->_limit_max;
+
+	  if (!pass)
+	    {
+	      n += 4 + 2 * (size_t) max_loops * loop_size;
+	      continue;
+	    }
+
+	  *(o++) = EXTERNAL_WRITER_MARK_CLEAR_ZERO | EXTERNAL_WRITER_MARK_LOOP;
+	  *(o++) = item->_offset;
+	  *(o++) = max_loops;
+	  *(o++) = loop_size;
+
+	  for (i = 0; i < max_loops; i++)
+	    for (child = struct_info->_items; child;
+		 child = child->_next_off_item)
+	      if (child->_ctrl_item == item)
+		{
+		  *(o++) =
+		    (child->_var_type & EXT_DATA_ITEM_TYPE_MASK) ==
+		    EXT_DATA_ITEM_TYPE_FLOAT32 ?
+		    EXTERNAL_WRITER_MARK_CLEAR_NAN :
+		    EXTERNAL_WRITER_MARK_CLEAR_ZERO;
+		  *(o++) = child->_offset + i * (uint32_t) sizeof (uint32_t);
+		}
+	}
+
+      if (!pass)
+	{
+	  clistr->_dest_pack_list =
+	    (uint32_t *) malloc ((n ? n : 1) * sizeof(uint32_t));
+
+	  if (!clistr->_dest_pack_list)
+	    {
+	      client->_last_error =
+		"Memory allocation failure (dest pack list).";
+	      errno = ENOMEM;
+	      return -1;
+	    }
+
+	  clistr->_dest_pack_list_end = clistr->_dest_pack_list + n;
+	}
+    }
+
+  return 0;
+}
+
+/* Worst case size of an event in ext_data_write_event().  Bit-packed,
+ * a word takes at most 10 bytes (skip and value), and the last word of
+ * the structure is always sent.
+ */
+
+#define EXT_DATA_WRITE_MAX_EVENT(client, clistr)			\
+  ((client)->_write_bitpacked ?						\
+   ((size_t) (clistr)->_dest_max_pack_items + 1) * 10 + sizeof(uint32_t) : \
+   (size_t) (clistr)->_dest_max_pack_items * sizeof(uint32_t))
+
 int ext_data_setup(struct ext_data_client *client,
 		   const void *struct_layout_info,size_t size_info,
 		   struct ext_data_structure_info *struct_info,
@@ -2276,7 +3208,18 @@ int ext_data_setup(struct ext_data_client *client,
 
       memcpy(clistr->_dest_pack_list,slo_pack_list,
 	     slo->_pack_list_items * sizeof(uint32_t));
+    }
+  else if (client->_state == EXT_DATA_STATE_OPEN_OUT)
+    {
+      /* Writing with only the items given, make the pack list. */
+
+      if (ext_data_struct_info_pack_list(client, clistr,
+					 struct_info, size_buf))
+	return -1;
+    }
 
+  if (clistr->_dest_pack_list)
+    {
       /* Make the reverse list, to be able to quickly (directly) look any
        * controlling items up.  (Needed for clearing).  Also calculate the
        * worst case message size.
@@ -2339,29 +3282,52 @@ int ext_data_setup(struct ext_data_client *client,
       struct external_writer_buf_header *header;
       uint32_t *p;
 
-      /* Without a pack list (i.e. without slo (struct_layout_info)),
-       * we cannot write data, as the pack order is not known.
-       */
-
-      if (!slo)
-	{
-	  client->_last_error = "Cannot write without structure layout info.";
-	  errno = EFAULT;
-	  return -1;
-	}
+      struct ext_data_structure_item *item;
+      size_t setup_size = 0;
 
       /* We need to allocate the write buffer.
        *
        * The size is limited by the pack list.  Plus the message header.
        */
 
-      size_t bufsize = clistr->_dest_max_pack_items * sizeof(uint32_t) +
+      size_t bufsize = EXT_DATA_WRITE_MAX_EVENT(client, clistr) +
 	sizeof(struct external_writer_buf_header) + 2 * sizeof(uint32_t);
 
+      if (client->_write_bitpacked)
+	{
+	  clistr->_dest_present =
+	    (uint8_t *) calloc (size_buf / sizeof(uint32_t) + 1, 1);
+
+	  if (!clistr->_dest_present)
+	    {
+	      client->_last_error = "Memory allocation failure (present).";
+	      errno = ENOMEM;
+	      return -1;
+	    }
+	}
+
       /* The other messages we send first are fixed length, and
-       * contained within the 4kB buffer size.
+       * contained within the 4kB buffer size.  Except when the items
+       * and pack list are described (with struct_info), such that
+       * the reader needs no layout of its own.
        */
 
+      if (struct_info)
+	{
+	  setup_size = (size_t) (clistr->_dest_pack_list_end -
+				 clistr->_dest_pack_list) * sizeof(uint32_t);
+
+	  for (item = struct_info->_items; item; item = item->_next_off_item)
+	    setup_size += sizeof(struct external_writer_buf_header) +
+	      9 * sizeof(uint32_t) +
+	      ((strlen(item->_var_name) + 4) & ~(size_t) 3) +
+	      ((strlen(item->_var_ctrl_name) + 4) & ~(size_t) 3) + 4;
+	}
+
+      if (bufsize < setup_size)
+	bufsize = setup_size;
+
+      bufsize += 0x1000;
       bufsize = (bufsize + 0x1000-(uint32_t) 1) & ~(0x1000-(uint32_t) 1);
 
       client->_buf = (char *) malloc (bufsize);
@@ -2421,14 +3387,45 @@ int ext_data_setup(struct ext_data_client *client,
       *(p++) = htonl((uint32_t) clistr->_dest_struct_size);
       header->_length = htonl((uint32_t) (((char *) p) - ((char *) header)));
 
+      // EXTERNAL_WRITER_BUF_CREATE_BRANCH
+
+      for (item = struct_info ? struct_info->_items : NULL; item;
+	   item = item->_next_off_item)
+	{
+	  uint32_t array_len = item->_length / (uint32_t) sizeof(uint32_t);
+
+	  header = (struct external_writer_buf_header *) p;
+
+	  header->_request = htonl(EXTERNAL_WRITER_BUF_CREATE_BRANCH |
+				   EXTERNAL_WRITER_REQUEST_HI_MAGIC);
+	  p = (uint32_t *) (header+1);
+	  *(p++) = htonl(item->_offset);
+	  *(p++) = htonl(item->_length);
+	  *(p++) = htonl(array_len > 1 ? array_len : 0);
+	  *(p++) = htonl(item->_var_type);
+	  *(p++) = htonl(item->_limit_min);
+	  *(p++) = htonl(item->_limit_max);
+	  p = ext_data_insert_str(p, "");
+	  p = ext_data_insert_str(p, item->_var_name);
+	  p = ext_data_insert_str(p, item->_var_ctrl_name);
+	  header->_length =
+	    htonl((uint32_t) (((char *) p) - ((char *) header)));
+	}
+
       // EXTERNAL_WRITER_BUF_RESIZE      /* tell size? */
 
+      /* Readers start with EXTERNAL_WRITER_MIN_SHARED_SIZE, and some
+       * resize to exactly what we tell, also below the data they
+       * hold already.
+       */
+
       header = (struct external_writer_buf_header *) p;
 
       header->_request = htonl(EXTERNAL_WRITER_BUF_RESIZE |
 			       EXTERNAL_WRITER_REQUEST_HI_MAGIC);
       p = (uint32_t *) (header+1);
-      *(p++) = htonl((uint32_t) bufsize);
+      *(p++) = htonl((uint32_t) (bufsize > EXTERNAL_WRITER_MIN_SHARED_SIZE ?
+				 bufsize : EXTERNAL_WRITER_MIN_SHARED_SIZE));
       *(p++) = htonl(EXTERNAL_WRITER_MAGIC);
       header->_length = htonl((uint32_t) (((char *) p) - ((char *) header)));
 
@@ -2439,7 +3436,19 @@ int ext_data_setup(struct ext_data_client *client,
       header->_request = htonl(EXTERNAL_WRITER_BUF_ARRAY_OFFSETS |
 			       EXTERNAL_WRITER_REQUEST_HI_MAGIC);
       p = (uint32_t *) (header+1);
-      *(p++) = htonl(slo->_items[0]._xor);
+      if (slo)
+	*(p++) = htonl(slo->_items[0]._xor);
+      else
+	{
+	  /* No xor known, but the pack list follows, so the reader
+	   * can unpack by the items.
+	   */
+	  uint32_t *o;
+
+	  *(p++) = htonl(0);
+	  for (o = clistr->_dest_pack_list; o < clistr->_dest_pack_list_end; o++)
+	    *(p++) = htonl(*o);
+	}
       header->_length = htonl((uint32_t) (((char *) p) - ((char *) header)));
 
       // EXTERNAL_WRITER_BUF_SETUP_DONE_WR
@@ -2510,7 +3519,20 @@ int ext_data_setup(struct ext_data_client *client,
       /* Create mapping between the two structures. */
 
       struct_info->_server_struct_info = clistr->_struct_info_msg;
-      if (!struct_info->_items)
+      if (!struct_info->_items && struct_info->_select)
+      {
+	size_t size_sel =
+	  ext_data_structure_item_select(struct_info,
+					 clistr->_struct_info_msg);
+
+	if (size_sel == (size_t) -1)
+	  {
+	    client->_last_error = struct_info->_last_error;
+	    return -1;
+	  }
+	clistr->_dest_struct_size = size_sel;
+      }
+      else if (!struct_info->_items)
       {
 	struct_info->_items = ext_data_structure_item_copy(clistr->_struct_info_msg->_items);
         clistr->_dest_struct_size = clistr->_orig_struct_size;
@@ -2555,78 +3577,378 @@ int ext_data_setup(struct ext_data_client *client,
   return 0;
 }
 
-/* This function is for internal use.  It is shared with the
- * struct_writer.  Returns 0 on success.
+/* Note the block of the destination word at @offset as changed, see
+ * ext_data_track_dirty().
  */
 
-int ext_data_write_bitpacked_event(char *dest,size_t dest_size,
-				   uint8_t *src,uint8_t *end_src)
+static inline __attribute__((always_inline)) void
+ext_data_mark_dirty(uint64_t *dirty,uint32_t offset,int changed)
 {
-  uint32_t offset = 0;
+  uint32_t block = offset >> EXT_DATA_DIRTY_BLOCK_SHIFT;
 
-  for ( ; src < end_src; )
-    {
-      int shift_offset = 2;
-      uint8_t v;
-      uint32_t value = 0; // to make compiler happy
+  dirty[block / 64] |= ((uint64_t) changed) << (block % 64);
+}
 
-      v = *(src++);
+static void
+ext_data_mark_all_dirty(const struct ext_data_client_struct *clistr)
+{
+  if (clistr->_dirty)
+    memset(clistr->_dirty, 0xff, clistr->_dirty_words * sizeof (uint64_t));
+}
 
-      while (v & 0x80)
-	{
-	  offset += ((uint32_t) (v & 0x7f)) << shift_offset;
-	  shift_offset += 7;
-	  if (src >= end_src) // unlikely
-	    return -1;
-	  v = *(src++);
-	}
+/* Decode one value of the bit-packed format, and store it.  This is
+ * the (scalar) core of ext_data_write_bitpacked_event(), shared by
+ * all implementations.  Words that change are marked in @dirty,
+ * unless it is NULL.  Returns 0 on success.
+ */
 
-      switch (v >> 5)
-	{
-	case 0:
-	  value = (uint32_t) (v & 0x1f);
-	  //fprintf(stderr,"WBP:0: @ 0x%08x : 0x%08x\n", offset, v & 0x1f);
-	  break;
-	case 1:
-	{
-	  uint32_t high = ((uint32_t) (v & 0x1f)) << 8;
-	  if (src >= end_src) // unlikely
-	    return -2;
-	  value = high | *(src++);
-	  //fprintf(stderr,"WBP:1: @ 0x%08x : 0x%08x\n", offset, value);
-	  break;
-	}
-	case 2:
-	{
-	  offset += ((uint32_t) (v & 0x1f)) << shift_offset;
-	  if (src+3 >= end_src) // unlikely
-	    return -3;
-	  value = ((uint32_t) *(src++)) << 24;
-	  value |= (uint32_t) (*(src++) << 16);
-	  value |= (uint32_t) (*(src++) << 8 );
-	  value |=             *(src++);
-	  //fprintf(stderr,"WBP:2: @ 0x%08x : 0x%08x\n", offset, value);
-	  break;
-	}
-	case 3:
-	  offset += ((uint32_t) (v & 0x0f)) << shift_offset;
-	  // Next is a trick, if *(src++) & 0x10,
-	  // the value will be shifted out -> 0 remains
-	  value = (uint32_t) 0x7fc00000 << (v & 0x10);
-	  //fprintf(stderr,"WBP:3: @ 0x%08x : 0x%08x\n",
-	  //	  offset, (uint32_t) 0x7fc00000 << (v & 0x10));
-	  break;
+static inline __attribute__((always_inline)) int
+ext_data_bitpacked_step(char *dest,size_t dest_size,
+			uint8_t **src_p,uint8_t *end_src,
+			uint32_t *offset_p,uint64_t *dirty)
+{
+  uint8_t *src = *src_p;
+  uint32_t offset = *offset_p;
+  int shift_offset = 2;
+  uint8_t v;
+  uint32_t value = 0; // to make compiler happy
+
+  v = *(src++);
+
+  while (v & 0x80)
+    {
+      offset += ((uint32_t) (v & 0x7f)) << shift_offset;
+      shift_offset += 7;
+      if (src >= end_src) // unlikely
+	return -1;
+      v = *(src++);
+    }
+
+  switch (v >> 5)
+    {
+    case 0:
+      value = (uint32_t) (v & 0x1f);
+      //fprintf(stderr,"WBP:0: @ 0x%08x : 0x%08x\n", offset, v & 0x1f);
+      break;
+    case 1:
+    {
+      uint32_t high = ((uint32_t) (v & 0x1f)) << 8;
+      if (src >= end_src) // unlikely
+	return -2;
+      value = high | *(src++);
+      //fprintf(stderr,"WBP:1: @ 0x%08x : 0x%08x\n", offset, value);
+      break;
+    }
+    case 2:
+    {
+      offset += ((uint32_t) (v & 0x1f)) << shift_offset;
+      if (src+3 >= end_src) // unlikely
+	return -3;
+      value = ((uint32_t) *(src++)) << 24;
+      value |= (uint32_t) (*(src++) << 16);
+      value |= (uint32_t) (*(src++) << 8 );
+      value |=             *(src++);
+      //fprintf(stderr,"WBP:2: @ 0x%08x : 0x%08x\n", offset, value);
+      break;
+    }
+    case 3:
+      offset += ((uint32_t) (v & 0x0f)) << shift_offset;
+      // Next is a trick, if *(src++) & 0x10,
+      // the value will be shifted out -> 0 remains
+      value = (uint32_t) 0x7fc00000 << (v & 0x10);
+      //fprintf(stderr,"WBP:3: @ 0x%08x : 0x%08x\n",
+      //	  offset, (uint32_t) 0x7fc00000 << (v & 0x10));
+      break;
+    }
+
+  if (offset + sizeof(uint32_t) > dest_size) // unlikely
+    return -4;
+  // By design, we are always aligned...
+  // if (offset & 3) // unlikely
+  //   return -5;
+
+  /* No branch on the comparison, values change at random. */
+  if (dirty)
+    ext_data_mark_dirty(dirty, offset,
+			*((uint32_t *) (dest + offset)) != value);
+  *((uint32_t *) (dest + offset)) = value;
+
+  offset += (uint32_t) sizeof(uint32_t);
+
+  *src_p = src;
+  *offset_p = offset;
+  return 0;
+}
+
+static int ext_data_write_bitpacked_event_scalar(char *dest,size_t dest_size,
+						 uint8_t *src,uint8_t *end_src,
+						 uint32_t offset,uint64_t *dirty)
+{
+
+  for ( ; src < end_src; )
+    {
+      int ret = ext_data_bitpacked_step(dest, dest_size,
+					&src, end_src, &offset, dirty);
+      if (ret) // unlikely
+	return ret;
+    }
+
+  if (offset != dest_size) // unlikely
+    return -6;
+
+  return 0;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* Vectorised versions.
+ *
+ * Dense events are dominated by values without offset skips that
+ * are either small (one byte, 0x00-0x1f, case 0 above) or below 13
+ * bits (two bytes, leading byte 0x20-0x3f, case 1).  We look at 8
+ * source bytes at a time.  Which of them are case 1 leaders gives
+ * (through a 256 entry table) where the values start, assuming that
+ * all are of case 0 or 1, and a byte shuffle that moves each into a
+ * 16-bit lane.  The values up to the first leader that is something
+ * else are then written at once, the rest goes through the scalar
+ * step.  The values written, and where, are exactly those of the
+ * scalar code; destination words past the decoded values are
+ * written back unchanged.
+ */
+
+#include <immintrin.h>
+
+/* Sparse events are mostly single values between offset skips,
+ * which the windows cannot speed up: then the window setup is pure
+ * overhead.  Events (or the rest after a prefix) shorter than
+ * EXT_DATA_BITPACKED_SCALAR_BYTES, or with less than one source byte
+ * per EXT_DATA_BITPACKED_SPARSE_WORDS destination words, go to the
+ * scalar decoder directly.  The choice is per event: checking each
+ * window for it costs more than it saves on dense events.
+ */
+#define EXT_DATA_BITPACKED_SCALAR_BYTES  64
+#define EXT_DATA_BITPACKED_SPARSE_WORDS  2
+
+typedef struct ext_data_bitpacked_window_t
+{
+  int8_t  _shuffle[16]; /* source byte for each byte of 8 16-bit lanes */
+  uint8_t _leaders;     /* bit mask of value start bytes */
+  uint8_t _end;         /* bytes used by all values */
+} ext_data_bitpacked_window;
+
+static ext_data_bitpacked_window _ext_data_bitpacked_windows[256];
+/* Several clients may decode in parallel threads. */
+static pthread_once_t _ext_data_bitpacked_windows_once = PTHREAD_ONCE_INIT;
+
+static void ext_data_bitpacked_init_windows(void)
+{
+  int t1, p, n;
+
+  for (t1 = 0; t1 < 256; t1++)
+    {
+      ext_data_bitpacked_window *w = &_ext_data_bitpacked_windows[t1];
+
+      memset(w, 0, sizeof (*w));
+      memset(w->_shuffle, -1, sizeof (w->_shuffle)); /* -> zero */
+
+      for (p = 0, n = 0; p < 8; n++)
+	{
+	  if (t1 & (1 << p))
+	    {
+	      if (p + 1 >= 8)
+		break; /* value not complete in window */
+	      w->_shuffle[2*n  ] = (int8_t) (p + 1);
+	      w->_shuffle[2*n+1] = (int8_t) p;
+	      w->_leaders |= (uint8_t) (1 << p);
+	      p += 2;
+	    }
+	  else
+	    {
+	      w->_shuffle[2*n  ] = (int8_t) p;
+	      w->_leaders |= (uint8_t) (1 << p);
+	      p += 1;
+	    }
+	  w->_end = (uint8_t) p;
+	}
+    }
+}
+
+/* Classify the 8 bytes at src.  Returns the number of values that
+ * can be taken from the window (0 if none), the window to use, and
+ * the number of source bytes they use.  The latter is what the next
+ * window depends on, so is not derived from the value count.
+ */
+
+__attribute__((target("ssse3")))
+static inline uint32_t
+ext_data_bitpacked_window_values(__m128i b,
+				 const ext_data_bitpacked_window **w_p,
+				 uint32_t *used_p)
+{
+  const __m128i type_mask = _mm_set1_epi8((char) 0xe0);
+  const __m128i type1 = _mm_set1_epi8(0x20);
+  const __m128i type2 = _mm_set1_epi8(0x3f);
+  __m128i type = _mm_and_si128(b, type_mask);
+  uint32_t t1, bad, leaders;
+  const ext_data_bitpacked_window *w;
+
+  t1 = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(type, type1)) & 0xff;
+  /* Signed compare: 0x80-0xff are negative, i.e. also fine here, so
+   * catch them separately with the sign bit.
+   */
+  bad = ((uint32_t) _mm_movemask_epi8(_mm_cmpgt_epi8(b, type2)) |
+	 (uint32_t) _mm_movemask_epi8(b)) & 0xff;
+
+  w = &_ext_data_bitpacked_windows[t1];
+  leaders = w->_leaders;
+  bad &= leaders;
+  if (bad)
+    {
+      leaders &= (bad & -bad) - 1;
+      *used_p = (uint32_t) __builtin_ctz(bad);
+    }
+  else
+    *used_p = w->_end;
+
+  *w_p = w;
+  return (uint32_t) __builtin_popcount(leaders);
+}
+
+__attribute__((target("ssse3")))
+static int ext_data_write_bitpacked_event_ssse3(char *dest,size_t dest_size,
+						uint8_t *src,uint8_t *end_src,
+						uint32_t offset,uint64_t *dirty)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i low13 = _mm_set1_epi16(0x1fff);
+  const __m128i iota_lo = _mm_setr_epi32(0, 1, 2, 3);
+  const __m128i iota_hi = _mm_setr_epi32(4, 5, 6, 7);
+
+  if (end_src - src < EXT_DATA_BITPACKED_SCALAR_BYTES ||
+      (size_t) (end_src - src) * EXT_DATA_BITPACKED_SPARSE_WORDS *
+      sizeof(uint32_t) < dest_size - offset)
+    return ext_data_write_bitpacked_event_scalar(dest, dest_size,
+						 src, end_src, offset, dirty);
+
+  for ( ; src < end_src; )
+    {
+      /* Skips and large values at the start cannot use a window. */
+      if (*src < 0x40 &&
+	  end_src - src >= 8 &&
+	  offset + 8 * sizeof(uint32_t) <= dest_size)
+	{
+	  __m128i b = _mm_loadl_epi64((const __m128i *) src);
+	  const ext_data_bitpacked_window *w;
+	  uint32_t used;
+	  uint32_t n = ext_data_bitpacked_window_values(b, &w, &used);
+
+	  if (n)
+	    {
+	      __m128i *d = (__m128i *) (dest + offset);
+	      __m128i v, cnt, m_lo, m_hi, lo, hi, old_lo, old_hi;
+
+	      v = _mm_shuffle_epi8(b, _mm_loadu_si128((const __m128i *)
+						      w->_shuffle));
+	      v = _mm_and_si128(v, low13);
+	      lo = _mm_unpacklo_epi16(v, zero);
+	      hi = _mm_unpackhi_epi16(v, zero);
+
+	      cnt = _mm_set1_epi32((int) n);
+	      m_lo = _mm_cmpgt_epi32(cnt, iota_lo);
+	      m_hi = _mm_cmpgt_epi32(cnt, iota_hi);
+
+	      /* Keep the destination words not decoded. */
+	      old_lo = _mm_loadu_si128(d);
+	      old_hi = _mm_loadu_si128(d + 1);
+	      lo = _mm_or_si128(_mm_and_si128(m_lo, lo),
+				_mm_andnot_si128(m_lo, old_lo));
+	      hi = _mm_or_si128(_mm_and_si128(m_hi, hi),
+				_mm_andnot_si128(m_hi, old_hi));
+	      _mm_storeu_si128(d, lo);
+	      _mm_storeu_si128(d + 1, hi);
+	      if (dirty &&
+		  (_mm_movemask_epi8(_mm_cmpeq_epi32(lo, old_lo)) &
+		   _mm_movemask_epi8(_mm_cmpeq_epi32(hi, old_hi))) != 0xffff)
+		{
+		  /* The n words span at most two blocks. */
+		  ext_data_mark_dirty(dirty, offset, 1);
+		  ext_data_mark_dirty(dirty, offset + 4 * (n - 1), 1);
+		}
+
+	      src += used;
+	      offset += n * (uint32_t) sizeof(uint32_t);
+	      continue;
+	    }
 	}
 
-      if (offset + sizeof(uint32_t) > dest_size) // unlikely
-	return -4;
-      // By design, we are always aligned...
-      // if (offset & 3) // unlikely
-      //   return -5;
+      int ret = ext_data_bitpacked_step(dest, dest_size,
+					&src, end_src, &offset, dirty);
+      if (ret) // unlikely
+	return ret;
+    }
+
+  if (offset != dest_size) // unlikely
+    return -6;
+
+  return 0;
+}
+
+__attribute__((target("avx2")))
+static int ext_data_write_bitpacked_event_avx2(char *dest,size_t dest_size,
+					       uint8_t *src,uint8_t *end_src,
+					       uint32_t offset,uint64_t *dirty)
+{
+  const __m128i low13 = _mm_set1_epi16(0x1fff);
+  const __m256i iota = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+  if (end_src - src < EXT_DATA_BITPACKED_SCALAR_BYTES ||
+      (size_t) (end_src - src) * EXT_DATA_BITPACKED_SPARSE_WORDS *
+      sizeof(uint32_t) < dest_size - offset)
+    return ext_data_write_bitpacked_event_scalar(dest, dest_size,
+						 src, end_src, offset, dirty);
+
+  for ( ; src < end_src; )
+    {
+      /* Skips and large values at the start cannot use a window. */
+      if (*src < 0x40 &&
+	  end_src - src >= 8 &&
+	  offset + 8 * sizeof(uint32_t) <= dest_size)
+	{
+	  __m128i b = _mm_loadl_epi64((const __m128i *) src);
+	  const ext_data_bitpacked_window *w;
+	  uint32_t used;
+	  uint32_t n = ext_data_bitpacked_window_values(b, &w, &used);
+
+	  if (n)
+	    {
+	      __m128i v;
+	      __m256i m, values;
+
+	      v = _mm_shuffle_epi8(b, _mm_loadu_si128((const __m128i *)
+						      w->_shuffle));
+	      v = _mm_and_si128(v, low13);
+	      m = _mm256_cmpgt_epi32(_mm256_set1_epi32((int) n), iota);
+	      values = _mm256_cvtepu16_epi32(v);
+	      if (dirty &&
+		  (~_mm256_movemask_epi8(_mm256_cmpeq_epi32(
+		      values,
+		      _mm256_loadu_si256((const __m256i *) (dest + offset)))) &
+		   _mm256_movemask_epi8(m)))
+		{
+		  ext_data_mark_dirty(dirty, offset, 1);
+		  ext_data_mark_dirty(dirty, offset + 4 * (n - 1), 1);
+		}
+	      _mm256_maskstore_epi32((int *) (dest + offset), m, values);
 
-      *((uint32_t *) (dest + offset)) = value;
+	      src += used;
+	      offset += n * (uint32_t) sizeof(uint32_t);
+	      continue;
+	    }
+	}
 
-      offset += (uint32_t) sizeof(uint32_t);
+      int ret = ext_data_bitpacked_step(dest, dest_size,
+					&src, end_src, &offset, dirty);
+      if (ret) // unlikely
+	return ret;
     }
 
   if (offset != dest_size) // unlikely
@@ -2634,9 +3956,183 @@ int ext_data_write_bitpacked_event(char *dest,size_t dest_size,
 
   return 0;
 }
+#endif
+
+/* @offset is where the decoding of @src starts in @dest, non-zero
+ * when continuing after ext_data_write_bitpacked_prefix().  @dirty
+ * (or NULL) gets the blocks changed, see ext_data_mark_dirty().
+ */
+typedef int (*ext_data_write_bitpacked_event_t)(char *dest,size_t dest_size,
+						uint8_t *src,uint8_t *end_src,
+						uint32_t offset,uint64_t *dirty);
+
+static ext_data_write_bitpacked_event_t _ext_data_write_bitpacked_event_impl;
+
+int ext_data_select_bitpacked(const char *name)
+{
+  ext_data_write_bitpacked_event_t impl = NULL;
+
+#if defined(__x86_64__) || defined(__i386__)
+  pthread_once(&_ext_data_bitpacked_windows_once,
+	       ext_data_bitpacked_init_windows);
+#endif
+
+  if (!name || !*name)
+    {
+      /* SSSE3 where the CPU has it.  The AVX2 version is not always
+       * faster: the masked store is slow on some CPUs, and sparse
+       * events use few values per window.
+       */
+      impl = ext_data_write_bitpacked_event_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("ssse3"))
+	impl = ext_data_write_bitpacked_event_ssse3;
+#endif
+    }
+  else if (strcmp(name, "scalar") == 0)
+    impl = ext_data_write_bitpacked_event_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+  else if (strcmp(name, "ssse3") == 0 && __builtin_cpu_supports("ssse3"))
+    impl = ext_data_write_bitpacked_event_ssse3;
+  else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+    impl = ext_data_write_bitpacked_event_avx2;
+#endif
+
+  if (!impl)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  _ext_data_write_bitpacked_event_impl = impl;
+  return 0;
+}
+
+/* This function is for internal use.  It is shared with the
+ * struct_writer.  Returns 0 on success.
+ */
+
+static pthread_once_t _ext_data_bitpacked_default_once = PTHREAD_ONCE_INIT;
+
+static void ext_data_select_bitpacked_default(void)
+{
+  if (_ext_data_write_bitpacked_event_impl)
+    return; /* ext_data_select_bitpacked() was called */
+
+  /* EXT_DATA_BITPACKED=scalar etc. for debugging. */
+  if (ext_data_select_bitpacked(getenv("EXT_DATA_BITPACKED")) != 0)
+    ext_data_select_bitpacked(NULL);
+}
+
+static int ext_data_write_bitpacked_rest(char *dest,size_t dest_size,
+					 uint8_t *src,uint8_t *end_src,
+					 uint32_t offset,uint64_t *dirty)
+{
+  pthread_once(&_ext_data_bitpacked_default_once,
+	       ext_data_select_bitpacked_default);
+
+  return _ext_data_write_bitpacked_event_impl(dest, dest_size,
+					      src, end_src, offset, dirty);
+}
+
+int ext_data_write_bitpacked_event(char *dest,size_t dest_size,
+				   uint8_t *src,uint8_t *end_src)
+{
+  return ext_data_write_bitpacked_rest(dest, dest_size, src, end_src, 0,
+				       NULL);
+}
+
+/* Decode the values before @prefix_size only.  The values are sorted
+ * by offset, so we can stop at the first one beyond.  *@src_p and
+ * *@offset_p are where ext_data_write_bitpacked_rest() continues.
+ */
+
+static int ext_data_write_bitpacked_prefix(char *dest,size_t dest_size,
+					   uint8_t **src_p,uint8_t *end_src,
+					   uint32_t *offset_p,
+					   uint32_t prefix_size,
+					   uint64_t *dirty)
+{
+  while (*src_p < end_src && *offset_p < prefix_size)
+    {
+      int ret = ext_data_bitpacked_step(dest, dest_size,
+					src_p, end_src, offset_p, dirty);
+      if (ret) // unlikely
+	return ret;
+    }
+  return 0;
+}
+
+/* Copy @n words from network to host byte order. */
+
+static void ext_data_ntohl_copy_scalar(uint32_t *dest,const uint32_t *src,
+				       size_t n)
+{
+  for ( ; n; n--)
+    *(dest++) = ntohl(*(src++));
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("ssse3")))
+static void ext_data_ntohl_copy_ssse3(uint32_t *dest,const uint32_t *src,
+				      size_t n)
+{
+  const __m128i swap32 = _mm_setr_epi8(3,2,1,0,7,6,5,4,
+				       11,10,9,8,15,14,13,12);
+
+  for ( ; n >= 4; n -= 4, src += 4, dest += 4)
+    _mm_storeu_si128((__m128i *) dest,
+		     _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) src),
+				      swap32));
+  ext_data_ntohl_copy_scalar(dest, src, n);
+}
+
+__attribute__((target("avx2")))
+static void ext_data_ntohl_copy_avx2(uint32_t *dest,const uint32_t *src,
+				     size_t n)
+{
+  const __m256i swap32 = _mm256_setr_epi8(3,2,1,0,7,6,5,4,
+					  11,10,9,8,15,14,13,12,
+					  3,2,1,0,7,6,5,4,
+					  11,10,9,8,15,14,13,12);
+
+  for ( ; n >= 8; n -= 8, src += 8, dest += 8)
+    _mm256_storeu_si256((__m256i *) dest,
+			_mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)
+							       src),
+					    swap32));
+  ext_data_ntohl_copy_ssse3(dest, src, n);
+}
+#endif
+
+static void (*_ext_data_ntohl_copy)(uint32_t *dest,const uint32_t *src,
+				    size_t n) = ext_data_ntohl_copy_scalar;
+
+static pthread_once_t _ext_data_ntohl_copy_once = PTHREAD_ONCE_INIT;
+
+/* Picks the implementation, once.  Callers go through pthread_once()
+ * before they use _ext_data_ntohl_copy.
+ */
+static void ext_data_ntohl_copy_select(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  if (ntohl(0x01020304) != 0x01020304)
+    {
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2"))
+	_ext_data_ntohl_copy = ext_data_ntohl_copy_avx2;
+      else if (__builtin_cpu_supports("ssse3"))
+	_ext_data_ntohl_copy = ext_data_ntohl_copy_ssse3;
+    }
+#endif
+}
 
 /* This function is for internal use.  It is similar to the code in
  * the struct_writer.  Returns 0 on success.
+ *
+ * It runs the program made from the pack list by
+ * ext_data_compile_pack_list().
  */
 
 int ext_data_write_packed_event(struct ext_data_client *client,
@@ -2657,8 +4153,10 @@ int ext_data_write_packed_event(struct ext_data_client *client,
 
   clistr = &client->_structures[struct_id];
 
-  o    = clistr->_orig_pack_list;
-  oend = clistr->_orig_pack_list_end;
+  pthread_once(&_ext_data_ntohl_copy_once, ext_data_ntohl_copy_select);
+
+  o    = clistr->_orig_pack_prog;
+  oend = clistr->_orig_pack_prog_end;
 
   /*
   fprintf (stderr, "[str: %d] %zd cmp %zd\n",
@@ -2674,41 +4172,64 @@ int ext_data_write_packed_event(struct ext_data_client *client,
 
   while (o < oend)
     {
-      uint32_t mark   = *(o++);
-      uint32_t offset = *(o++);
-      uint32_t loop = mark & EXTERNAL_WRITER_MARK_LOOP;
-      uint32_t value = ntohl(*(p++));
+      uint32_t op = *(o++);
 
-      *((uint32_t *) (dest + offset)) = value;
+      if (op == EXT_DATA_PACK_PROG_RUN)
+	{
+	  uint32_t n      = *(o++);
+	  uint32_t offset = *(o++);
 
-      if (loop)
+	  _ext_data_ntohl_copy((uint32_t *) (dest + offset), p, n);
+	  p += n;
+	}
+      else
 	{
+	  uint32_t offset    = *(o++);
 	  uint32_t max_loops = *(o++);
 	  uint32_t loop_size = *(o++);
+	  uint32_t value = ntohl(*(p++));
 
-	  uint32_t *onext = o + 2 * max_loops * loop_size;
+	  *((uint32_t *) (dest + offset)) = value;
 
 	  if (value > max_loops)
 	    return -2;
 
 	  uint32_t items = value * loop_size;
-	  uint32_t i;
 
 	  if (pend - pcheck < (ssize_t) items)
 	    return -3;
 
 	  pcheck += items;
 
-	  for (i = items; i; i--)
+	  if (op == EXT_DATA_PACK_PROG_STRIDED)
 	    {
-	      mark   = *(o++);
-	      offset = *(o++);
-	      value = ntohl(*(p++));
+	      uint32_t *base = o;
+	      uint32_t i, k;
 
-	      *((uint32_t *) (dest + offset)) = value;
+	      for (i = 0; i < value; i++)
+		for (k = 0; k < loop_size; k++)
+		  *((uint32_t *) (dest + base[k] +
+				  i * (uint32_t) sizeof(uint32_t))) =
+		    ntohl(*(p++));
+
+	      o += loop_size;
 	    }
+	  else
+	    {
+	      uint32_t nruns = *(o++);
+	      uint32_t *onext = o + 2 * nruns;
 
-	  o = onext;
+	      for ( ; items; o += 2)
+		{
+		  uint32_t n = o[0] < items ? o[0] : items;
+
+		  _ext_data_ntohl_copy((uint32_t *) (dest + o[1]), p, n);
+		  p += n;
+		  items -= n;
+		}
+
+	      o = onext;
+	    }
 	}
     }
 
@@ -2818,7 +4339,7 @@ int ext_data_next_event(struct ext_data_client *client,
 
 	  uint32_t length = ntohl(header->_length);
 
-	  client->_buf_used += length;
+	  ext_data_consume_message(client, length);
 
 	  client->_fetched_event = 0;
 	  continue;
@@ -2833,6 +4354,88 @@ int ext_data_next_event(struct ext_data_client *client,
   return 1;
 }
 
+/* Split an event (NTUPLE_FILL) message: make the raw data available
+ * (ext_data_get_raw_data()), and return the compact marker, with
+ * *@p_out at the event data after it.  The message is not consumed.
+ * Returns 0 on success, -1 (errno EBADMSG) on malformed messages.
+ */
+
+static int ext_data_event_msg_data(struct ext_data_client *client,
+				   const struct ext_data_client_struct *clistr,
+				   struct external_writer_buf_header *header,
+				   uint32_t length,
+				   uint32_t **p_out,uint32_t *marker_out)
+{
+  uint32_t *p = (uint32_t *) (header+1);
+  uint32_t *end = (uint32_t *) (((char*) header) + length);
+  uint32_t ntuple_index;
+  uint32_t marker, compact_marker;
+
+  if (p + (client->_sort_u32_words + 3) > end)
+    {
+      client->_last_error = "Event message too short for headers.";
+      errno = EBADMSG;
+      return -1;
+    }
+
+  p += client->_sort_u32_words;
+
+  p++; /* struct_index, handled by the caller. */
+  ntuple_index = ntohl(*(p++));
+
+  // printf ("index: %d\n",ntuple_index);
+
+  if (ntuple_index != 0)
+    {
+      client->_last_error = "Non-zero ntuple_index - "
+	"do not know how to handle.";
+      /* Or rather, do not know if it is properly propagated. */
+      /* Especially to a struct_writer continuation server. */
+      errno = EBADMSG;
+      return -1;
+    }
+
+  if (clistr->_max_raw_words)
+    {
+      client->_raw_words = ntohl(*(p++));
+
+      if (p + (client->_raw_words + 1) > end)
+	{
+	  client->_last_error = "Event message too short for raw data.";
+	  errno = EBADMSG;
+	  return -1;
+	}
+
+      client->_raw_ptr = p;
+      p += client->_raw_words;
+    }
+
+  marker = ntohl(*(p++));
+  compact_marker = marker & (EXTERNAL_WRITER_COMPACT_PACKED |
+			     EXTERNAL_WRITER_COMPACT_NONPACKED);
+
+  if (compact_marker != EXTERNAL_WRITER_COMPACT_PACKED &&
+      compact_marker != EXTERNAL_WRITER_COMPACT_NONPACKED)
+    {
+      client->_last_error = "Compact marker invalid.";
+      errno = EBADMSG;
+      return -1;
+    }
+
+  if (compact_marker == EXTERNAL_WRITER_COMPACT_PACKED &&
+      (end - p) * sizeof (uint32_t) !=
+      (((marker & 0x3fffffff) + 3) & (uint32_t) ~3))
+    {
+      client->_last_error = "Event message packed length mismatch.";
+      errno = EBADMSG;
+      return -1;
+    }
+
+  *p_out = p;
+  *marker_out = marker;
+  return 0;
+}
+
 int ext_data_fetch_event(struct ext_data_client *client,
 			 void *buf,size_t size
 #if !STRUCT_WRITER
@@ -2866,227 +4469,846 @@ int ext_data_fetch_event(struct ext_data_client *client,
       return -1;
     }
 
-  if (struct_id < 0 || struct_id >= client->_num_structures)
+  if (struct_id < 0 || struct_id >= client->_num_structures)
+    {
+      client->_last_error = "Request for non-existing structure index (key).";
+      errno = EINVAL;
+      return -1;
+    }  
+
+  clistr = &client->_structures[struct_id];
+
+  if (size != clistr->_dest_struct_size)
+    {
+      client->_last_error = "Buffer size mismatch.";
+      errno = EINVAL;
+      return -1;
+    }
+
+  client->_raw_ptr = NULL;
+  client->_raw_words = 0;
+
+  /* So, try to treat the message.
+   *
+   * Note that we ignore most messages, and only partially treat some.
+   */
+
+ next_event:
+  for ( ; ; )
+    {
+      uint32_t struct_index = -1; /* make compiler happy */
+
+      int ret = ext_data_fetch_event_message(client, &header, &struct_index);
+
+      uint32_t length = ntohl(header->_length);
+
+      if (ret == 0)
+	{
+#ifdef STRUCT_WRITER
+
+	  *header_in = header;
+	  *length_in = length;
+#endif
+	  /* Read through, all events are indexed. */
+	  if (client->_file_map &&
+	      client->_event_no == client->_index_events)
+	    client->_index_complete = 1;
+	  return 0;
+	}
+
+      if (ret != 1)
+	return ret;
+
+      if (struct_index != (uint32_t) struct_id)
+	{
+	  /* Discard this event. */
+	  ext_data_consume_message(client, length);
+	  continue;
+	}
+
+      /* This event is for us. */
+      break;
+    }
+
+  /* We do however make sure that (given correctness of the buf and
+   * size parameters, this function can never crash on bad network
+   * input, but rather produces some error message).
+   */
+
+  uint32_t length = ntohl(header->_length);
+
+  assert ((ntohl(header->_request) & EXTERNAL_WRITER_REQUEST_LO_MASK) ==
+	  EXTERNAL_WRITER_BUF_NTUPLE_FILL);
+  
+  {
+    /* The main message, prompting fill of the structure.
+     */
+    uint32_t *p;
+    uint32_t *end = (uint32_t *) (((char*) header) + length);
+    uint8_t *start;
+    uint32_t marker, compact_marker, real_len;
+    int prefiltered = 0;
+
+    char *unpack_buf = (char *) buf;
+    size_t unpack_size = size;
+    uint64_t *dirty = clistr->_dirty;
+
+    if (ext_data_event_msg_data(client, clistr, header, length,
+				&p, &marker))
+      return -1; /* errno already set */
+
+    if (clistr->_orig_array)
+      {
+	unpack_buf = (char *) clistr->_orig_array;
+	unpack_size = clistr->_orig_struct_size;
+	/* Different layout, the items are copied. */
+	ext_data_mark_all_dirty(clistr);
+	dirty = NULL;
+      }
+
+    compact_marker = marker & (EXTERNAL_WRITER_COMPACT_PACKED |
+			       EXTERNAL_WRITER_COMPACT_NONPACKED);
+
+    if (compact_marker & EXTERNAL_WRITER_COMPACT_NONPACKED)
+      {
+	int ret;
+	
+	/* It is not bit-packed.  Use the pack list.
+	 */
+
+	ext_data_consume_message(client, length);
+
+#ifdef STRUCT_WRITER
+	/* We actually do not want to get it unpacked for us.  We will
+	 * handle it ourselves.
+	 */
+	*header_in = header;
+	*length_in = length;
+	return 2;
+#endif
+
+	ret = ext_data_write_packed_event(client,unpack_buf,
+					  struct_id,p,end);
+	ext_data_mark_all_dirty(clistr);
+
+	if (ret)
+	  {
+	    /* fprintf (stderr, "ret=%d\n", ret); */
+	    client->_last_error = "Event message unpack failure.";
+	    errno = EBADMSG;
+	    return -1;
+	  }
+      }
+    else
+      {
+	int ret;
+
+	real_len = marker & 0x3fffffff;
+
+	/* Either we strike an error or not, we declare this event
+	 * as consumed.  Note: there is not much sense for clients
+	 * to continue, and they can anyhow not distinguish the
+	 * error message from other (more fatal) failures that give
+	 * the same error code.
+	 */
+
+	ext_data_consume_message(client, length);
+
+	start = (uint8_t *) p;
+
+	if (clistr->_prefilter)
+	  {
+	    /* Two phases: first only what the filter looks at. */
+	    uint8_t *end_src = start + real_len;
+	    uint32_t offset = 0;
+
+	    ret = ext_data_write_bitpacked_prefix(unpack_buf, unpack_size,
+						  &start, end_src, &offset,
+						  clistr->_prefix_size,
+						  dirty);
+	    if (!ret)
+	      {
+		if (clistr->_orig_array)
+		  ext_data_struct_map_items(clistr,
+					    (char *) buf,
+					    (char *) unpack_buf);
+		if (!clistr->_prefilter(buf, clistr->_prefilter_arg))
+		  goto next_event; /* Already consumed. */
+		prefiltered = 1;
+		ret = ext_data_write_bitpacked_rest(unpack_buf, unpack_size,
+						    start, end_src, offset,
+						    dirty);
+	      }
+	  }
+	else
+	  ret = ext_data_write_bitpacked_rest(unpack_buf,
+					      unpack_size,
+					      start,start + real_len,
+					      0, dirty);
+
+	if (ret)
+	  {
+	    client->_last_error = "Event message bit-unpack failure.";
+	    errno = EBADMSG;
+	    return -1;
+	  }
+      }
+
+    if (clistr->_orig_array)
+      {
+	ext_data_struct_map_items(clistr,
+				  (char *) buf,
+				  (char *) unpack_buf);
+      }
+
+    /* Not bit-packed, it was decoded completely. */
+    if (clistr->_prefilter && !prefiltered &&
+	!clistr->_prefilter(buf, clistr->_prefilter_arg))
+      goto next_event;
+
+    client->_fetched_event = 0;
+    /* We got an event! */
+    return 1;
+  }
+}
+
+#if !STRUCT_WRITER
+int ext_data_fetch_event_data(struct ext_data_client *client,
+			      int struct_id,
+			      uint32_t **src,uint32_t **end_src,
+			      int *packed_len)
+{
+  const struct ext_data_client_struct *clistr;
+  struct external_writer_buf_header *header;
+  uint32_t length, marker;
+  uint32_t *p;
+
+  if (!client)
+    {
+      /* client->_last_error = "Client context NULL."; */
+      errno = EFAULT;
+      return -1;
+    }
+
+  if (client->_state != EXT_DATA_STATE_SETUP_READ)
+    {
+      client->_last_error = "Client context has not had setup (for reading).";
+      errno = EFAULT;
+      return -1;
+    }
+
+  if (struct_id < 0 || struct_id >= client->_num_structures)
+    {
+      client->_last_error = "Request for non-existing structure index (key).";
+      errno = EINVAL;
+      return -1;
+    }
+
+  clistr = &client->_structures[struct_id];
+
+  client->_raw_ptr = NULL;
+  client->_raw_words = 0;
+
+  for ( ; ; )
+    {
+      uint32_t struct_index = -1; /* make compiler happy */
+
+      int ret = ext_data_fetch_event_message(client, &header, &struct_index);
+
+      if (ret != 1)
+	return ret;
+
+      length = ntohl(header->_length);
+
+      if (struct_index == (uint32_t) struct_id)
+	break;
+
+      /* Discard this event. */
+      ext_data_consume_message(client, length);
+    }
+
+  if (ext_data_event_msg_data(client, clistr, header, length, &p, &marker))
+    return -1; /* errno already set */
+
+  ext_data_consume_message(client, length);
+
+  *src = p;
+  *end_src = (uint32_t *) (((char*) header) + length);
+  *packed_len = (marker & EXTERNAL_WRITER_COMPACT_PACKED) ?
+    (int) (marker & 0x3fffffff) : -1;
+  return 1;
+}
+
+void *ext_data_unpack_array(struct ext_data_client *client,
+			    int struct_id,size_t *size)
+{
+  const struct ext_data_client_struct *clistr =
+    &client->_structures[struct_id];
+
+  *size = clistr->_orig_struct_size;
+  return clistr->_orig_array;
+}
+
+void ext_data_map_event(struct ext_data_client *client,
+			void *buf,int struct_id)
+{
+  const struct ext_data_client_struct *clistr =
+    &client->_structures[struct_id];
+
+  ext_data_struct_map_items(clistr, (char *) buf,
+			    (char *) clistr->_orig_array);
+}
+#endif
+
+void ext_data_ntohl_copy(uint32_t *dest,const uint32_t *src,size_t n)
+{
+  pthread_once(&_ext_data_ntohl_copy_once, ext_data_ntohl_copy_select);
+  _ext_data_ntohl_copy(dest, src, n);
+}
+
+#if !STRUCT_WRITER
+int ext_data_fetch_events(struct ext_data_client *client,
+			  void *buf,size_t size,size_t stride,
+			  int max_events,int struct_id,
+			  int (*accept)(const void *event,void *arg),
+			  void *accept_arg)
+{
+  char *slot = (char *) buf;
+  int fetched = 0;
+  struct ext_data_client_struct *clistr = NULL;
+  uint64_t *dirty = NULL;
+
+  if (!client)
+    {
+      /* client->_last_error = "Client context NULL."; */
+      errno = EFAULT;
+      return -1;
+    }
+
+  if (client->_pending_errno)
+    {
+      /* Failure after the events returned by the previous call.
+       * _last_error is still from then.
+       */
+      errno = client->_pending_errno;
+      client->_pending_errno = 0;
+      return -1;
+    }
+
+  if (stride < size || max_events < 0)
+    {
+      client->_last_error = "Bad stride or number of events.";
+      errno = EINVAL;
+      return -1;
+    }
+
+  /* The slots are not the buffer whose blocks are tracked (see
+   * ext_data_track_dirty()), so the decoders need not compare the
+   * words.  All blocks are dirty afterwards.
+   */
+  if (struct_id >= 0 && struct_id < client->_num_structures)
+    {
+      clistr = &client->_structures[struct_id];
+      dirty = clistr->_dirty;
+      clistr->_dirty = NULL;
+    }
+
+  while (fetched < max_events)
+    {
+      int ret = ext_data_fetch_event(client,slot,size,struct_id);
+
+      if (ret == 0)
+	break; /* Not consumed, so we also get 0 next time. */
+
+      if (ret == -1)
+	{
+	  if (!fetched)
+	    {
+	      fetched = -1;
+	      break;
+	    }
+	  /* Hand out what we have first. */
+	  if (errno != EAGAIN)
+	    client->_pending_errno = errno;
+	  break;
+	}
+
+      if (accept && !accept(slot,accept_arg))
+	continue; /* Reuse the slot. */
+
+      slot += stride;
+      fetched++;
+    }
+
+  if (dirty)
+    {
+      clistr->_dirty = dirty;
+      ext_data_mark_all_dirty(clistr);
+    }
+
+  return fetched;
+}
+#endif
+
+#if !STRUCT_WRITER
+/* Extend *@end to cover the words of @words at @src (dest @dest)
+ * which fall into the dest range [@offset, @offset+@length).
+ */
+
+static void ext_data_prefix_end_range(uint32_t *end,
+				      uint32_t src,uint32_t dest,
+				      uint32_t words,
+				      uint32_t offset,uint32_t length)
+{
+  uint32_t lo = dest > offset ? dest : offset;
+  uint32_t hi = dest + words * (uint32_t) sizeof (uint32_t);
+
+  if (hi > offset + length)
+    hi = offset + length;
+  if (lo < hi && src + (hi - dest) > *end)
+    *end = src + (hi - dest);
+}
+
+/* The end of the words for the dest range [@offset, @offset+@length)
+ * in the unpack layout, i.e. through the map list if there is one.
+ * Words which are not transmitted do not matter.
+ */
+
+static uint32_t
+ext_data_prefix_end(const struct ext_data_client_struct *clistr,
+		    uint32_t offset,uint32_t length)
+{
+  uint32_t *o    = clistr->_map_list;
+  uint32_t *oend = clistr->_map_list_end;
+  uint32_t end = 0;
+
+  if (!clistr->_orig_array)
+    return offset + length;
+
+  while (o < oend)
+    {
+      uint32_t offset_src_mark = *(o++);
+      uint32_t offset_dest     = *(o++);
+      uint32_t offset_src = offset_src_mark & MAP_LIST_SRC_OFFSET_MASK;
+
+      ext_data_prefix_end_range(&end, offset_src, offset_dest, 1,
+				offset, length);
+
+      if (offset_src_mark & MAP_LIST_MARK_LOOP)
+	{
+	  uint32_t max_loops = *(o++);
+	  uint32_t loop_size = *(o++);
+	  uint32_t i;
+
+	  for (i = 0; i < loop_size; i++, o += 2)
+	    ext_data_prefix_end_range(&end, o[0], o[1], max_loops,
+				      offset, length);
+	}
+    }
+  return end;
+}
+
+int ext_data_set_prefilter(struct ext_data_client *client,int struct_id,
+			   const uint32_t *ranges,int n,
+			   int (*accept)(const void *event,void *arg),
+			   void *accept_arg)
+{
+  struct ext_data_client_struct *clistr;
+  int i;
+
+  if (!client)
+    {
+      /* client->_last_error = "Client context NULL."; */
+      errno = EFAULT;
+      return -1;
+    }
+
+  if (client->_state != EXT_DATA_STATE_SETUP_READ)
+    {
+      client->_last_error = "Client context has not had setup (for reading).";
+      errno = EFAULT;
+      return -1;
+    }
+
+  if (struct_id < 0 || struct_id >= client->_num_structures)
+    {
+      client->_last_error = "Request for non-existing structure index (key).";
+      errno = EINVAL;
+      return -1;
+    }
+
+  clistr = &client->_structures[struct_id];
+
+  clistr->_prefix_size = 0;
+  for (i = 0; i < n; i++)
+    {
+      uint32_t end;
+
+      if (ranges[2*i] + ranges[2*i+1] > clistr->_dest_struct_size)
+	{
+	  clistr->_prefilter = NULL;
+	  client->_last_error = "Prefilter range outside structure.";
+	  errno = EINVAL;
+	  return -1;
+	}
+      end = ext_data_prefix_end(clistr, ranges[2*i], ranges[2*i+1]);
+      if (end > clistr->_prefix_size)
+	clistr->_prefix_size = end;
+    }
+
+  clistr->_prefilter = accept;
+  clistr->_prefilter_arg = accept_arg;
+  return 0;
+}
+
+uint64_t *ext_data_track_dirty(struct ext_data_client *client,int struct_id,
+			       size_t *words)
+{
+  struct ext_data_client_struct *clistr;
+
+  if (!client)
+    {
+      /* client->_last_error = "Client context NULL."; */
+      errno = EFAULT;
+      return NULL;
+    }
+
+  if (client->_state != EXT_DATA_STATE_SETUP_READ)
+    {
+      client->_last_error = "Client context has not had setup (for reading).";
+      errno = EFAULT;
+      return NULL;
+    }
+
+  if (struct_id < 0 || struct_id >= client->_num_structures)
+    {
+      client->_last_error = "Request for non-existing structure index (key).";
+      errno = EINVAL;
+      return NULL;
+    }
+
+  clistr = &client->_structures[struct_id];
+
+  if (!clistr->_dirty)
+    {
+      size_t blocks =
+	(clistr->_dest_struct_size + EXT_DATA_DIRTY_BLOCK_SIZE - 1) >>
+	EXT_DATA_DIRTY_BLOCK_SHIFT;
+
+      clistr->_dirty_words = (blocks + 63) / 64;
+      clistr->_dirty = (uint64_t *) malloc(clistr->_dirty_words *
+					   sizeof (uint64_t));
+      if (!clistr->_dirty)
+	{
+	  clistr->_dirty_words = 0;
+	  client->_last_error = "Memory allocation failure (dirty blocks).";
+	  errno = ENOMEM;
+	  return NULL;
+	}
+      /* Nothing has been seen yet. */
+      ext_data_mark_all_dirty(clistr);
+    }
+
+  if (words)
+    *words = clistr->_dirty_words;
+  return clistr->_dirty;
+}
+#endif
+
+int ext_data_skip_events(struct ext_data_client *client,uint64_t n)
+{
+  if (!client)
+    {
+      /* client->_last_error = "Client context NULL."; */
+      errno = EFAULT;
+      return -1;
+    }
+
+  if (client->_state != EXT_DATA_STATE_SETUP_READ)
+    {
+      client->_last_error = "Client context has not had setup (for reading).";
+      errno = EFAULT;
+      return -1;
+    }
+
+  /* Held back failure belongs to messages we have passed already. */
+  client->_pending_errno = 0;
+
+  /* Known positions need not be walked to. */
+  if (client->_file_map &&
+      client->_event_no + n > client->_event_no &&
+      client->_event_no + n < client->_index_events)
+    return ext_data_seek_event(client, client->_event_no + n);
+
+  for ( ; n; n--)
+    {
+      struct external_writer_buf_header *header;
+      uint32_t struct_index;
+
+      int ret = ext_data_fetch_event_message(client, &header, &struct_index);
+
+      if (ret != 1)
+	{
+	  if (ret == 0 && client->_file_map &&
+	      client->_event_no == client->_index_events)
+	    client->_index_complete = 1;
+	  return ret;
+	}
+
+      /* Also an event announced by ext_data_next_event(). */
+      client->_fetched_event = 0;
+
+      ext_data_consume_message(client, ntohl(header->_length));
+    }
+
+  return 1;
+}
+
+int ext_data_seek_event(struct ext_data_client *client,uint64_t event_no)
+{
+  if (!client)
+    {
+      /* client->_last_error = "Client context NULL."; */
+      errno = EFAULT;
+      return -1;
+    }
+
+  if (!client->_file_map)
     {
-      client->_last_error = "Request for non-existing structure index (key).";
-      errno = EINVAL;
+      client->_last_error = "Seek needs a mapped file (ext_data_from_file).";
+      errno = ESPIPE;
       return -1;
-    }  
-
-  clistr = &client->_structures[struct_id];
+    }
 
-  if (size != clistr->_dest_struct_size)
+  if (client->_state != EXT_DATA_STATE_SETUP_READ)
     {
-      client->_last_error = "Buffer size mismatch.";
-      errno = EINVAL;
+      client->_last_error = "Client context has not had setup (for reading).";
+      errno = EFAULT;
       return -1;
     }
 
-  client->_raw_ptr = NULL;
-  client->_raw_words = 0;
-
-  /* So, try to treat the message.
-   *
-   * Note that we ignore most messages, and only partially treat some.
-   */
+  client->_pending_errno = 0;
+  client->_fetched_event = 0;
 
-  for ( ; ; )
+  if (event_no < client->_index_events)
     {
-      uint32_t struct_index = -1; /* make compiler happy */
-
-      int ret = ext_data_fetch_event_message(client, &header, &struct_index);
-
-      uint32_t length = ntohl(header->_length);
-
-      if (ret == 0)
-	{
-#ifdef STRUCT_WRITER
-
-	  *header_in = header;
-	  *length_in = length;
-#endif
-	  return 0;
-	}
-
-      if (ret != 1)
-	return ret;
-
-      if (struct_index != (uint32_t) struct_id)
+      if (client->_index[event_no] >= client->_buf_filled)
 	{
-	  /* Discard this event. */
-	  client->_buf_used += length;
-	  continue;
+	  client->_last_error = "Index entry outside of file.";
+	  errno = EBADMSG;
+	  return -1;
 	}
-
-      /* This event is for us. */
-      break;
+      client->_buf_used = client->_index[event_no];
+      client->_event_no = event_no;
+      return 1;
     }
 
-  /* We do however make sure that (given correctness of the buf and
-   * size parameters, this function can never crash on bad network
-   * input, but rather produces some error message).
-   */
+  /* Walk from the last known event. */
+  if (client->_index_events &&
+      client->_event_no < client->_index_events)
+    {
+      client->_buf_used = client->_index[client->_index_events - 1];
+      client->_event_no = client->_index_events - 1;
+    }
 
-  uint32_t length = ntohl(header->_length);
+  if (event_no < client->_event_no) // unlikely, index not complete
+    {
+      client->_last_error = "Event before indexed range (out of memory?).";
+      errno = ENOMEM;
+      return -1;
+    }
 
-  assert ((ntohl(header->_request) & EXTERNAL_WRITER_REQUEST_LO_MASK) ==
-	  EXTERNAL_WRITER_BUF_NTUPLE_FILL);
-  
-  {
-    /* The main message, prompting fill of the structure.
-     */
-#if 0
-    uint32_t *p   = (uint32_t *) (header+1);
-    uint32_t *end = (uint32_t *) (((char*) header) +
-				  ntohl(header->_length));
-#endif
+  return ext_data_skip_events(client, event_no - client->_event_no);
+}
 
-    uint32_t *p = (uint32_t *) (header+1);
-    uint32_t *end = (uint32_t *) (((char*) header) + length);
-    uint8_t *start;
-    uint32_t struct_index;
-    uint32_t ntuple_index;
-    uint32_t marker, compact_marker, real_len;
+uint64_t ext_data_tell_event(struct ext_data_client *client)
+{
+  return client->_event_no;
+}
 
-    char *unpack_buf = (char *) buf;
-    size_t unpack_size = size;
+void ext_data_set_wait_clock(struct ext_data_client *client,
+			     uint64_t (*clock)(void))
+{
+  client->_wait_clock = clock;
+}
 
-    if (p + (client->_sort_u32_words + 3) > end)
-      {
-	client->_last_error = "Event message too short for headers.";
-	errno = EBADMSG;
-	return -1;
-      }
+uint64_t ext_data_wait_time(struct ext_data_client *client)
+{
+  return client->_wait_time;
+}
 
-    p += client->_sort_u32_words;
+#define EXT_DATA_INDEX_MAGIC  0x68313031 /* 'h101' */
 
-    struct_index = ntohl(*(p++));
-    ntuple_index = ntohl(*(p++));
+/* Sidecar index file layout, host byte order.  Version 2 added the
+ * modification time of the data file.
+ */
+struct ext_data_index_header
+{
+  uint32_t _magic;
+  uint32_t _version;
+  uint64_t _file_size;
+  int64_t  _file_mtime_sec;
+  int64_t  _file_mtime_nsec;
+  uint64_t _events;
+};
 
-    // printf ("index: %d\n",ntuple_index);
+static int ext_data_read_index(struct ext_data_client *client,
+			       const char *sidecar)
+{
+  struct ext_data_index_header h;
+  uint64_t *index = NULL;
+  size_t size;
+  uint64_t i;
+  FILE *fid;
+
+  fid = fopen(sidecar, "rb");
+  if (!fid)
+    return 0;
 
-    (void) struct_index; /* Handled above. */
+  if (fread(&h, sizeof (h), 1, fid) != 1 ||
+      h._magic != EXT_DATA_INDEX_MAGIC ||
+      h._version != 2 ||
+      h._file_size != client->_file_map_size ||
+      h._file_mtime_sec != client->_file_map_mtime.tv_sec ||
+      h._file_mtime_nsec != client->_file_map_mtime.tv_nsec ||
+      h._events > client->_file_map_size /
+      sizeof (struct external_writer_buf_header))
+    goto not_valid;
+
+  size = (size_t) h._events * sizeof (uint64_t);
+  if (!(index = (uint64_t *) malloc (size ? size : 1)) ||
+      fread(index, 1, size, fid) != size)
+    goto not_valid;
+
+  /* Each entry must be a message header in the file, after the
+   * previous one.  seek uses them as they are.
+   */
+  for (i = 0; i < h._events; i++)
+    if ((index[i] & 3) ||
+	index[i] + sizeof (struct external_writer_buf_header) >
+	client->_file_map_size ||
+	(i && index[i] <= index[i - 1]))
+      goto not_valid;
+
+  /* What we walked ourselves must agree. */
+  for (i = 0; i < h._events && i < client->_index_events; i++)
+    if (index[i] != client->_index[i])
+      goto not_valid;
+
+  /* Spot check that the first and last entries are events. */
+  if (h._events)
+    {
+      uint64_t ends[2] = { index[0], index[h._events - 1] };
 
-    if (ntuple_index != 0)
-      {
-	client->_last_error = "Non-zero ntuple_index - "
-	  "do not know how to handle.";
-	/* Or rather, do not know if it is properly propagated. */
-	/* Especially to a struct_writer continuation server. */
-	errno = EBADMSG;
-	return -1;
-      }
+      for (i = 0; i < 2; i++)
+	{
+	  struct external_writer_buf_header *header =
+	    (struct external_writer_buf_header *)
+	    ((char *) client->_file_map + ends[i]);
 
-    if (clistr->_orig_array)
-      {
-	unpack_buf = (char *) clistr->_orig_array;
-	unpack_size = clistr->_orig_struct_size;
-      }
+	  if ((ntohl(header->_request) & EXTERNAL_WRITER_REQUEST_LO_MASK) !=
+	      EXTERNAL_WRITER_BUF_NTUPLE_FILL)
+	    goto not_valid;
+	}
+    }
 
-    if (clistr->_max_raw_words)
-      {
-	client->_raw_words = ntohl(*(p++));
+  fclose(fid);
 
-	if (p + (client->_raw_words + 1) > end)
-	  {
-	    client->_last_error = "Event message too short for raw data.";
-	    errno = EBADMSG;
-	    return -1;
-	  }
+  /* It may only extend what we have. */
+  if (h._events < client->_index_events)
+    {
+      free(index);
+      return 0;
+    }
 
-	client->_raw_ptr = p;
-	p += client->_raw_words;
-      }
+  free(client->_index);
+  client->_index = index;
+  client->_index_events = h._events;
+  client->_index_alloc = h._events;
+  client->_index_complete = 1;
+  return 1;
 
-    marker = ntohl(*(p++));
-    compact_marker = marker & (EXTERNAL_WRITER_COMPACT_PACKED |
-			       EXTERNAL_WRITER_COMPACT_NONPACKED);
+ not_valid:
+  free(index);
+  fclose(fid);
+  return 0;
+}
 
-    if (compact_marker != EXTERNAL_WRITER_COMPACT_PACKED &&
-	compact_marker != EXTERNAL_WRITER_COMPACT_NONPACKED)
-      {
-	client->_last_error = "Compact marker invalid.";
-	errno = EBADMSG;
-	return -1;
-      }
+static void ext_data_write_index(struct ext_data_client *client,
+				 const char *sidecar)
+{
+  struct ext_data_index_header h;
+  FILE *fid;
+  int ok;
+
+  h._magic = EXT_DATA_INDEX_MAGIC;
+  h._version = 2;
+  h._file_size = client->_file_map_size;
+  h._file_mtime_sec = client->_file_map_mtime.tv_sec;
+  h._file_mtime_nsec = client->_file_map_mtime.tv_nsec;
+  h._events = client->_index_events;
+
+  fid = fopen(sidecar, "wb");
+  if (!fid)
+    return;
 
-    if (compact_marker & EXTERNAL_WRITER_COMPACT_NONPACKED)
-      {
-	int ret;
-	
-	/* It is not bit-packed.  Use the pack list.
-	 */
+  ok = (fwrite(&h, sizeof (h), 1, fid) == 1 &&
+	fwrite(client->_index, sizeof (uint64_t),
+	       (size_t) h._events, fid) == h._events);
 
-	client->_buf_used += length;
+  if (fclose(fid) != 0 || !ok)
+    unlink(sidecar); /* no half-written index */
+}
 
-#ifdef STRUCT_WRITER
-	/* We actually do not want to get it unpacked for us.  We will
-	 * handle it ourselves.
-	 */
-	*header_in = header;
-	*length_in = length;
-	return 2;
-#endif
+int64_t ext_data_index_events(struct ext_data_client *client,
+			      const char *sidecar)
+{
+  uint64_t event_no;
+  int ret;
 
-	ret = ext_data_write_packed_event(client,unpack_buf,
-					  struct_index,p,end);
+  if (!client)
+    {
+      /* client->_last_error = "Client context NULL."; */
+      errno = EFAULT;
+      return -1;
+    }
 
-	if (ret)
-	  {
-	    /* fprintf (stderr, "ret=%d\n", ret); */
-	    client->_last_error = "Event message unpack failure.";
-	    errno = EBADMSG;
-	    return -1;
-	  }
-      }
-    else
-      {
-	int ret;
+  if (!client->_file_map)
+    {
+      client->_last_error = "Index needs a mapped file (ext_data_from_file).";
+      errno = ESPIPE;
+      return -1;
+    }
 
-	real_len = marker & 0x3fffffff;
+  if (client->_index_complete)
+    return (int64_t) client->_index_events;
 
-	if ((end - p) * sizeof (uint32_t) !=
-	    ((real_len + 3) & (uint32_t) ~3))
-	  {
-	    client->_last_error = "Event message packed length mismatch.";
-	    errno = EBADMSG;
-	    return -1;
-	  }
+  if (sidecar && ext_data_read_index(client, sidecar))
+    return (int64_t) client->_index_events;
 
-	/* Either we strike an error or not, we declare this event
-	 * as consumed.  Note: there is not much sense for clients
-	 * to continue, and they can anyhow not distinguish the
-	 * error message from other (more fatal) failures that give
-	 * the same error code.
-	 */
+  /* Skim to the end, and come back. */
+  event_no = client->_event_no;
 
-	client->_buf_used += length;
+  ret = ext_data_seek_event(client, (uint64_t) -1);
 
-	start = (uint8_t *) p;
+  if (ret == -1)
+    return -1;
 
-	ret = ext_data_write_bitpacked_event(unpack_buf,
-					     unpack_size,
-					     start,start + real_len);
+  if (!client->_index_complete)
+    {
+      /* The walk stopped on something else than the end. */
+      client->_last_error = "Indexing did not reach end of data.";
+      errno = EBADMSG;
+      return -1;
+    }
 
-	if (ret)
-	  {
-	    client->_last_error = "Event message bit-unpack failure.";
-	    errno = EBADMSG;
-	    return -1;
-	  }
-      }
+  if (ext_data_seek_event(client, event_no) == -1)
+    return -1;
 
-    if (clistr->_orig_array)
-      {
-	ext_data_struct_map_items(clistr,
-				  (char *) buf,
-				  (char *) unpack_buf);
-      }
+  if (sidecar)
+    ext_data_write_index(client, sidecar);
 
-    client->_fetched_event = 0;
-    /* We got an event! */
-    return 1;
-  }
+  return (int64_t) client->_index_events;
 }
 
 int ext_data_get_raw_data(struct ext_data_client *client,
@@ -3113,7 +5335,6 @@ int ext_data_get_raw_data(struct ext_data_client *client,
     {
       uint32_t *d32 = client->_raw_swapped;
       uint32_t *s32 = client->_raw_ptr;
-      uint32_t i;
 
       /* One could of course discuss whether data should instead be
        * sent in native order and then byteswapped only when necessary
@@ -3125,8 +5346,8 @@ int ext_data_get_raw_data(struct ext_data_client *client,
        * E3-1240v3  (3.8 GHz)  1985 MiB/s
        */
 
-      for (i = 0; i < client->_raw_words; i++)
-	*(d32++) = ntohl(*(s32++));
+      pthread_once(&_ext_data_ntohl_copy_once, ext_data_ntohl_copy_select);
+      _ext_data_ntohl_copy(d32, s32, client->_raw_words);
 
       client->_raw_ptr = client->_raw_swapped;
     }
@@ -3180,12 +5401,10 @@ int ext_data_clear_event(struct ext_data_client *client,
 
   if (!clistr->_dest_pack_list)
     {
-      /* Setup was called without struct_layout_info (i.e. only with
-       * struct_info) - we have no pack list, so do not know where
-       * the items are.
-       *
-       * In principle, we could produce such a list from the
-       * struct_info.
+      /* Setup for reading was called without struct_layout_info
+       * (i.e. only with struct_info) - we have no pack list, so do
+       * not know where the items are.  (For writing, it is produced
+       * from the struct_info.)
        */
       client->_last_error = "No pack list known - cannot clear.";
       errno = EFAULT;
@@ -3322,6 +5541,122 @@ void ext_data_clear_zzp_lists(struct ext_data_client *client,
 }
 
 
+/* Encode one word for ext_data_write_bitpacked_event(), after @skip
+ * words which are not sent.
+ */
+
+static uint8_t *ext_data_bitpack_word(uint8_t *p,uint32_t skip,uint32_t value)
+{
+  if (value < 0x2000)
+    {
+      while (skip)
+	{
+	  *(p++) = (uint8_t) (0x80 | (skip & 0x7f));
+	  skip >>= 7;
+	}
+      if (value < 0x20)
+	*(p++) = (uint8_t) value;
+      else
+	{
+	  *(p++) = (uint8_t) (0x20 | (value >> 8));
+	  *(p++) = (uint8_t) value;
+	}
+    }
+  else if (value == 0x7fc00000)
+    {
+      while (skip >= 0x10)
+	{
+	  *(p++) = (uint8_t) (0x80 | (skip & 0x7f));
+	  skip >>= 7;
+	}
+      *(p++) = (uint8_t) (0x60 | skip);
+    }
+  else
+    {
+      while (skip >= 0x20)
+	{
+	  *(p++) = (uint8_t) (0x80 | (skip & 0x7f));
+	  skip >>= 7;
+	}
+      *(p++) = (uint8_t) (0x40 | skip);
+      *(p++) = (uint8_t) (value >> 24);
+      *(p++) = (uint8_t) (value >> 16);
+      *(p++) = (uint8_t) (value >> 8);
+      *(p++) = (uint8_t) value;
+    }
+  return p;
+}
+
+/* Write the event in @b bit-packed, after the message headers at @cur.
+ * The words given by the pack list (and the array items up to the
+ * control values) are marked, and then sent in structure order.
+ * Returns the end of the message, NULL on failure.
+ */
+
+static uint32_t *
+ext_data_write_event_bitpacked(struct ext_data_client *client,
+			       const struct ext_data_client_struct *clistr,
+			       uint32_t *cur,char *b)
+{
+  uint8_t *present = clistr->_dest_present;
+  uint32_t words = (uint32_t) (clistr->_dest_struct_size / sizeof(uint32_t));
+  uint32_t *o    = clistr->_dest_pack_list;
+  uint32_t *oend = clistr->_dest_pack_list_end;
+  uint8_t *start, *p;
+  uint32_t i, last = 0, real_len;
+
+  while (o < oend)
+    {
+      uint32_t mark   = *(o++);
+      uint32_t offset = *(o++);
+
+      present[offset / sizeof(uint32_t)] = 1;
+
+      if (mark & EXTERNAL_WRITER_MARK_LOOP)
+	{
+	  uint32_t max_loops = *(o++);
+	  uint32_t loop_size = *(o++);
+	  uint32_t value = *((uint32_t *) (b + offset));
+	  uint32_t *onext = o + 2 * max_loops * loop_size;
+
+	  if (value > max_loops)
+	    {
+	      /* Unmark again, for the next event. */
+	      memset(present, 0, words);
+	      client->_last_error = "Array ctrl item value out of bounds.";
+	      errno = EINVAL;
+	      return NULL;
+	    }
+
+	  for (i = value * loop_size; i; i--, o += 2)
+	    present[o[1] / sizeof(uint32_t)] = 1;
+	  o = onext;
+	}
+    }
+
+  /* The decoder wants the event to end with the structure. */
+  if (words)
+    present[words - 1] = 1;
+
+  start = p = (uint8_t *) (cur + 1);
+
+  for (i = 0; i < words; i++)
+    if (present[i])
+      {
+	present[i] = 0;
+	p = ext_data_bitpack_word(p, i - last,
+				  ((uint32_t *) b)[i]);
+	last = i + 1;
+      }
+
+  real_len = (uint32_t) (p - start);
+  while ((p - start) & 3)
+    *(p++) = 0;
+
+  *cur = htonl(EXTERNAL_WRITER_COMPACT_PACKED | real_len);
+  return (uint32_t *) p;
+}
+
 int ext_data_write_event(struct ext_data_client *client,
 			 void *buf,size_t size)
 {
@@ -3371,7 +5706,7 @@ int ext_data_write_event(struct ext_data_client *client,
 
   if (client->_buf_alloc - client->_buf_filled <
       sizeof (struct external_writer_buf_header) + 3 * sizeof(uint32_t) +
-      clistr->_dest_max_pack_items * sizeof(uint32_t))
+      EXT_DATA_WRITE_MAX_EVENT(client, clistr))
     {
       if (ext_data_flush_buffer(client))
 	return -1; // errno has been set
@@ -3384,6 +5719,15 @@ int ext_data_write_event(struct ext_data_client *client,
 
   *(cur++) = htonl(0); /* struct_index */
   *(cur++) = htonl(0); /* ntuple_index */
+
+  if (client->_write_bitpacked)
+    {
+      cur = ext_data_write_event_bitpacked(client, clistr, cur, (char *) buf);
+      if (!cur)
+	return -1;
+      goto write_done;
+    }
+
   *(cur++) = htonl(EXTERNAL_WRITER_COMPACT_NONPACKED);
 
   /* Run through the offset list and write the data to the buffer.
@@ -3441,6 +5785,7 @@ int ext_data_write_event(struct ext_data_client *client,
 	}
     }
 
+write_done:
   length = (uint32_t) (((char*) cur) - ((char*) header));
 
   header->_request = htonl(EXTERNAL_WRITER_BUF_NTUPLE_FILL |
@@ -3541,6 +5886,11 @@ int ext_data_close(struct ext_data_client *client)
 	return -1; // errno already set
     }
 
+  /* The reader thread must be gone before its fd is closed (and
+   * maybe reused).
+   */
+  ext_data_prefetch_stop(client);
+
   /* Only close the file handle if opened by us. */
 
   while (client->_fd_close != -1)
@@ -98,6 +98,34 @@ void ext_data_struct_info_free(struct ext_data_structure_info *struct_info);
 
 /*************************************************************************/
 
+/* Only take some of the server items.
+ *
+ * When ext_data_setup() is given a structure information without
+ * items, it takes all items that the server provides.  With a
+ * selection, it only takes the items for which @select returns
+ * non-zero, plus the items controlling their length.  They are placed
+ * one after another in the order of the server structure, and
+ * ext_data_struct_info_get_items() gives the resulting layout.
+ *
+ * @struct_info     Information structure (without items).
+ * @select          Called with the name of each server item.
+ * @arg             Passed to @select.
+ *
+ * Return value:
+ *
+ *  0  success.
+ * -1  failure.  See errno.
+ *
+ * EFAULT           @struct_info is NULL.
+ * EINVAL           @struct_info already has items.
+ */
+
+int ext_data_struct_info_select(struct ext_data_structure_info *struct_info,
+				int (*select)(const char *name, void *arg),
+				void *arg);
+
+/*************************************************************************/
+
 #define EXT_DATA_ITEM_FLAGS_OPTIONAL  0x01
 
 /* Add one item of structure information.
@@ -399,6 +427,30 @@ struct ext_data_client *ext_data_from_fd(int fd);
 
 /*************************************************************************/
 
+/* Create a client context to read data from a (recorded) file.  The
+ * entire file is mapped into memory, and messages are handed to the
+ * unpacking routines directly from the mapping, i.e. without any
+ * read() calls or copying into an intermediate buffer.
+ *
+ * @filename        Name of a regular file with STRUCT data.
+ *
+ * The file is closed (and unmapped) by ext_data_close().
+ *
+ * Return value:
+ *
+ * Pointer to a context structure (use when calling other functions).
+ * NULL on failure, in which case errno describes the error:
+ *
+ * EINVAL           Not a regular file, or empty.
+ * ENOMEM           Failure to allocate memory.
+ *
+ * Other error codes come from open(), fstat() and mmap().
+ */
+
+struct ext_data_client *ext_data_from_file(const char *filename);
+
+/*************************************************************************/
+
 /* Create a client context to write events using stdout (STDOUT_FILENO).
  * Then call the setup function to describe the data structure.
  *
@@ -414,6 +466,26 @@ struct ext_data_client *ext_data_open_out();
 
 /*************************************************************************/
 
+/* Write the events bit-packed (compact), as the unpacker does, instead
+ * of one word per item.  Only words given by the control items are
+ * sent.  Must be called before the setup function.
+ *
+ * @client          Connection context structure (ext_data_open_out()).
+ * @bitpacked       Non-zero to bit-pack.
+ *
+ * Return value:
+ *
+ *  0  success.
+ * -1  failure.  See errno.
+ *
+ * EINVAL           Setup has already been done.
+ * EFAULT           @client is NULL.
+ */
+
+int ext_data_write_bitpacked(struct ext_data_client *client,int bitpacked);
+
+/*************************************************************************/
+
 /* Consume the header messages and verify that the structure to
  * be filled is correct - alternatively map as many members as is
  * possible.
@@ -432,6 +504,9 @@ struct ext_data_client *ext_data_open_out();
  * @struct_info         Detailed structure member information.
  *                      Allows mapping of items when sending structure
  *                      is different from structure to be filled.
+ *                      When writing (ext_data_open_out()), the items
+ *                      and the pack list made from them are sent, so
+ *                      that readers need no layout of their own.
  * @struct_map_success  Returns overall mapping success of @struct_info.
  *                      In order to not have silent data loss, it is
  *                      suggested to only continue if
@@ -496,6 +571,34 @@ int ext_data_nonblocking_fd(struct ext_data_client *client);
 
 /*************************************************************************/
 
+/* Read messages in a background thread, such that the sender does not
+ * have to wait while the client processes events, and the client does
+ * not have to wait in read() when the receive buffer runs dry.
+ *
+ * @client          Connection context structure.
+ * @ring_size       Size of the buffer holding complete messages read
+ *                  ahead.  At least twice the maximum message size is
+ *                  used.
+ *
+ * Must be called after ext_data_setup().  After this call, the file
+ * descriptor belongs to the thread, which is stopped by
+ * ext_data_close().  ext_data_nonblocking_fd() cannot be used.
+ *
+ * Return value:
+ *  0  success.
+ * -1  failure, see errno.
+ *
+ * EBUSY            Prefetch already running.
+ * EINVAL           Client reads from a mapped file.
+ * ENOMEM           Failure to allocate memory.
+ *
+ * Other error codes come from pthread_create().
+ */
+
+int ext_data_prefetch(struct ext_data_client *client, size_t ring_size);
+
+/*************************************************************************/
+
 /* Tell which structure will be returned next.
  * Structures not registered with ext_data_setup will be ignored.
  *
@@ -574,6 +677,205 @@ int ext_data_fetch_event(struct ext_data_client *client,
 
 /*************************************************************************/
 
+/* Fetch several events into consecutive slots of a user-provided
+ * buffer.  Mostly to move per-event overhead out of interpreted
+ * callers, which then can work on all events of a batch at once.
+ *
+ * @client          Connection context structure.
+ * @buf             Pointer to the first slot.
+ * @size            Size of the structure, as for ext_data_fetch_event().
+ * @stride          Distance between slots, at least @size.
+ * @max_events      Number of slots.
+ * @struct_id       As for ext_data_fetch_event().
+ * @accept          If not NULL, called for each fetched event (with
+ *                  the pointer to its slot).  Events for which it
+ *                  returns 0 are dropped, and the slot reused.
+ * @accept_arg      Passed to @accept.
+ *
+ * As with ext_data_fetch_event(), a slot only gets the items that are
+ * transmitted for its event; other items are left as they were.
+ *
+ * Return value:
+ *
+ *  n  number of events fetched, 1 <= n <= @max_events.  Less than
+ *     @max_events at end-of-data, on a failure, or when no further
+ *     data is available (after using ext_data_nonblocking_fd()).
+ *     A failure after some events is reported by the next call.
+ *  0  end-of-data.
+ * -1  failure.  See errno, as for ext_data_fetch_event().
+ *
+ * EINVAL           @stride or @max_events is wrong.
+ */
+
+#if !STRUCT_WRITER
+int ext_data_fetch_events(struct ext_data_client *client,
+			  void *buf,size_t size,size_t stride,
+			  int max_events,int struct_id,
+			  int (*accept)(const void *event,void *arg),
+			  void *accept_arg);
+#endif
+
+/*************************************************************************/
+
+/* Filter events while they are fetched, and decode bit-packed events
+ * in two phases: first only the words up to the end of the given
+ * items, which then are checked by @accept.  The rest of the event is
+ * only decoded if it is accepted.  Other events are decoded
+ * completely before the check.  Rejected events are consumed, and
+ * ext_data_fetch_event() continues with the next one.
+ *
+ * @client          Connection context structure.
+ * @struct_id       As for ext_data_fetch_event().
+ * @ranges          @n pairs of (offset, length) in the destination
+ *                  structure, of the items @accept reads.
+ * @n               Number of ranges.
+ * @accept          Called with the destination structure, in which
+ *                  (only) the items of @ranges are valid.  Returns
+ *                  0 to drop the event.  NULL removes the filter.
+ * @accept_arg      Passed to @accept.
+ *
+ * Return value:
+ *
+ *  0  success.
+ * -1  failure.  See errno.
+ *
+ * EINVAL           @struct_id is wrong, or a range is outside the
+ *                  structure.
+ * EFAULT           @client is NULL, or has not had setup.
+ */
+
+#if !STRUCT_WRITER
+int ext_data_set_prefilter(struct ext_data_client *client,int struct_id,
+			   const uint32_t *ranges,int n,
+			   int (*accept)(const void *event,void *arg),
+			   void *accept_arg);
+#endif
+
+/*************************************************************************/
+
+/* Track which parts of the destination structure the events change.
+ * A caller that maps the items of each event can then skip the items
+ * of which no word changed, e.g. arrays that stay empty.  Bit-packed
+ * events are compared word by word while they are decoded (the words
+ * not sent keep their values, and do not count).
+ *
+ * @client          Connection context structure.
+ * @struct_id       As for ext_data_fetch_event().
+ * @words           Set to the size of the bitmap, in 64-bit words.
+ *
+ * The structure is divided in blocks of EXT_DATA_DIRTY_BLOCK_SIZE
+ * bytes, and ext_data_fetch_event() sets the bit of each block in
+ * which it changes a word (bit b%64 of word b/64 for block b).
+ * Events that are not bit-packed, or with a structure mapping
+ * (different server layout), set all bits.  The caller clears the
+ * bits after handling an event; until then they accumulate, also over
+ * events dropped by the prefilter.  Initially all bits are set.
+ * ext_data_fetch_events() does not compare, as its slots are not the
+ * buffer of ext_data_fetch_event(), and sets all bits.  Calling it
+ * again gives the same bitmap.
+ *
+ * Return value:
+ *
+ *  The bitmap, owned by @client.
+ *  NULL on failure.  See errno.
+ *
+ * EINVAL           @struct_id is wrong.
+ * EFAULT           @client is NULL, or has not had setup.
+ * ENOMEM           Memory allocation failure.
+ */
+
+#define EXT_DATA_DIRTY_BLOCK_SHIFT  6
+#define EXT_DATA_DIRTY_BLOCK_SIZE   (1 << EXT_DATA_DIRTY_BLOCK_SHIFT)
+
+#if !STRUCT_WRITER
+uint64_t *ext_data_track_dirty(struct ext_data_client *client,int struct_id,
+			       size_t *words);
+#endif
+
+/*************************************************************************/
+
+/* Skip events without unpacking them.  Works for all sources, for
+ * mapped files (ext_data_from_file()) known positions are used
+ * directly.
+ *
+ * @client          Connection context structure.
+ * @n               Number of events (messages) to skip.
+ *
+ * Events are counted as event messages, whatever structure they are
+ * for, and without any filtering by the caller.
+ *
+ * Return value:
+ *
+ *  1  success.
+ *  0  end-of-data reached before.
+ * -1  failure.  See errno, as for ext_data_fetch_event().
+ */
+
+int ext_data_skip_events(struct ext_data_client *client,uint64_t n);
+
+/* Position at an event of a mapped file (ext_data_from_file()), such
+ * that the next fetch gives that event.
+ *
+ * @client          Connection context structure.
+ * @event_no        Number of the event (message), 0 is the first
+ *                  one, i.e. 0 rewinds.
+ *
+ * The message offsets of all events passed are kept in an index, so
+ * going back, or forward to an event seen before, is immediate.
+ * Events beyond are found by walking the messages from the last
+ * known one.
+ *
+ * Return value:
+ *
+ *  1  success.
+ *  0  end-of-data reached before @event_no.  Positioned at the end.
+ * -1  failure.  See errno.
+ *
+ * ESPIPE           Not a mapped file.
+ */
+
+int ext_data_seek_event(struct ext_data_client *client,uint64_t event_no);
+
+/* Number of the next event to be fetched (or skipped).  Also counts
+ * for sources that cannot seek.
+ */
+
+uint64_t ext_data_tell_event(struct ext_data_client *client);
+
+/* Measure the time spent blocked in read(), or waiting for the
+ * prefetch thread, with @clock (in its units, NULL to stop, which is
+ * the default).  ext_data_wait_time() gives the sum so far.
+ */
+
+void ext_data_set_wait_clock(struct ext_data_client *client,
+			     uint64_t (*clock)(void));
+
+uint64_t ext_data_wait_time(struct ext_data_client *client);
+
+/* Complete the index of a mapped file (ext_data_from_file()), by
+ * walking all messages once, without unpacking.  The position is
+ * kept.
+ *
+ * @client          Connection context structure.
+ * @sidecar         If not NULL, name of a file with the index.  If it
+ *                  is valid for the mapped file, it is used instead
+ *                  of the walk.  Otherwise, it is (re-)written after
+ *                  the walk.  Failure to write it is not reported.
+ *
+ * Return value:
+ *
+ *  n  number of events in the file.
+ * -1  failure.  See errno.
+ *
+ * ESPIPE           Not a mapped file.
+ * EBADMSG          Walk stopped before end of data, malformed message.
+ */
+
+int64_t ext_data_index_events(struct ext_data_client *client,
+			      const char *sidecar);
+
+/*************************************************************************/
+
 /* Get the ancillary raw data (if any) associated with the last
  * fetched event.
  *
@@ -770,6 +1072,78 @@ const char *ext_data_last_error(struct ext_data_client *client);
 
 /*************************************************************************/
 
+#ifdef EXT_DATA_CLIENT_INTERNALS
+
+/* Unpack the bit-packed (compact) event format into @dest.
+ * Returns 0 on success, negative on malformed data.
+ */
+
+int ext_data_write_bitpacked_event(char *dest,size_t dest_size,
+				   uint8_t *src,uint8_t *end_src);
+
+/* Choose the implementation used by ext_data_write_bitpacked_event().
+ *
+ * @name            "scalar", "ssse3", "avx2", or NULL (or "") for
+ *                  "ssse3" if the CPU has it, else "scalar".  The
+ *                  "avx2" version is only used when asked for, it
+ *                  is slower on some CPUs.  Default is NULL,
+ *                  unless overridden by the environment variable
+ *                  EXT_DATA_BITPACKED.
+ *
+ * Return value:
+ *  0  success.
+ * -1  failure, errno EINVAL: unknown or not supported by the CPU.
+ */
+
+int ext_data_select_bitpacked(const char *name);
+
+/* Unpack a not bit-packed event into @dest (the server layout), using
+ * the pack list.  Returns 0 on success, non-zero on malformed data.
+ */
+
+int ext_data_write_packed_event(struct ext_data_client *client,
+				char *dest,
+				int struct_id,
+				uint32_t *src,uint32_t *end_src);
+
+/* The single stages of ext_data_fetch_event(), to measure them in
+ * isolation (ext_data_bench).
+ *
+ * ext_data_fetch_event_data() takes the next event message of
+ * @struct_id without unpacking it.  @src..@end_src is the event data,
+ * for ext_data_write_bitpacked_event() (of @packed_len bytes) or, with
+ * @packed_len -1, for ext_data_write_packed_event().  The raw data is
+ * available with ext_data_get_raw_data().  The data stays valid until
+ * the next call, and for mapped files (ext_data_from_file()) as long
+ * as the client.  Returns 1 for an event, 0 at the end, -1 on failure.
+ *
+ * ext_data_unpack_array() gives the buffer events are unpacked into
+ * when the server structure is different from the destination, and
+ * its size.  NULL if they are unpacked directly into the destination.
+ * ext_data_map_event() then copies the items from it to @buf.
+ *
+ * ext_data_ntohl_copy() is the byte swap of ext_data_get_raw_data().
+ */
+
+#if !STRUCT_WRITER
+int ext_data_fetch_event_data(struct ext_data_client *client,
+			      int struct_id,
+			      uint32_t **src,uint32_t **end_src,
+			      int *packed_len);
+
+void *ext_data_unpack_array(struct ext_data_client *client,
+			    int struct_id,size_t *size);
+
+void ext_data_map_event(struct ext_data_client *client,
+			void *buf,int struct_id);
+#endif
+
+void ext_data_ntohl_copy(uint32_t *dest,const uint32_t *src,size_t n);
+
+#endif
+
+/*************************************************************************/
+
 /* The following functions are the same as those above, except that
  * errors are caught and messages printed to stderr.
  *
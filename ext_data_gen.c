@@ -0,0 +1,377 @@
+/* Generator for synthetic STRUCT streams.
+ *
+ * Describes a structure with the requested number of items of each
+ * kind the unpacker produces, and writes random events with
+ * ext_data_open_out() / ext_data_write_event() to stdout.  The output
+ * can be read like the one of an unpacker (--ntuple=RAW,STRUCT,-),
+ * e.g. with H101(path=...) after redirecting it to a file.
+ *
+ * Items (n counts from 1):
+ *
+ * EVENTNO, TRIGGER           always
+ * SCALARn                    single values
+ * VECn, VECnv                variable length arrays
+ * ZSn, ZSnI, ZSnv            zero suppressed arrays
+ * MHn, MHnv, MHnM,
+ * MHnMI, MHnME               zero suppressed multi hit arrays
+ * TIMESTAMP_WRn_ID,
+ * TIMESTAMP_WRn_WR_T1..4     white rabbit timestamps
+ *
+ * Usage: ext_data_gen [options] > file.struct
+ *
+ * -n events     Number of events (100000).
+ * -s scalars    Number of single value items (16).
+ * -v vectors    Number of variable length arrays (4).
+ * -z zs         Number of zero suppressed arrays (4).
+ * -m multi      Number of zero suppressed multi hit arrays (4).
+ * -w wr         Number of white rabbit timestamps (2).
+ * -c channels   Array size (channels) of the arrays (64).
+ * -o occupancy  Fraction of channels with data (0.25).
+ * -h hits       Mean number of hits per channel with data (2).
+ * -r seed       Random seed (12345).
+ * -p            Write bit-packed events (as the unpacker does).
+ */
+
+#include "ext_data_client.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define GEN_NAME_LEN 64
+
+enum gen_kind
+{
+  GEN_SCALAR,
+  GEN_VECTOR,
+  GEN_ZS,
+  GEN_MULTI,
+  GEN_WR,
+};
+
+/* One described item group, and where its words are in the buffer. */
+struct gen_item
+{
+  enum gen_kind _kind;
+  uint32_t _n;      /* offset of the count (the value for scalars) */
+  uint32_t _i;      /* offset of indices (ZS), channel count (multi) */
+  uint32_t _v;      /* offset of values */
+  uint32_t _mi;     /* multi: offset of channel indices */
+  uint32_t _me;     /* multi: offset of channel hit ends */
+};
+
+static uint32_t gen_rand_state = 12345;
+
+static uint32_t gen_rand(void)
+{
+  /* xorshift32 - just needs to be deterministic */
+  uint32_t x = gen_rand_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return gen_rand_state = x;
+}
+
+static double gen_uniform(void)
+{
+  return gen_rand() / 4294967296.;
+}
+
+static uint32_t gen_size = 0; /* bytes allocated in the structure */
+
+static uint32_t gen_add(struct ext_data_structure_info *struct_info,
+			const char *name, const char *ctrl,
+			uint32_t words, int limit)
+{
+  uint32_t offset = gen_size;
+
+  if (ext_data_struct_info_item(struct_info, offset,
+				words * sizeof (uint32_t),
+				EXT_DATA_ITEM_TYPE_UINT32,
+				"", -1, name, ctrl, limit, 0) != 0)
+    {
+      fprintf (stderr, "ext_data_gen: item %s: %s\n", name,
+	       ext_data_struct_info_last_error(struct_info));
+      exit(1);
+    }
+  gen_size += words * (uint32_t) sizeof (uint32_t);
+  return offset;
+}
+
+#define GEN_WORD(buf, offset) (*(uint32_t *) ((char *) (buf) + (offset)))
+
+/* Channels with data, for ZS and multi hit arrays. */
+static uint32_t gen_channels(uint32_t *ch, uint32_t channels,
+			     double occupancy)
+{
+  uint32_t i, n = 0;
+
+  for (i = 0; i < channels; i++)
+    if (gen_uniform() < occupancy)
+      ch[n++] = i;
+  return n;
+}
+
+static void gen_fill(void *buf, const struct gen_item *it,
+		     uint32_t channels, double occupancy,
+		     double hits, uint64_t eventno, uint32_t *ch)
+{
+  uint32_t i, j, n;
+
+  switch (it->_kind)
+    {
+    case GEN_SCALAR:
+      GEN_WORD(buf, it->_n) = gen_rand() & 0xfff;
+      break;
+    case GEN_VECTOR:
+      n = gen_channels(ch, channels, occupancy);
+      GEN_WORD(buf, it->_n) = n;
+      for (i = 0; i < n; i++)
+	GEN_WORD(buf, it->_v + 4 * i) = gen_rand() & 0xfff;
+      break;
+    case GEN_ZS:
+      n = gen_channels(ch, channels, occupancy);
+      GEN_WORD(buf, it->_n) = n;
+      for (i = 0; i < n; i++)
+	{
+	  GEN_WORD(buf, it->_i + 4 * i) = ch[i] + 1;
+	  GEN_WORD(buf, it->_v + 4 * i) = gen_rand() & 0xfff;
+	}
+      break;
+    case GEN_MULTI:
+      {
+	/* Hits per channel uniform in 1..2*hits-1, i.e. mean hits.
+	 * The total is limited by the value array.
+	 */
+	uint32_t max_hits = (uint32_t) (2 * hits + 0.5) * channels;
+	uint32_t spread = (uint32_t) (2 * hits - 1 + 0.5);
+	uint32_t total = 0;
+
+	if (!spread)
+	  spread = 1;
+
+	n = gen_channels(ch, channels, occupancy);
+	for (i = 0; i < n; i++)
+	  {
+	    uint32_t k = 1 + gen_rand() % spread;
+
+	    if (total + k > max_hits)
+	      k = max_hits - total;
+	    if (!k)
+	      break;
+	    GEN_WORD(buf, it->_mi + 4 * i) = ch[i] + 1;
+	    for (j = 0; j < k; j++)
+	      GEN_WORD(buf, it->_v + 4 * (total + j)) = gen_rand() & 0xfff;
+	    total += k;
+	    GEN_WORD(buf, it->_me + 4 * i) = total;
+	  }
+	GEN_WORD(buf, it->_i) = i;
+	GEN_WORD(buf, it->_n) = total;
+      }
+      break;
+    case GEN_WR:
+      {
+	/* 5 ns per event, 1/8 of the timestamps absent. */
+	uint64_t t = 1700000000000000000ull + eventno * 5000 +
+	  (gen_rand() & 0xff);
+	int present = (gen_rand() & 7) != 0;
+
+	GEN_WORD(buf, it->_n) = present ? 0x100 : 0;
+	for (i = 0; i < 4; i++)
+	  GEN_WORD(buf, it->_v + 4 * i) =
+	    present ? (uint32_t) (t >> (16 * i)) & 0xffff : 0;
+      }
+      break;
+    }
+}
+
+static void gen_usage(const char *cmd)
+{
+  fprintf (stderr,
+	   "Usage: %s [-n events] [-s scalars] [-v vectors] [-z zs] "
+	   "[-m multi] [-w wr]\n"
+	   "       [-c channels] [-o occupancy] [-h hits] [-r seed] [-p] "
+	   "> file.struct\n", cmd);
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  uint64_t events = 100000, e;
+  uint32_t scalars = 16, vectors = 4, zs = 4, multi = 4, wr = 2;
+  uint32_t channels = 64;
+  double occupancy = 0.25, hits = 2;
+  int bitpacked = 0;
+  uint32_t num_items, i, j;
+  uint32_t eventno_off, trigger_off;
+  struct ext_data_structure_info *struct_info;
+  struct ext_data_client *client;
+  struct gen_item *items;
+  uint32_t *ch;
+  void *buf;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:v:z:m:w:c:o:h:r:p")) != -1)
+    {
+      switch (opt)
+	{
+	case 'n': events    = strtoull(optarg, NULL, 0); break;
+	case 's': scalars   = (uint32_t) atoi(optarg); break;
+	case 'v': vectors   = (uint32_t) atoi(optarg); break;
+	case 'z': zs        = (uint32_t) atoi(optarg); break;
+	case 'm': multi     = (uint32_t) atoi(optarg); break;
+	case 'w': wr        = (uint32_t) atoi(optarg); break;
+	case 'c': channels  = (uint32_t) atoi(optarg); break;
+	case 'o': occupancy = atof(optarg); break;
+	case 'h': hits      = atof(optarg); break;
+	case 'r': gen_rand_state = (uint32_t) strtoul(optarg, NULL, 0); break;
+	case 'p': bitpacked = 1; break;
+	default:
+	  gen_usage(argv[0]);
+	}
+    }
+
+  if (optind != argc || channels < 1 || hits < 1 ||
+      occupancy < 0 || occupancy > 1 || !gen_rand_state)
+    gen_usage(argv[0]);
+
+  if (isatty(STDOUT_FILENO))
+    {
+      fprintf (stderr, "ext_data_gen: not writing binary data to a terminal.\n");
+      return 1;
+    }
+
+  struct_info = ext_data_struct_info_alloc();
+  num_items = scalars + vectors + zs + multi + wr;
+  items = (struct gen_item *) calloc (num_items + 1, sizeof (struct gen_item));
+  ch = (uint32_t *) malloc (channels * sizeof (uint32_t));
+
+  if (!struct_info || !items || !ch)
+    {
+      perror("malloc");
+      return 1;
+    }
+
+  eventno_off = gen_add(struct_info, "EVENTNO", "", 1, -1);
+  trigger_off = gen_add(struct_info, "TRIGGER", "", 1, -1);
+
+  j = 0;
+  for (i = 1; i <= scalars; i++, j++)
+    {
+      char name[GEN_NAME_LEN];
+
+      snprintf(name, sizeof (name), "SCALAR%u", i);
+      items[j]._kind = GEN_SCALAR;
+      items[j]._n = gen_add(struct_info, name, "", 1, -1);
+    }
+  for (i = 1; i <= vectors; i++, j++)
+    {
+      char name[GEN_NAME_LEN], sub[GEN_NAME_LEN + 4];
+
+      snprintf(name, sizeof (name), "VEC%u", i);
+      items[j]._kind = GEN_VECTOR;
+      items[j]._n = gen_add(struct_info, name, "", 1, (int) channels);
+      snprintf(sub, sizeof (sub), "%sv", name);
+      items[j]._v = gen_add(struct_info, sub, name, channels, -1);
+    }
+  for (i = 1; i <= zs; i++, j++)
+    {
+      char name[GEN_NAME_LEN], sub[GEN_NAME_LEN + 4];
+
+      snprintf(name, sizeof (name), "ZS%u", i);
+      items[j]._kind = GEN_ZS;
+      items[j]._n = gen_add(struct_info, name, "", 1, (int) channels);
+      snprintf(sub, sizeof (sub), "%sI", name);
+      items[j]._i = gen_add(struct_info, sub, name, channels, -1);
+      snprintf(sub, sizeof (sub), "%sv", name);
+      items[j]._v = gen_add(struct_info, sub, name, channels, -1);
+    }
+  for (i = 1; i <= multi; i++, j++)
+    {
+      char name[GEN_NAME_LEN], sub[GEN_NAME_LEN + 4], msub[GEN_NAME_LEN + 4];
+      uint32_t max_hits = (uint32_t) (2 * hits + 0.5) * channels;
+
+      snprintf(name, sizeof (name), "MH%u", i);
+      items[j]._kind = GEN_MULTI;
+      items[j]._n = gen_add(struct_info, name, "", 1, (int) max_hits);
+      snprintf(sub, sizeof (sub), "%sv", name);
+      items[j]._v = gen_add(struct_info, sub, name, max_hits, -1);
+      snprintf(msub, sizeof (msub), "%sM", name);
+      items[j]._i = gen_add(struct_info, msub, "", 1, (int) channels);
+      snprintf(sub, sizeof (sub), "%sMI", name);
+      items[j]._mi = gen_add(struct_info, sub, msub, channels, -1);
+      snprintf(sub, sizeof (sub), "%sME", name);
+      items[j]._me = gen_add(struct_info, sub, msub, channels, -1);
+    }
+  for (i = 1; i <= wr; i++, j++)
+    {
+      char name[GEN_NAME_LEN];
+      uint32_t k;
+
+      items[j]._kind = GEN_WR;
+      snprintf(name, sizeof (name), "TIMESTAMP_WR%u_ID", i);
+      items[j]._n = gen_add(struct_info, name, "", 1, -1);
+      for (k = 1; k <= 4; k++)
+	{
+	  snprintf(name, sizeof (name), "TIMESTAMP_WR%u_WR_T%u", i, k);
+	  if (k == 1)
+	    items[j]._v = gen_add(struct_info, name, "", 1, -1);
+	  else
+	    gen_add(struct_info, name, "", 1, -1);
+	}
+    }
+
+  buf = calloc (1, gen_size);
+  client = ext_data_open_out();
+
+  if (!buf || !client)
+    {
+      perror("ext_data_open_out");
+      return 1;
+    }
+
+  if (ext_data_write_bitpacked(client, bitpacked) != 0 ||
+      ext_data_setup(client, NULL, 0, struct_info, NULL, gen_size,
+		     "", NULL) != 0)
+    {
+      fprintf (stderr, "ext_data_gen: setup: %s\n",
+	       ext_data_last_error(client));
+      return 1;
+    }
+
+  for (e = 0; e < events; e++)
+    {
+      if (ext_data_clear_event(client, buf, gen_size, 0, 0) != 0)
+	{
+	  fprintf (stderr, "ext_data_gen: clear: %s\n",
+		   ext_data_last_error(client));
+	  return 1;
+	}
+
+      GEN_WORD(buf, eventno_off) = (uint32_t) (e + 1);
+      GEN_WORD(buf, trigger_off) = 1 + (gen_rand() % 16 == 0);
+
+      for (i = 0; i < num_items; i++)
+	gen_fill(buf, &items[i], channels, occupancy, hits, e, ch);
+
+      if (ext_data_write_event(client, buf, gen_size) != (int) gen_size)
+	{
+	  fprintf (stderr, "ext_data_gen: write: %s\n",
+		   ext_data_last_error(client));
+	  return 1;
+	}
+    }
+
+  if (ext_data_close(client) != 0)
+    {
+      perror("ext_data_close");
+      return 1;
+    }
+
+  ext_data_struct_info_free(struct_info);
+  free(items);
+  free(ch);
+  free(buf);
+  return 0;
+}
@@ -1,7 +1,7 @@
 from _h101 import *
 
 import numpy, math, sys, os, os.path, subprocess
-import traceback, copy
+import traceback, copy, collections.abc
 import h101.trigger_map
 from  h101.tdc_cal import *
 
@@ -10,8 +10,12 @@ if not 'UCESB_DIR' in os.environ:
 
 ucesb=os.environ['UCESB_DIR']
 
+collections.abc.Mapping.register(ZSDict)
+collections.abc.Mapping.register(MultiDict)
+collections.abc.Sequence.register(HitList)
 
-def mkh101(inputs, unpacker=None, options=""):
+
+def mkh101(inputs, unpacker=None, options="", native_tdc=True):
         if unpacker == None:
             if not 'EXP_NAME' in os.environ:
                 raise RuntimeError("No unpacker specified, and EXP_NAME is not set.")
@@ -29,9 +33,9 @@ def mkh101(inputs, unpacker=None, options=""):
         res.unpacker=sp
         t=test_iteminfo()
         t.register(res)
-        n=tdc_iteminfo.addFields(res)
+        n=tdc_iteminfo.addFields(res, native=native_tdc)
         print("Added %d single edge TDC arrays"%n)
-        n=tot_iteminfo.addFields(res)
+        n=tot_iteminfo.addFields(res, native=native_tdc)
         print("Added %d dual edge TDC arrays"%n)
         return res
  
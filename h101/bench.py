@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+# Benchmark of the mapping, per kind of field, on synthetic STRUCT streams.
+#
+# The streams are written by ext_data_gen (make ext_data_gen) to temporary
+# files, so the numbers do not depend on an unpacker or on LMD files:
+#
+#   python3 -m h101.bench [--gen ./ext_data_gen] [-n 200000] [-- gen options]
+#
+# For each kind, getevent (the dict) and getbatch (numpy columns) are timed
+# over the whole file, and events/s and ns/event are printed, with the
+# decode and map parts from H101.stats().
+#
+# With --check, short streams are read and the results compared as well
+# (make test): _REL values from getevent and getbatch, reading through
+# a pipe (with and without prefetch) against the file, and the operator
+# precedence of addexpr.
+
+import argparse, math, os, subprocess, sys, tempfile, time
+from _h101 import H101
+
+# name, ext_data_gen options for a stream with only that kind of field
+kinds=[("scalar", "-s 64 -v 0 -z 0 -m 0 -w 0"),
+       ("vector", "-s 0 -v 8 -z 0 -m 0 -w 0"),
+       ("zs",     "-s 0 -v 0 -z 8 -m 0 -w 0"),
+       ("multi",  "-s 0 -v 0 -z 0 -m 8 -w 0"),
+       ("wr",     "-s 0 -v 0 -z 0 -m 0 -w 16"),
+       ("mixed",  "")]
+
+def run_getevent(path):
+    h=H101(path=path)
+    h.timing=1
+    h.getdict()
+    t0=time.perf_counter()
+    while h.getevent():
+        pass
+    return time.perf_counter()-t0, h.stats()
+
+def run_getbatch(path, batch):
+    h=H101(path=path)
+    h.timing=1
+    t0=time.perf_counter()
+    while h.getbatch(batch) is not None:
+        pass
+    return time.perf_counter()-t0, h.stats()
+
+def gen_stream(gen, path, opts):
+    with open(path, "wb") as f:
+        subprocess.check_call([gen]+opts, stdout=f)
+
+# getbatch must give the same white rabbit _REL values as getevent, also
+# if the first timestamps of the stream are absent (in some seeds)
+def check_rel(gen, tmp):
+    path=os.path.join(tmp, "rel.struct")
+    for seed in range(1, 33):
+        gen_stream(gen, path, ["-n", "100", "-w", "2", "-r", str(seed)])
+        h=H101(path=path)
+        d=h.getdict()
+        names=[k for k in d if k.endswith("_REL")]
+        ev={k: [] for k in names}
+        while h.getevent():
+            for k in names:
+                ev[k].append(float(d[k]))
+        h=H101(path=path)
+        bt={k: [] for k in names}
+        while True:
+            cols=h.getbatch(30)
+            if cols is None:
+                break
+            for k in names:
+                bt[k].extend(float(x) for x in cols[k])
+        same=lambda a, b: a==b or (math.isnan(a) and math.isnan(b))
+        for k in names:
+            if len(ev[k])!=len(bt[k]) or not all(map(same, ev[k], bt[k])):
+                sys.exit("check failed: %s differs between getevent and getbatch (-r %d)"%(k, seed))
+    os.unlink(path)
+    print("check    _REL      getevent==getbatch")
+
+# reading from a pipe (H101(fd=...)), with and without the prefetch
+# thread, must give the events of the file
+def check_pipe(gen, tmp):
+    path=os.path.join(tmp, "pipe.struct")
+    for packed in ([], ["-p"]):
+        opts=["-n", "3000"]+packed
+        gen_stream(gen, path, opts)
+        h=H101(path=path)
+        want=[]
+        while (cols:=h.getbatch(1000)) is not None:
+            want.extend(zip(cols["EVENTNO"], cols["SCALAR1"]))
+        for prefetch in (0, 1):
+            sp=subprocess.Popen([gen]+opts, stdout=subprocess.PIPE)
+            h=H101(fd=sp.stdout.fileno(), prefetch=prefetch)
+            d=h.getdict()
+            got=[]
+            while h.getevent():
+                got.append((int(d["EVENTNO"]), int(d["SCALAR1"])))
+            sp.stdout.close()
+            sp.wait()
+            if got!=want:
+                sys.exit("check failed: pipe%s, prefetch=%d: %d of %d events differ"%(
+                    " ".join([""]+packed), prefetch,
+                    sum(a!=b for a, b in zip(got, want))+abs(len(got)-len(want)), len(want)))
+    os.unlink(path)
+    print("check    pipe      prefetch=0,1 == file")
+
+# the operators of addexpr have the precedence of C
+def check_expr(gen, tmp):
+    path=os.path.join(tmp, "expr.struct")
+    gen_stream(gen, path, ["-n", "1"])
+    exprs=[("5==1<2", 0), ("1<2==1", 1), ("3>2!=0<1", 0),
+           ("2!=1>0", 1), ("1<2<3", 1), ("3==3==1", 1),
+           ("1+2*3<<1", 14), ("6&3==3", 0), ("1|2^3&1", 3),
+           ("0||1&&0", 0)]
+    h=H101(path=path)
+    for i, (e, _) in enumerate(exprs):
+        h.addexpr("EXPR%d"%i, e)
+    d=h.getdict()
+    if not h.getevent():
+        sys.exit("check failed: expr: no event")
+    for i, (e, want) in enumerate(exprs):
+        if d["EXPR%d"%i]!=want:
+            sys.exit("check failed: expr %s gives %s, not %s"%(e, d["EXPR%d"%i], want))
+    os.unlink(path)
+    print("check    expr      C precedence")
+
+def report(kind, method, elapsed, st):
+    n=st["events"]
+    if not n:
+        print("%-8s %-9s no events"%(kind, method))
+        return
+    print("%-8s %-9s %10d %12.0f %10.1f %10.1f %10.1f"%(
+        kind, method, n, n/elapsed, 1e9*elapsed/n,
+        1e9*st["decode"]/n, 1e9*st["map"]/n))
+
+def main(argv=None):
+    p=argparse.ArgumentParser(description="Benchmark the mapping per kind of field on synthetic STRUCT streams.")
+    p.add_argument("--gen", default="./ext_data_gen",
+                   help="path of the ext_data_gen binary")
+    p.add_argument("-n", "--events", type=int, default=200000)
+    p.add_argument("-b", "--batch", type=int, default=10000, help="getbatch size")
+    p.add_argument("--check", action="store_true",
+                   help="also check the results on short streams")
+    p.add_argument("-k", "--kinds", default=",".join(k for k, _ in kinds),
+                   help="comma separated list of kinds to run")
+    p.add_argument("genopts", nargs=argparse.REMAINDER,
+                   help="further ext_data_gen options (after --), e.g. -c 128 -o 0.5 -h 4")
+    args=p.parse_args(argv)
+    extra=[o for o in args.genopts if o!="--"]
+    selected=args.kinds.split(",")
+    unknown=set(selected)-set(k for k, _ in kinds)
+    if unknown:
+        p.error("unknown kinds: %s"%", ".join(sorted(unknown)))
+
+    print("%-8s %-9s %10s %12s %10s %10s %10s"%(
+        "kind", "method", "events", "events/s", "ns/event", "decode", "map"))
+    with tempfile.TemporaryDirectory() as tmp:
+        for kind, opts in kinds:
+            if not kind in selected:
+                continue
+            path=os.path.join(tmp, kind+".struct")
+            gen_stream(args.gen, path, ["-n", str(args.events)]+opts.split()+extra)
+            report(kind, "getevent", *run_getevent(path))
+            report(kind, "getbatch", *run_getbatch(path, args.batch))
+            os.unlink(path)
+            sys.stdout.flush()
+        if args.check:
+            check_rel(args.gen, tmp)
+            check_pipe(args.gen, tmp)
+            check_expr(args.gen, tmp)
+
+if __name__=="__main__":
+    main()
@@ -1,4 +1,5 @@
 from h101.iteminfo import *
+from _h101 import HitList
 import math
 import random
 import re
@@ -12,9 +13,11 @@ stat_lifetime   = 1e5  # how long does a count contribute to the calibration?
 allcals={}
 
 def readcals(filename):
-    global allcals
+    # in place: the native calibrations (H101.addtdc) keep a reference
     with open(filename, "r") as f:
-        allcals=json.load(f)
+        cals=json.load(f)
+    allcals.clear()
+    allcals.update(cals)
 
 
 def writecals(filename):
@@ -121,7 +124,7 @@ class tdc_hit:
 
 class tdc_iteminfo(custom_iteminfo):
     def __init__(self, name, coarse, fine, is_trailing=False):
-        self.res=type(coarse)()
+        self.res=dict() # coarse may be a (read only) h101.ZSDict
         super().__init__(name, self.res)
         self.cals=dict()
         self.coarse=coarse
@@ -130,13 +133,15 @@ class tdc_iteminfo(custom_iteminfo):
         self.coarse_period   = 5 #ns
     @staticmethod
     def _listify(x):
-        if type(x)==list:
+        if type(x) in (list, HitList):
             return x
         return [x]
 
     def map_event(self):
         self.res.clear()
         for k in self.coarse.keys():
+            if not k in self.fine:
+                continue # no fine times, as in zip() below
             out=self.res[k]=[]
             if not k in self.cals:
                 self.cals[k]=finetime_cal(self.name+str(k))
@@ -149,16 +154,23 @@ class tdc_iteminfo(custom_iteminfo):
                 h.fine=f
                 out.append(h)
     @staticmethod
-    def addFields(myh101):
+    def addFields(myh101, native=True):
+        """Calibrated fields for all coarse/fine pairs. native: lists of
+        float64 times (H101.addtdc), else lists of tdc_hit as before."""
         count=0
         d=myh101.getdict()
         for k in list(d.keys()):
             base=k[0:-1]
             if not filterre.match(base):
                 continue
-            if k[-1]=="C" and (f:=d.get(base+"F"))!=None:
-                c=d[k]
-                tdc_iteminfo(base, c, f).register(myh101)
+            if k[-1]=="C" and base+"F" in d and not base in d:
+                if native:
+                    # calibrated natively, with the same parameters
+                    myh101.addtdc(base, k, base+"F", cals=allcals,
+                                  mincount=mincount, update_interval=update_interval,
+                                  stat_lifetime=stat_lifetime)
+                else:
+                    tdc_iteminfo(base, d[k], d[base+"F"]).register(myh101)
                 count+=1
         return count
 
@@ -192,43 +204,77 @@ class tot_iteminfo(custom_iteminfo):
             if len(out)>0: 
                 self.res[k]=out
     @staticmethod
-    def addFields(myh101):
+    def _edge_field(fields, fine):
+        """The calibrated field of a fine time mapname, or None."""
+        for suffix, name in (("FL", "%s_lead"), ("FT", "%s_lead"), ("FL", "%s"), ("F", "%s")):
+            if fine.endswith(suffix) and name%fine[:-len(suffix)] in fields:
+                return name%fine[:-len(suffix)]
+        return None
+    @staticmethod
+    def _addFields_python(myh101):
+        """tdc_hit objects with tot and totc, without trigger times."""
         count=0
         d=myh101.getdict()
-        added={}
         for k in list(d.keys()):
             if k[-2:]!="CL":
                 continue
             base=k[:-2]
-            if not filterre.match(base):
-                continue
-            cl=d.get(base+"CL") 
-            fl=d.get(base+"FL")
-            if cl==None or fl==None:
+            if not filterre.match(base) or not base+"FL" in d:
                 continue
-            ct=d.get(base+"CT")
-            ft=d.get(base+"FT")
-            if ct==None or ft==None:
-                leading=tdc_iteminfo(base, cl, fl)
-                leading.register(myh101, hidden=False)
+            if not base+"CT" in d or not base+"FT" in d:
+                if base in d:
+                    continue
+                tdc_iteminfo(base, d[k], d[base+"FL"]).register(myh101)
                 count+=1
-                print("registered %s"%sbase)
-                added.append[base+"FT"]=leading
                 continue
-            leading=tdc_iteminfo(base+"_lead", cl, fl)
+            leading=tdc_iteminfo(base+"_lead", d[k], d[base+"FL"])
             leading.register(myh101, hidden=True)
-            trailing=tdc_iteminfo(base+"_trail", ct, ft, is_trailing=True)
+            trailing=tdc_iteminfo(base+"_trail", d[base+"CT"], d[base+"FT"], is_trailing=True)
             trailing.register(myh101, hidden=True)
-            tot=tot_iteminfo(base+"_tot", leading, trailing)
-            tot.register(myh101, hidden=False)
+            tot_iteminfo(base+"_tot", leading, trailing).register(myh101)
             count+=1
-            added[base+"FT"]=tot
-        for name, info in added.items():
-            if name in myh101.triggermap and myh101.triggermap[name] in added:
-                info.trig=added[myh101.triggermap[name]]
         return count
-
-
-
-
-
+    @staticmethod
+    def addFields(myh101, native=True):
+        """ToT fields for all leading/trailing edge pairs. native: arrays
+        of the hits (H101.addtot), else lists of tdc_hit as before."""
+        if not native:
+            return tot_iteminfo._addFields_python(myh101)
+        count=0
+        d=myh101.getdict()
+        added=[]
+        params=dict(cals=allcals, mincount=mincount, update_interval=update_interval,
+                    stat_lifetime=stat_lifetime)
+        for k in list(d.keys()):
+            if k[-2:]!="CL":
+                continue
+            base=k[:-2]
+            if not filterre.match(base):
+                continue
+            if not base+"FL" in d:
+                continue
+            if not base+"CT" in d or not base+"FT" in d:
+                if base in d:
+                    continue
+                myh101.addtdc(base, base+"CL", base+"FL", **params)
+                count+=1
+                continue
+            # paired natively, the edges are available as base_lead, base_trail
+            myh101.addtot(base+"_tot", base+"CL", base+"FL", base+"CT", base+"FT",
+                          prefix=base, **params)
+            count+=1
+            added.append(base)
+        # triggermap: (fine time mapname, ch) -> (trigger fine time mapname, ch)
+        triggermap=myh101.triggermap or {}
+        fields=set(myh101.getdict().keys()) | {base+"_lead" for base in added}
+        for base in added:
+            trig={}
+            for (mapname, ch), (tmapname, tch) in triggermap.items():
+                if not mapname in (base+"FL", base+"FT"):
+                    continue
+                field=tot_iteminfo._edge_field(fields, tmapname)
+                if field:
+                    trig[ch]=(field, tch)
+            if trig:
+                myh101.settrig(base+"_tot", trig)
+        return count
@@ -1,5 +1,5 @@
 #!/usr/bin/python3
-import os.path, os
+import os.path, os, platform
 from setuptools import setup, Extension
 import sysconfig
 
@@ -13,6 +13,32 @@ ucesb=os.environ['UCESB_DIR']
 
 
 
+# H101_BUILD selects how the extension is compiled:
+#   release  (default) -O3 with link time optimization
+#   debug    -O0 -g, for valgrind (see python.supp) and gdb
+#   pgo-gen  release, instrumented to write profiles to H101_PGO_DIR
+#   pgo-use  release, optimized with the profiles in H101_PGO_DIR
+# "make pgo" does both pgo steps, training on ext_data_gen streams.
+
+build=os.environ.get("H101_BUILD", "release")
+pgodir=os.path.abspath(os.environ.get("H101_PGO_DIR", os.path.join(toplevel, "pgo-data")))
+
+modes={"debug":   ["-O0", "-fno-inline-small-functions"],
+       "release": ["-O3", "-flto=auto"],
+       "pgo-gen": ["-O3", "-flto=auto", "-fprofile-generate="+pgodir, "-fprofile-update=atomic"],
+       "pgo-use": ["-O3", "-flto=auto", "-fprofile-use="+pgodir, "-fprofile-correction",
+                   "-Wno-missing-profile"]}
+
+if not build in modes:
+    raise RuntimeError("H101_BUILD=%s, must be one of %s."%(build, ", ".join(modes)))
+
+optflags=modes[build]
+
+# With profiles, gcc expands the (short, variable length) memcpy of the
+# getbatch columns as "rep movsb", which is more than twice as slow.
+if build=="pgo-use" and platform.machine() in ("x86_64", "i686"):
+    optflags.append("-mstringop-strategy=libcall")
+
 # there has to be a better way to do this
 
 npinc="-I"+sysconfig.get_paths()["purelib"]+"/numpy/_core/include/"
@@ -23,14 +49,16 @@ setup(name="h101",
       packages=["h101"],
       ext_modules=[Extension(name="_h101", 
                              sources=["_h101module.cxx", "ext_data_client.c"],
-                             extra_compile_args=["-O0","-fno-inline-small-functions",
+                             extra_compile_args=optflags+[
                                                  "--std=c++2a",
                                                  "-g", "-Wno-unused-function", "-Wno-unused-variable", 
                                                  "-Wno-write-strings", # PyArg kw
                                                  "-I"+toplevel,
                                                  "-I"+ucesb+"/hbook",
+                                                 "-pthread", # ext_data_prefetch
                                                  npinc
                                                  ],
+                                          extra_link_args=optflags+["-pthread"],
                                           #include_dirs=[toplevel, ucesb+"/hbook"]
 #                                          extra_link_args=["-L${UCESB_DIR}/hbook -lext_data_clnt.so"]
                                           )])